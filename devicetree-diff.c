@@ -0,0 +1,293 @@
+/*
+ * devicetree-diff.c
+ * Brandon Azad
+ */
+#include "devicetree-diff.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+// A named item, either a child node or a property, to be matched up with the items of the other
+// tree.
+struct diff_item {
+	const char *name;
+	uint32_t length;
+	// The position of the item among its siblings.
+	uint32_t position;
+};
+
+struct diff_context {
+	const struct devicetree_index *old_index;
+	const struct devicetree_hashes *old_hashes;
+	const struct devicetree_index *new_index;
+	const struct devicetree_hashes *new_hashes;
+	devicetree_diff_callback_t callback;
+	// The path of the node being compared, without a trailing slash. The root's path is empty.
+	char *path;
+	size_t path_length;
+	size_t path_capacity;
+	bool identical;
+	bool stop;
+};
+
+#define PROPERTY_NAME_SIZE	sizeof(((struct devicetree_property *)NULL)->name)
+
+static int
+compare_items(const void *a, const void *b) {
+	const struct diff_item *item_a = a;
+	const struct diff_item *item_b = b;
+	uint32_t length = (item_a->length < item_b->length ? item_a->length : item_b->length);
+	int cmp = memcmp(item_a->name, item_b->name, length);
+	if (cmp != 0) {
+		return cmp;
+	}
+	if (item_a->length != item_b->length) {
+		return (item_a->length < item_b->length ? -1 : 1);
+	}
+	return (item_a->position < item_b->position ? -1 : 1);
+}
+
+static bool
+items_same_name(const struct diff_item *a, const struct diff_item *b) {
+	return (a->length == b->length && memcmp(a->name, b->name, a->length) == 0);
+}
+
+// Pair up the old and new items by name, matching the k-th item with a given name in the old list
+// with the k-th item with that name in the new list. On return, old_match[i] is the position of
+// the new item matching old item i, or DEVICETREE_INDEX_NONE, and likewise for new_match. The
+// item lists may be reordered.
+static void
+match_items(struct diff_item *old_items, uint32_t n_old, uint32_t *old_match,
+		struct diff_item *new_items, uint32_t n_new, uint32_t *new_match) {
+	// Usually the names are the same in the same order, which needs no sorting.
+	if (n_old == n_new) {
+		uint32_t i = 0;
+		while (i < n_old && items_same_name(&old_items[i], &new_items[i])) {
+			i++;
+		}
+		if (i == n_old) {
+			for (i = 0; i < n_old; i++) {
+				old_match[i] = i;
+				new_match[i] = i;
+			}
+			return;
+		}
+	}
+	for (uint32_t i = 0; i < n_old; i++) {
+		old_match[i] = DEVICETREE_INDEX_NONE;
+	}
+	for (uint32_t i = 0; i < n_new; i++) {
+		new_match[i] = DEVICETREE_INDEX_NONE;
+	}
+	// Sort both lists by name and then by position, and merge them.
+	qsort(old_items, n_old, sizeof(*old_items), compare_items);
+	qsort(new_items, n_new, sizeof(*new_items), compare_items);
+	uint32_t i = 0;
+	uint32_t j = 0;
+	while (i < n_old && j < n_new) {
+		struct diff_item *old_item = &old_items[i];
+		struct diff_item *new_item = &new_items[j];
+		if (items_same_name(old_item, new_item)) {
+			old_match[old_item->position] = new_item->position;
+			new_match[new_item->position] = old_item->position;
+			i++;
+			j++;
+		} else if (compare_items(old_item, new_item) < 0) {
+			i++;
+		} else {
+			j++;
+		}
+	}
+}
+
+static void
+path_push(struct diff_context *ctx, const char *name, size_t length) {
+	size_t needed = ctx->path_length + 1 + length + 1;
+	if (needed > ctx->path_capacity) {
+		size_t capacity = 2 * ctx->path_capacity;
+		if (capacity < needed) {
+			capacity = needed;
+		}
+		ctx->path = realloc(ctx->path, capacity);
+		assert(ctx->path != NULL);
+		ctx->path_capacity = capacity;
+	}
+	ctx->path[ctx->path_length] = '/';
+	memcpy(ctx->path + ctx->path_length + 1, name, length);
+	ctx->path_length += 1 + length;
+	ctx->path[ctx->path_length] = 0;
+}
+
+static void
+path_pop(struct diff_context *ctx, size_t length) {
+	ctx->path_length = length;
+	ctx->path[length] = 0;
+}
+
+static void
+report(struct diff_context *ctx, enum devicetree_diff_kind kind,
+		uint32_t old_node, uint32_t new_node,
+		uint32_t old_property, uint32_t new_property) {
+	struct devicetree_diff_entry entry = {
+		.kind         = kind,
+		.path         = (ctx->path_length > 0 ? ctx->path : "/"),
+		.old_node     = old_node,
+		.new_node     = new_node,
+		.old_property = old_property,
+		.new_property = new_property,
+	};
+	ctx->identical = false;
+	ctx->callback(&entry, &ctx->stop);
+}
+
+static uint32_t
+property_items(const struct devicetree_index *index, uint32_t id, struct diff_item **items) {
+	const struct devicetree_index_node *node = &index->nodes[id];
+	*items = malloc(node->n_properties * sizeof(**items));
+	assert(*items != NULL || node->n_properties == 0);
+	for (uint32_t i = 0; i < node->n_properties; i++) {
+		const struct devicetree_index_property *prop =
+			&index->properties[node->first_property + i];
+		const char *name = devicetree_index_property_name(index, prop);
+		(*items)[i].name     = name;
+		(*items)[i].length   = strnlen(name, PROPERTY_NAME_SIZE);
+		(*items)[i].position = i;
+	}
+	return node->n_properties;
+}
+
+// Collect the children of a node. children[i] is set to the ID of the i-th child.
+static uint32_t
+child_items(const struct devicetree_index *index, uint32_t id, struct diff_item **items,
+		uint32_t **children) {
+	const struct devicetree_index_node *node = &index->nodes[id];
+	*items = malloc(node->n_children * sizeof(**items));
+	*children = malloc(node->n_children * sizeof(**children));
+	assert((*items != NULL && *children != NULL) || node->n_children == 0);
+	uint32_t i = 0;
+	for (uint32_t child = id + 1; child < node->subtree_end;
+			child = index->nodes[child].subtree_end) {
+		devicetree_index_node_name(index, child, &(*items)[i].name, &(*items)[i].length);
+		(*items)[i].position = i;
+		(*children)[i] = child;
+		i++;
+	}
+	return i;
+}
+
+static void
+diff_properties(struct diff_context *ctx, uint32_t old_id, uint32_t new_id) {
+	const struct devicetree_index_node *old_node = &ctx->old_index->nodes[old_id];
+	const struct devicetree_index_node *new_node = &ctx->new_index->nodes[new_id];
+	struct diff_item *old_items;
+	struct diff_item *new_items;
+	uint32_t n_old = property_items(ctx->old_index, old_id, &old_items);
+	uint32_t n_new = property_items(ctx->new_index, new_id, &new_items);
+	uint32_t *old_match = malloc((n_old + n_new) * sizeof(*old_match));
+	assert(old_match != NULL || n_old + n_new == 0);
+	uint32_t *new_match = old_match + n_old;
+	match_items(old_items, n_old, old_match, new_items, n_new, new_match);
+	for (uint32_t i = 0; i < n_old && !ctx->stop; i++) {
+		if (old_match[i] == DEVICETREE_INDEX_NONE) {
+			report(ctx, DEVICETREE_DIFF_PROPERTY_REMOVED, old_id, new_id,
+					old_node->first_property + i, DEVICETREE_INDEX_NONE);
+		}
+	}
+	for (uint32_t i = 0; i < n_new && !ctx->stop; i++) {
+		uint32_t new_prop = new_node->first_property + i;
+		if (new_match[i] == DEVICETREE_INDEX_NONE) {
+			report(ctx, DEVICETREE_DIFF_PROPERTY_ADDED, old_id, new_id,
+					DEVICETREE_INDEX_NONE, new_prop);
+			continue;
+		}
+		uint32_t old_prop = old_node->first_property + new_match[i];
+		if (!devicetree_hash_equal(ctx->old_hashes->properties[old_prop],
+					ctx->new_hashes->properties[new_prop])) {
+			report(ctx, DEVICETREE_DIFF_PROPERTY_CHANGED, old_id, new_id,
+					old_prop, new_prop);
+		}
+	}
+	free(old_match);
+	free(old_items);
+	free(new_items);
+}
+
+static void
+diff_nodes(struct diff_context *ctx, uint32_t old_id, uint32_t new_id) {
+	// Identical subtrees are skipped entirely.
+	if (devicetree_hash_equal(ctx->old_hashes->nodes[old_id], ctx->new_hashes->nodes[new_id])) {
+		return;
+	}
+	diff_properties(ctx, old_id, new_id);
+	if (ctx->stop) {
+		return;
+	}
+	struct diff_item *old_items;
+	struct diff_item *new_items;
+	uint32_t *old_children;
+	uint32_t *new_children;
+	uint32_t n_old = child_items(ctx->old_index, old_id, &old_items, &old_children);
+	uint32_t n_new = child_items(ctx->new_index, new_id, &new_items, &new_children);
+	uint32_t *old_match = malloc((n_old + n_new) * sizeof(*old_match));
+	assert(old_match != NULL || n_old + n_new == 0);
+	uint32_t *new_match = old_match + n_old;
+	match_items(old_items, n_old, old_match, new_items, n_new, new_match);
+	size_t path_length = ctx->path_length;
+	for (uint32_t i = 0; i < n_old && !ctx->stop; i++) {
+		if (old_match[i] == DEVICETREE_INDEX_NONE) {
+			const char *name;
+			uint32_t length;
+			devicetree_index_node_name(ctx->old_index, old_children[i], &name, &length);
+			path_push(ctx, name, length);
+			report(ctx, DEVICETREE_DIFF_NODE_REMOVED, old_children[i],
+					DEVICETREE_INDEX_NONE,
+					DEVICETREE_INDEX_NONE, DEVICETREE_INDEX_NONE);
+			path_pop(ctx, path_length);
+		}
+	}
+	for (uint32_t i = 0; i < n_new && !ctx->stop; i++) {
+		const char *name;
+		uint32_t length;
+		devicetree_index_node_name(ctx->new_index, new_children[i], &name, &length);
+		path_push(ctx, name, length);
+		if (new_match[i] == DEVICETREE_INDEX_NONE) {
+			report(ctx, DEVICETREE_DIFF_NODE_ADDED, DEVICETREE_INDEX_NONE,
+					new_children[i],
+					DEVICETREE_INDEX_NONE, DEVICETREE_INDEX_NONE);
+		} else {
+			diff_nodes(ctx, old_children[new_match[i]], new_children[i]);
+		}
+		path_pop(ctx, path_length);
+	}
+	free(old_match);
+	free(old_items);
+	free(new_items);
+	free(old_children);
+	free(new_children);
+}
+
+bool
+devicetree_diff(const struct devicetree_index *old_index,
+		const struct devicetree_hashes *old_hashes,
+		const struct devicetree_index *new_index,
+		const struct devicetree_hashes *new_hashes,
+		devicetree_diff_callback_t callback) {
+	struct diff_context ctx = {
+		.old_index     = old_index,
+		.old_hashes    = old_hashes,
+		.new_index     = new_index,
+		.new_hashes    = new_hashes,
+		.callback      = callback,
+		.path          = malloc(256),
+		.path_length   = 0,
+		.path_capacity = 256,
+		.identical     = true,
+		.stop          = false,
+	};
+	assert(ctx.path != NULL);
+	ctx.path[0] = 0;
+	diff_nodes(&ctx, 0, 0);
+	free(ctx.path);
+	return ctx.identical;
+}
@@ -0,0 +1,54 @@
+/*
+ * devicetree-diff.h
+ * Brandon Azad
+ */
+#ifndef DEVICETREE_DIFF__H_
+#define DEVICETREE_DIFF__H_
+
+#include "devicetree-hash.h"
+
+enum devicetree_diff_kind {
+	DEVICETREE_DIFF_NODE_ADDED,
+	DEVICETREE_DIFF_NODE_REMOVED,
+	DEVICETREE_DIFF_PROPERTY_ADDED,
+	DEVICETREE_DIFF_PROPERTY_REMOVED,
+	DEVICETREE_DIFF_PROPERTY_CHANGED,
+};
+
+struct devicetree_diff_entry {
+	enum devicetree_diff_kind kind;
+	// The path of the node that was added or removed, or of the node holding the property. For
+	// removals this is the path in the old tree, otherwise the path in the new tree.
+	const char *path;
+	// The node in each tree, or DEVICETREE_INDEX_NONE if it is absent from that tree. For
+	// property changes both nodes are present.
+	uint32_t old_node;
+	uint32_t new_node;
+	// For property changes, the property in each tree's property table, or
+	// DEVICETREE_INDEX_NONE if it is absent from that tree.
+	uint32_t old_property;
+	uint32_t new_property;
+};
+
+// Report one difference. Set stop to end the diff early.
+typedef void (^devicetree_diff_callback_t)(
+		const struct devicetree_diff_entry *entry,
+		bool *stop);
+
+// Compare two indexed devicetrees. Nodes are matched by path: children with the same name are
+// paired up in order, as are properties with the same name. Subtrees whose hashes are equal are
+// skipped without being visited, so the work done is proportional to the number of nodes on the
+// paths to the differences rather than to the size of the trees.
+//
+// For each pair of matched nodes that differ, the removed properties are reported first, then the
+// added and changed properties in new tree order, then the removed children, and finally the new
+// children in order, each either reported as added or compared recursively. An added or removed
+// node is reported once; its descendants are not reported separately. Returns true if the trees
+// are identical.
+bool devicetree_diff(const struct devicetree_index *old_index,
+		const struct devicetree_hashes *old_hashes,
+		const struct devicetree_index *new_index,
+		const struct devicetree_hashes *new_hashes,
+		devicetree_diff_callback_t callback);
+
+#endif
@@ -0,0 +1,507 @@
+/*
+ * devicetree-edit.c
+ * Brandon Azad
+ */
+#include "devicetree-edit.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#define PROPERTY_NAME_SIZE	sizeof(((struct devicetree_property *)NULL)->name)
+
+struct edit_property {
+	char name[PROPERTY_NAME_SIZE];
+	// The property in the index that this one started out as, or DEVICETREE_INDEX_NONE if it
+	// was added.
+	uint32_t original;
+	// The new value, or NULL if the property still has its original value.
+	uint8_t *value;
+	uint32_t size;
+};
+
+struct edit_node {
+	// The node's properties, or NULL if they have not been edited.
+	struct edit_property *properties;
+	uint32_t n_properties;
+	uint32_t properties_capacity;
+	// The added children of the node, in order.
+	uint32_t *added_children;
+	uint32_t n_added_children;
+	uint32_t added_children_capacity;
+	// The number of the node's original children that were removed.
+	uint32_t n_removed_children;
+	uint32_t parent;
+	bool removed;
+	// Set if anything in the node's subtree was edited.
+	bool dirty;
+};
+
+// A piece of the output: either a range of bytes that already exists (in the original data or in
+// an edited value), or a range of the generated buffer.
+struct edit_segment {
+	const uint8_t *data;
+	size_t offset;
+	size_t size;
+};
+
+struct edit_layout {
+	struct edit_segment *segments;
+	size_t n_segments;
+	size_t segments_capacity;
+	// Headers and padding that had to be generated. Segments refer to it by offset, since it
+	// moves as it grows.
+	uint8_t *generated;
+	size_t generated_size;
+	size_t generated_capacity;
+	// The size of the output.
+	size_t size;
+};
+
+struct devicetree_edit {
+	const struct devicetree_index *index;
+	// The original nodes followed by the added nodes.
+	struct edit_node *nodes;
+	size_t n_nodes;
+	size_t nodes_capacity;
+	// The layout of the output, rebuilt after every edit.
+	struct edit_layout layout;
+	bool layout_valid;
+};
+
+struct devicetree_edit *
+devicetree_edit_create(const struct devicetree_index *index) {
+	struct devicetree_edit *edit = calloc(1, sizeof(*edit));
+	assert(edit != NULL);
+	edit->index = index;
+	edit->n_nodes = index->n_nodes;
+	edit->nodes_capacity = index->n_nodes;
+	edit->nodes = calloc(index->n_nodes, sizeof(*edit->nodes));
+	assert(edit->nodes != NULL || index->n_nodes == 0);
+	for (size_t id = 0; id < index->n_nodes; id++) {
+		edit->nodes[id].parent = index->nodes[id].parent;
+	}
+	return edit;
+}
+
+void
+devicetree_edit_free(struct devicetree_edit *edit) {
+	for (size_t id = 0; id < edit->n_nodes; id++) {
+		struct edit_node *node = &edit->nodes[id];
+		for (uint32_t i = 0; i < node->n_properties; i++) {
+			free(node->properties[i].value);
+		}
+		free(node->properties);
+		free(node->added_children);
+	}
+	free(edit->nodes);
+	free(edit->layout.segments);
+	free(edit->layout.generated);
+	free(edit);
+}
+
+// ---- Editing -----------------------------------------------------------------------------------
+
+// Check that the node exists and that neither it nor any of its ancestors has been removed.
+static bool
+node_valid(struct devicetree_edit *edit, uint32_t id) {
+	if (id >= edit->n_nodes) {
+		return false;
+	}
+	for (; id != DEVICETREE_INDEX_NONE; id = edit->nodes[id].parent) {
+		if (edit->nodes[id].removed) {
+			return false;
+		}
+	}
+	return true;
+}
+
+// Mark the node and its ancestors as edited.
+static void
+mark_dirty(struct devicetree_edit *edit, uint32_t id) {
+	for (; id != DEVICETREE_INDEX_NONE && !edit->nodes[id].dirty; id = edit->nodes[id].parent) {
+		edit->nodes[id].dirty = true;
+	}
+	edit->layout_valid = false;
+}
+
+static void *
+array_reserve(void *array, uint32_t count, uint32_t *capacity, size_t element_size) {
+	if (count < *capacity) {
+		return array;
+	}
+	uint32_t new_capacity = (*capacity == 0 ? 8 : 2 * *capacity);
+	void *new_array = realloc(array, new_capacity * element_size);
+	assert(new_array != NULL);
+	*capacity = new_capacity;
+	return new_array;
+}
+
+// Make the node's property list editable, starting from its original properties.
+static void
+load_properties(struct devicetree_edit *edit, uint32_t id) {
+	struct edit_node *node = &edit->nodes[id];
+	if (node->properties != NULL || id >= edit->index->n_nodes) {
+		return;
+	}
+	const struct devicetree_index *index = edit->index;
+	const struct devicetree_index_node *original = &index->nodes[id];
+	uint32_t n_properties = original->n_properties;
+	node->properties_capacity = (n_properties > 0 ? n_properties : 1);
+	node->properties = malloc(node->properties_capacity * sizeof(*node->properties));
+	assert(node->properties != NULL);
+	for (uint32_t i = 0; i < n_properties; i++) {
+		uint32_t prop_id = original->first_property + i;
+		struct edit_property *prop = &node->properties[i];
+		// The name is the start of the original 32-byte property header.
+		const struct devicetree_index_property *original_prop = &index->properties[prop_id];
+		memcpy(prop->name, devicetree_index_property_name(index, original_prop),
+				sizeof(prop->name));
+		prop->original = prop_id;
+		prop->value    = NULL;
+		prop->size     = original_prop->size;
+	}
+	node->n_properties = n_properties;
+}
+
+static struct edit_property *
+find_property(struct edit_node *node, const char *name) {
+	for (uint32_t i = 0; i < node->n_properties; i++) {
+		if (strncmp(node->properties[i].name, name, PROPERTY_NAME_SIZE) == 0) {
+			return &node->properties[i];
+		}
+	}
+	return NULL;
+}
+
+bool
+devicetree_edit_set_property(struct devicetree_edit *edit, uint32_t id,
+		const char *name, const void *value, size_t size) {
+	if (!node_valid(edit, id) || strlen(name) >= PROPERTY_NAME_SIZE || size > 0x7fffffff) {
+		return false;
+	}
+	load_properties(edit, id);
+	struct edit_node *node = &edit->nodes[id];
+	struct edit_property *prop = find_property(node, name);
+	if (prop == NULL) {
+		node->properties = array_reserve(node->properties, node->n_properties,
+				&node->properties_capacity, sizeof(*node->properties));
+		prop = &node->properties[node->n_properties++];
+		memset(prop->name, 0, sizeof(prop->name));
+		strcpy(prop->name, name);
+		prop->original = DEVICETREE_INDEX_NONE;
+		prop->value    = NULL;
+	}
+	// Always allocate, even for an empty value, so that a NULL value means "unchanged".
+	uint8_t *copy = malloc(size > 0 ? size : 1);
+	assert(copy != NULL);
+	memcpy(copy, value, size);
+	free(prop->value);
+	prop->value = copy;
+	prop->size  = size;
+	mark_dirty(edit, id);
+	return true;
+}
+
+bool
+devicetree_edit_remove_property(struct devicetree_edit *edit, uint32_t id, const char *name) {
+	if (!node_valid(edit, id)) {
+		return false;
+	}
+	load_properties(edit, id);
+	struct edit_node *node = &edit->nodes[id];
+	struct edit_property *prop = find_property(node, name);
+	if (prop == NULL) {
+		return false;
+	}
+	free(prop->value);
+	struct edit_property *end = node->properties + node->n_properties;
+	memmove(prop, prop + 1, (end - (prop + 1)) * sizeof(*prop));
+	node->n_properties--;
+	mark_dirty(edit, id);
+	return true;
+}
+
+uint32_t
+devicetree_edit_add_node(struct devicetree_edit *edit, uint32_t parent, const char *name) {
+	if (!node_valid(edit, parent) || strlen(name) >= PROPERTY_NAME_SIZE
+			|| edit->n_nodes >= DEVICETREE_INDEX_NONE) {
+		return DEVICETREE_INDEX_NONE;
+	}
+	if (edit->n_nodes == edit->nodes_capacity) {
+		edit->nodes_capacity = 2 * edit->nodes_capacity + 8;
+		edit->nodes = realloc(edit->nodes, edit->nodes_capacity * sizeof(*edit->nodes));
+		assert(edit->nodes != NULL);
+	}
+	uint32_t id = edit->n_nodes++;
+	struct edit_node *node = &edit->nodes[id];
+	memset(node, 0, sizeof(*node));
+	node->parent = parent;
+	struct edit_node *parent_node = &edit->nodes[parent];
+	parent_node->added_children = array_reserve(parent_node->added_children,
+			parent_node->n_added_children, &parent_node->added_children_capacity,
+			sizeof(*parent_node->added_children));
+	parent_node->added_children[parent_node->n_added_children++] = id;
+	// New nodes start out with just a name.
+	node->properties_capacity = 1;
+	node->properties = malloc(sizeof(*node->properties));
+	assert(node->properties != NULL);
+	devicetree_edit_set_property(edit, id, "name", name, strlen(name) + 1);
+	return id;
+}
+
+bool
+devicetree_edit_remove_node(struct devicetree_edit *edit, uint32_t id) {
+	if (id == 0 || !node_valid(edit, id)) {
+		return false;
+	}
+	struct edit_node *node = &edit->nodes[id];
+	struct edit_node *parent = &edit->nodes[node->parent];
+	node->removed = true;
+	if (id < edit->index->n_nodes) {
+		parent->n_removed_children++;
+	} else {
+		uint32_t *child = parent->added_children;
+		uint32_t *end = child + parent->n_added_children;
+		while (*child != id) {
+			child++;
+		}
+		memmove(child, child + 1, (end - (child + 1)) * sizeof(*child));
+		parent->n_added_children--;
+	}
+	mark_dirty(edit, node->parent);
+	return true;
+}
+
+// ---- Serialization -----------------------------------------------------------------------------
+
+static void
+layout_add_segment(struct edit_layout *layout, const uint8_t *data, size_t offset, size_t size) {
+	if (size == 0) {
+		return;
+	}
+	layout->size += size;
+	// Merge with the previous segment if this one continues it.
+	if (layout->n_segments > 0) {
+		struct edit_segment *last = &layout->segments[layout->n_segments - 1];
+		if (data != NULL ? (last->data != NULL && last->data + last->size == data)
+				: (last->data == NULL && last->offset + last->size == offset)) {
+			last->size += size;
+			return;
+		}
+	}
+	if (layout->n_segments == layout->segments_capacity) {
+		layout->segments_capacity = 2 * layout->segments_capacity + 64;
+		layout->segments = realloc(layout->segments,
+				layout->segments_capacity * sizeof(*layout->segments));
+		assert(layout->segments != NULL);
+	}
+	struct edit_segment *segment = &layout->segments[layout->n_segments++];
+	segment->data   = data;
+	segment->offset = offset;
+	segment->size   = size;
+}
+
+// Add bytes that exist elsewhere and stay put, like the original data.
+static void
+emit_existing(struct edit_layout *layout, const void *data, size_t size) {
+	layout_add_segment(layout, data, 0, size);
+}
+
+// Add generated bytes. If data is NULL, the bytes are zero.
+static void
+emit_generated(struct edit_layout *layout, const void *data, size_t size) {
+	// Most alignment is empty, and the buffer may not exist yet.
+	if (size == 0) {
+		return;
+	}
+	size_t needed = layout->generated_size + size;
+	if (needed > layout->generated_capacity) {
+		size_t capacity = 2 * layout->generated_capacity + 256;
+		if (capacity < needed) {
+			capacity = needed;
+		}
+		layout->generated = realloc(layout->generated, capacity);
+		assert(layout->generated != NULL);
+		layout->generated_capacity = capacity;
+	}
+	uint8_t *p = layout->generated + layout->generated_size;
+	if (data != NULL) {
+		memcpy(p, data, size);
+	} else {
+		memset(p, 0, size);
+	}
+	layout_add_segment(layout, NULL, layout->generated_size, size);
+	layout->generated_size += size;
+}
+
+// Headers start on a 4-byte boundary. This only adds padding when an original property that was
+// left unpadded at the end of the data is no longer last.
+static void
+emit_align(struct edit_layout *layout) {
+	size_t padding = (4 - (layout->size & 0x3)) & 0x3;
+	emit_generated(layout, NULL, padding);
+}
+
+static void
+emit_node_header(struct edit_layout *layout, uint32_t n_properties, uint32_t n_children) {
+	struct devicetree_node header = { n_properties, n_children };
+	emit_align(layout);
+	emit_generated(layout, &header, sizeof(header));
+}
+
+static void
+emit_properties(struct devicetree_edit *edit, struct edit_layout *layout,
+		const struct edit_node *node) {
+	const struct devicetree_index *index = edit->index;
+	for (uint32_t i = 0; i < node->n_properties; i++) {
+		const struct edit_property *prop = &node->properties[i];
+		emit_align(layout);
+		if (prop->value == NULL) {
+			// Copy the original property, header, value, padding and all.
+			const struct devicetree_index_property *original =
+				&index->properties[prop->original];
+			size_t end = original->value_offset + ((original->size + 0x3) & ~0x3);
+			if (end > index->size) {
+				end = index->size;
+			}
+			emit_existing(layout, index->data + original->name_offset,
+					end - original->name_offset);
+			continue;
+		}
+		struct devicetree_property header;
+		memcpy(header.name, prop->name, sizeof(header.name));
+		header.size = prop->size;
+		emit_generated(layout, &header, sizeof(header));
+		emit_existing(layout, prop->value, prop->size);
+		emit_generated(layout, NULL, ((prop->size + 0x3) & ~0x3) - prop->size);
+	}
+}
+
+static void
+layout_node(struct devicetree_edit *edit, struct edit_layout *layout, uint32_t id) {
+	const struct devicetree_index *index = edit->index;
+	const struct edit_node *node = &edit->nodes[id];
+	if (id >= index->n_nodes) {
+		emit_node_header(layout, node->n_properties, node->n_added_children);
+		emit_properties(edit, layout, node);
+	} else {
+		const struct devicetree_index_node *original = &index->nodes[id];
+		// An untouched subtree is copied in one piece.
+		if (!node->dirty) {
+			emit_align(layout);
+			emit_existing(layout, index->data + original->offset,
+					original->end - original->offset);
+			return;
+		}
+		uint32_t n_children = original->n_children - node->n_removed_children
+			+ node->n_added_children;
+		// The original properties end where the first child starts.
+		uint32_t properties_end = (original->n_children > 0
+				? index->nodes[id + 1].offset : original->end);
+		uint32_t properties_start = original->offset + sizeof(struct devicetree_node);
+		if (node->properties == NULL && n_children == original->n_children) {
+			emit_align(layout);
+			emit_existing(layout, index->data + original->offset,
+					properties_end - original->offset);
+		} else if (node->properties == NULL) {
+			emit_node_header(layout, original->n_properties, n_children);
+			emit_existing(layout, index->data + properties_start,
+					properties_end - properties_start);
+		} else {
+			emit_node_header(layout, node->n_properties, n_children);
+			emit_properties(edit, layout, node);
+		}
+		for (uint32_t child = id + 1; child < original->subtree_end;
+				child = index->nodes[child].subtree_end) {
+			if (!edit->nodes[child].removed) {
+				layout_node(edit, layout, child);
+			}
+		}
+	}
+	for (uint32_t i = 0; i < node->n_added_children; i++) {
+		layout_node(edit, layout, node->added_children[i]);
+	}
+}
+
+static struct edit_layout *
+edit_layout(struct devicetree_edit *edit) {
+	struct edit_layout *layout = &edit->layout;
+	if (!edit->layout_valid) {
+		layout->n_segments = 0;
+		layout->generated_size = 0;
+		layout->size = 0;
+		if (edit->n_nodes > 0) {
+			layout_node(edit, layout, 0);
+		}
+		edit->layout_valid = true;
+	}
+	return layout;
+}
+
+size_t
+devicetree_edit_size(struct devicetree_edit *edit) {
+	return edit_layout(edit)->size;
+}
+
+void
+devicetree_edit_serialize(struct devicetree_edit *edit, void *buffer) {
+	const struct edit_layout *layout = edit_layout(edit);
+	uint8_t *p = buffer;
+	for (size_t i = 0; i < layout->n_segments; i++) {
+		const struct edit_segment *segment = &layout->segments[i];
+		const uint8_t *data = (segment->data != NULL ? segment->data
+				: layout->generated + segment->offset);
+		memcpy(p, data, segment->size);
+		p += segment->size;
+	}
+}
+
+bool
+devicetree_edit_write(struct devicetree_edit *edit, int fd) {
+	const struct edit_layout *layout = edit_layout(edit);
+	struct iovec iov[256];
+	size_t next = 0;
+	size_t skip = 0;
+	while (next < layout->n_segments) {
+		// Gather up to IOV_MAX segments, skipping what was written already.
+		size_t count = 0;
+		size_t max_count = sizeof(iov) / sizeof(iov[0]);
+		if (max_count > IOV_MAX) {
+			max_count = IOV_MAX;
+		}
+		for (size_t i = next; i < layout->n_segments && count < max_count; i++) {
+			const struct edit_segment *segment = &layout->segments[i];
+			const uint8_t *data = (segment->data != NULL ? segment->data
+					: layout->generated + segment->offset);
+			size_t offset = (i == next ? skip : 0);
+			iov[count].iov_base = (void *)(data + offset);
+			iov[count].iov_len  = segment->size - offset;
+			count++;
+		}
+		ssize_t written = writev(fd, iov, count);
+		if (written < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return false;
+		}
+		// Advance past what was written.
+		size_t left = written;
+		while (next < layout->n_segments) {
+			size_t remaining = layout->segments[next].size - skip;
+			if (left < remaining) {
+				skip += left;
+				break;
+			}
+			left -= remaining;
+			skip = 0;
+			next++;
+		}
+	}
+	return true;
+}
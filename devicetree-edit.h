@@ -0,0 +1,53 @@
+/*
+ * devicetree-edit.h
+ * Brandon Azad
+ */
+#ifndef DEVICETREE_EDIT__H_
+#define DEVICETREE_EDIT__H_
+
+#include "devicetree-index.h"
+
+// A set of edits to an indexed devicetree. The original data is never modified: edits are
+// recorded on the side, and when the edited tree is written out, every unchanged byte range of the
+// original (a run of properties, or a whole subtree) is copied as is and only the headers and
+// values of edited nodes are generated.
+//
+// Nodes are identified by their index node ID. Nodes added with devicetree_edit_add_node() get
+// new IDs past the end of the index, which can be edited like any other node. The index and its
+// data must remain valid for as long as the edit is used.
+struct devicetree_edit;
+
+struct devicetree_edit *devicetree_edit_create(const struct devicetree_index *index);
+
+void devicetree_edit_free(struct devicetree_edit *edit);
+
+// Set the value of a property of a node, adding the property after the node's other properties
+// if it does not exist. The value is copied. Returns false if the node does not exist or has been
+// removed, or if the name does not fit in a property header.
+bool devicetree_edit_set_property(struct devicetree_edit *edit, uint32_t node,
+		const char *name, const void *value, size_t size);
+
+// Remove the first property of a node with the given name. Returns false if there is no such
+// property.
+bool devicetree_edit_remove_property(struct devicetree_edit *edit, uint32_t node,
+		const char *name);
+
+// Add a new node with the given name as the last child of parent. Returns the ID of the new node,
+// or DEVICETREE_INDEX_NONE if the parent does not exist or has been removed.
+uint32_t devicetree_edit_add_node(struct devicetree_edit *edit, uint32_t parent, const char *name);
+
+// Remove a node and its subtree. The root cannot be removed.
+bool devicetree_edit_remove_node(struct devicetree_edit *edit, uint32_t node);
+
+// Get the size of the edited devicetree.
+size_t devicetree_edit_size(struct devicetree_edit *edit);
+
+// Write the edited devicetree into buffer, which must be at least devicetree_edit_size() bytes.
+// Unchanged ranges of the original are copied with one memcpy() each.
+void devicetree_edit_serialize(struct devicetree_edit *edit, void *buffer);
+
+// Write the edited devicetree to a file descriptor with writev(), pointing straight at the
+// unchanged ranges of the original data. Returns false if a write fails.
+bool devicetree_edit_write(struct devicetree_edit *edit, int fd);
+
+#endif
@@ -0,0 +1,469 @@
+/*
+ * devicetree-export.c
+ * Brandon Azad
+ */
+#include "devicetree-export.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+// The most bytes of a property name, which need not be null-terminated.
+#define PROPERTY_NAME_SIZE	sizeof(((struct devicetree_property *)NULL)->name)
+
+// Property names are hashed with 64-bit FNV-1a.
+#define FNV_HASH_INIT	0xcbf29ce484222325
+#define FNV_HASH_PRIME	0x100000001b3
+
+// ---- Writing -----------------------------------------------------------------------------------
+
+struct export_name {
+	const char *name;
+	uint32_t length;
+	// The ID of the name before the names are sorted.
+	uint32_t id;
+};
+
+// The interned property names of an index.
+struct export_names {
+	// The ID of the name of each property.
+	uint32_t *property_names;
+	// The names, sorted.
+	struct export_name *names;
+	size_t n_names;
+	// The offset of each sorted name in strings.
+	uint32_t *offsets;
+	char *strings;
+	size_t strings_size;
+};
+
+static uint64_t
+hash_name(const char *name, size_t length) {
+	uint64_t hash = FNV_HASH_INIT;
+	for (size_t i = 0; i < length; i++) {
+		hash = (hash ^ (uint8_t)name[i]) * FNV_HASH_PRIME;
+	}
+	return hash;
+}
+
+// Order names like strcmp() would.
+static int
+compare_names(const void *a, const void *b) {
+	const struct export_name *name_a = a;
+	const struct export_name *name_b = b;
+	size_t length = (name_a->length < name_b->length ? name_a->length : name_b->length);
+	int cmp = memcmp(name_a->name, name_b->name, length);
+	if (cmp != 0) {
+		return cmp;
+	}
+	return (name_a->length > name_b->length) - (name_a->length < name_b->length);
+}
+
+// Give every distinct property name an ID. IDs are assigned in sorted order, so that names can be
+// looked up with a binary search.
+static void
+intern_names(const struct devicetree_index *index, struct export_names *names) {
+	size_t n_properties = index->n_properties;
+	names->property_names = malloc(n_properties * sizeof(*names->property_names) + 1);
+	names->names = malloc(n_properties * sizeof(*names->names) + 1);
+	assert(names->property_names != NULL && names->names != NULL);
+	// The hash table maps a name to its ID plus 1, so that 0 marks an empty slot. It is at most
+	// half full.
+	size_t capacity = 64;
+	while (capacity < 2 * n_properties) {
+		capacity *= 2;
+	}
+	uint32_t *table = calloc(capacity, sizeof(*table));
+	assert(table != NULL);
+	size_t n_names = 0;
+	for (size_t i = 0; i < n_properties; i++) {
+		const struct devicetree_index_property *prop = &index->properties[i];
+		const char *name = devicetree_index_property_name(index, prop);
+		uint32_t length = strnlen(name, PROPERTY_NAME_SIZE);
+		size_t slot = hash_name(name, length) & (capacity - 1);
+		for (;; slot = (slot + 1) & (capacity - 1)) {
+			if (table[slot] == 0) {
+				names->names[n_names].name = name;
+				names->names[n_names].length = length;
+				names->names[n_names].id = n_names;
+				table[slot] = ++n_names;
+				break;
+			}
+			const struct export_name *entry = &names->names[table[slot] - 1];
+			if (entry->length == length && memcmp(entry->name, name, length) == 0) {
+				break;
+			}
+		}
+		names->property_names[i] = table[slot] - 1;
+	}
+	free(table);
+	names->n_names = n_names;
+	// Sort the names and renumber the properties to match.
+	qsort(names->names, n_names, sizeof(*names->names), compare_names);
+	uint32_t *sorted_id = malloc(n_names * sizeof(*sorted_id) + 1);
+	names->offsets = malloc(n_names * sizeof(*names->offsets) + 1);
+	names->strings = malloc(n_names * (PROPERTY_NAME_SIZE + 1) + 1);
+	assert(sorted_id != NULL && names->offsets != NULL && names->strings != NULL);
+	size_t strings_size = 0;
+	for (size_t i = 0; i < n_names; i++) {
+		const struct export_name *entry = &names->names[i];
+		sorted_id[entry->id] = i;
+		names->offsets[i] = strings_size;
+		memcpy(names->strings + strings_size, entry->name, entry->length);
+		strings_size += entry->length;
+		names->strings[strings_size++] = 0;
+	}
+	names->strings_size = strings_size;
+	for (size_t i = 0; i < n_properties; i++) {
+		names->property_names[i] = sorted_id[names->property_names[i]];
+	}
+	free(sorted_id);
+}
+
+static void
+free_names(struct export_names *names) {
+	free(names->property_names);
+	free(names->names);
+	free(names->offsets);
+	free(names->strings);
+}
+
+// Write all of the data described by iov, continuing after partial writes. The iov array is
+// modified to track the progress.
+static bool
+write_all(int fd, struct iovec *iov, int count) {
+	while (count > 0) {
+		ssize_t written = writev(fd, iov, count);
+		if (written < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return false;
+		}
+		while (count > 0 && (size_t)written >= iov->iov_len) {
+			written -= iov->iov_len;
+			iov++;
+			count--;
+		}
+		if (count > 0) {
+			iov->iov_base = (char *)iov->iov_base + written;
+			iov->iov_len -= written;
+		}
+	}
+	return true;
+}
+
+bool
+devicetree_export_detect(const void *data, size_t size) {
+	const char *magic = DEVICETREE_EXPORT_MAGIC;
+	return (size >= sizeof(struct devicetree_export_header)
+			&& memcmp(data, magic, strlen(magic)) == 0);
+}
+
+bool
+devicetree_export_write(const struct devicetree_index *index, const uint8_t *display_types,
+		int fd) {
+	struct export_names names;
+	intern_names(index, &names);
+	struct devicetree_export_header header = {
+		.magic        = DEVICETREE_EXPORT_MAGIC,
+		.version      = DEVICETREE_EXPORT_VERSION,
+		.header_size  = sizeof(header),
+		.n_nodes      = index->n_nodes,
+		.n_properties = index->n_properties,
+		.n_names      = names.n_names,
+		.strings_size = names.strings_size,
+		.data_size    = index->size,
+	};
+	// Lay out the sections after the header, each padded to 8 bytes.
+	static const uint8_t padding[8];
+	struct iovec iov[2 * 8];
+	int count = 0;
+	uint64_t offset = 0;
+	uint64_t *section_offsets[] = {
+		NULL,
+		&header.data_offset,
+		&header.nodes_offset,
+		&header.properties_offset,
+		&header.property_names_offset,
+		&header.display_types_offset,
+		&header.names_offset,
+		&header.strings_offset,
+	};
+	struct { const void *data; size_t size; } sections[] = {
+		{ &header,              sizeof(header) },
+		{ index->data,          index->size },
+		{ index->nodes,         index->n_nodes * sizeof(*index->nodes) },
+		{ index->properties,    index->n_properties * sizeof(*index->properties) },
+		{ names.property_names, index->n_properties * sizeof(*names.property_names) },
+		{ display_types,        index->n_properties },
+		{ names.offsets,        names.n_names * sizeof(*names.offsets) },
+		{ names.strings,        names.strings_size },
+	};
+	for (size_t i = 0; i < sizeof(sections) / sizeof(sections[0]); i++) {
+		if (section_offsets[i] != NULL) {
+			*section_offsets[i] = offset;
+		}
+		iov[count].iov_base = (void *)sections[i].data;
+		iov[count].iov_len  = sections[i].size;
+		count++;
+		offset += sections[i].size;
+		size_t pad = -offset % sizeof(padding);
+		if (pad > 0) {
+			iov[count].iov_base = (void *)padding;
+			iov[count].iov_len  = pad;
+			count++;
+			offset += pad;
+		}
+	}
+	header.file_size = offset;
+	bool ok = write_all(fd, iov, count);
+	free_names(&names);
+	return ok;
+}
+
+// ---- Loading -----------------------------------------------------------------------------------
+
+// Check that a section of count elements lies inside the export and is aligned.
+static bool
+section_ok(uint64_t offset, uint64_t count, size_t element_size, size_t size) {
+	return (offset % 8 == 0 && offset <= size && count <= (size - offset) / element_size);
+}
+
+// Check that the node table describes a tree laid out the way devicetree_index_build() lays it out:
+// nodes in tree order inside the data, each subtree a contiguous range of IDs inside its parent's,
+// and the properties of the nodes in the same order as the nodes.
+static bool
+nodes_ok(const struct devicetree_index *index) {
+	const struct devicetree_index_node *nodes = index->nodes;
+	uint32_t n_nodes = index->n_nodes;
+	// The number of children found so far for each node.
+	uint32_t *n_children = calloc(n_nodes, sizeof(*n_children));
+	assert(n_children != NULL);
+	uint64_t first_property = 0;
+	bool ok = false;
+	for (uint32_t id = 0; id < n_nodes; id++) {
+		const struct devicetree_index_node *node = &nodes[id];
+		if (node->offset > node->end || node->end > index->size
+				|| node->end - node->offset < sizeof(struct devicetree_node)
+				|| node->subtree_end <= id || node->subtree_end > n_nodes
+				|| node->first_property != first_property
+				|| node->n_properties > index->n_properties - first_property) {
+			goto done;
+		}
+		first_property += node->n_properties;
+		// A node's subtree starts with its first child.
+		if (id + 1 < node->subtree_end && nodes[id + 1].parent != id) {
+			goto done;
+		}
+		if (id == 0) {
+			if (node->parent != DEVICETREE_INDEX_NONE || node->depth != 0
+					|| node->subtree_end != n_nodes) {
+				goto done;
+			}
+			continue;
+		}
+		// The subtree lies in the parent's, and is followed by the next sibling, if any.
+		uint32_t parent = node->parent;
+		if (parent >= id || node->depth != nodes[parent].depth + 1
+				|| node->depth > DEVICETREE_DEFAULT_MAX_DEPTH
+				|| node->subtree_end > nodes[parent].subtree_end
+				|| node->offset < nodes[id - 1].offset
+				|| node->end > nodes[parent].end) {
+			goto done;
+		}
+		if (node->subtree_end < nodes[parent].subtree_end
+				&& nodes[node->subtree_end].parent != parent) {
+			goto done;
+		}
+		n_children[parent]++;
+	}
+	if (first_property != index->n_properties) {
+		goto done;
+	}
+	for (uint32_t id = 0; id < n_nodes; id++) {
+		if (n_children[id] != nodes[id].n_children
+				|| (n_children[id] == 0) != (nodes[id].subtree_end == id + 1)) {
+			goto done;
+		}
+	}
+	ok = true;
+done:
+	free(n_children);
+	return ok;
+}
+
+// Check that every property lies inside the data of its node and that its name ID names it.
+static bool
+properties_ok(const struct devicetree_export *export) {
+	const struct devicetree_index *index = &export->index;
+	for (uint32_t id = 0; id < index->n_nodes; id++) {
+		const struct devicetree_index_node *node = &index->nodes[id];
+		uint64_t start = (uint64_t)node->offset + sizeof(struct devicetree_node);
+		for (uint32_t i = 0; i < node->n_properties; i++) {
+			uint32_t prop_id = node->first_property + i;
+			const struct devicetree_index_property *prop =
+				&index->properties[prop_id];
+			if (prop->name_offset < start
+					|| prop->value_offset - (uint64_t)prop->name_offset
+						!= sizeof(struct devicetree_property)
+					|| prop->value_offset > node->end
+					|| prop->size > node->end - prop->value_offset
+					|| (prop->flags & ~DEVICETREE_PROPERTY_FLAG) != 0
+					|| export->property_names[prop_id] >= export->n_names) {
+				return false;
+			}
+			const char *name = devicetree_index_property_name(index, prop);
+			const char *interned = devicetree_export_name(export,
+					export->property_names[prop_id]);
+			size_t length = strnlen(name, PROPERTY_NAME_SIZE);
+			if (strlen(interned) != length || memcmp(interned, name, length) != 0) {
+				return false;
+			}
+			start = prop->value_offset + prop->size;
+		}
+	}
+	return true;
+}
+
+// Check that the interned names lie inside the strings and are sorted, as the binary search in
+// devicetree_export_find_name() expects.
+static bool
+names_ok(const struct devicetree_export *export, size_t strings_size) {
+	for (size_t i = 0; i < export->n_names; i++) {
+		if (export->names[i] >= strings_size) {
+			return false;
+		}
+		if (i > 0 && strcmp(devicetree_export_name(export, i - 1),
+					devicetree_export_name(export, i)) >= 0) {
+			return false;
+		}
+	}
+	return true;
+}
+
+bool
+devicetree_export_load(const void *data, size_t size, struct devicetree_export *export) {
+	const uint8_t *base = data;
+	const struct devicetree_export_header *header = data;
+	if ((uintptr_t)data % 8 != 0 || !devicetree_export_detect(data, size)) {
+		return false;
+	}
+	if (header->version != DEVICETREE_EXPORT_VERSION
+			|| header->header_size != sizeof(*header)
+			|| header->file_size != size
+			|| header->data_size > UINT32_MAX
+			|| header->n_nodes == 0) {
+		return false;
+	}
+	bool ok = section_ok(header->data_offset, header->data_size, 1, size)
+		&& section_ok(header->nodes_offset, header->n_nodes,
+				sizeof(struct devicetree_index_node), size)
+		&& section_ok(header->properties_offset, header->n_properties,
+				sizeof(struct devicetree_index_property), size)
+		&& section_ok(header->property_names_offset, header->n_properties,
+				sizeof(uint32_t), size)
+		&& section_ok(header->display_types_offset, header->n_properties, 1, size)
+		&& section_ok(header->names_offset, header->n_names, sizeof(uint32_t), size)
+		&& section_ok(header->strings_offset, header->strings_size, 1, size);
+	if (!ok) {
+		return false;
+	}
+	// Make sure that the last name is terminated.
+	const char *strings = (const char *)(base + header->strings_offset);
+	if (header->strings_size > 0 && strings[header->strings_size - 1] != 0) {
+		return false;
+	}
+	// The index is never written through, so it can point into read-only memory.
+	struct devicetree_index *index = &export->index;
+	index->data         = base + header->data_offset;
+	index->size         = header->data_size;
+	index->nodes        = (struct devicetree_index_node *)(base + header->nodes_offset);
+	index->n_nodes      = header->n_nodes;
+	index->properties   = (struct devicetree_index_property *)
+		(base + header->properties_offset);
+	index->n_properties = header->n_properties;
+	index->paths        = NULL;
+	index->compatibles  = NULL;
+	index->phandles     = NULL;
+	export->property_names = (const uint32_t *)(base + header->property_names_offset);
+	export->display_types  = base + header->display_types_offset;
+	export->names          = (const uint32_t *)(base + header->names_offset);
+	export->n_names        = header->n_names;
+	export->strings        = strings;
+	export->mapping        = NULL;
+	export->mapping_size   = 0;
+	// Check the tables, so that nothing that uses the index reads outside of the export.
+	return (names_ok(export, header->strings_size) && nodes_ok(index)
+			&& properties_ok(export));
+}
+
+bool
+devicetree_open_index(const char *path, struct devicetree_export *export) {
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		return false;
+	}
+	struct stat st;
+	if (fstat(fd, &st) != 0) {
+		close(fd);
+		return false;
+	}
+	size_t size = st.st_size;
+	if (size < sizeof(struct devicetree_export_header)) {
+		close(fd);
+		errno = EINVAL;
+		return false;
+	}
+	void *mapping = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (mapping == MAP_FAILED) {
+		return false;
+	}
+	if (!devicetree_export_load(mapping, size, export)) {
+		munmap(mapping, size);
+		errno = EINVAL;
+		return false;
+	}
+	export->mapping = mapping;
+	export->mapping_size = size;
+	return true;
+}
+
+void
+devicetree_close_index(struct devicetree_export *export) {
+	// The node and property tables belong to the export, but the lookup tables built by
+	// queries belong to the index.
+	export->index.nodes = NULL;
+	export->index.properties = NULL;
+	devicetree_index_free(&export->index);
+	if (export->mapping != NULL) {
+		munmap(export->mapping, export->mapping_size);
+	}
+	memset(export, 0, sizeof(*export));
+}
+
+uint32_t
+devicetree_export_find_name(const struct devicetree_export *export, const char *name) {
+	size_t low = 0;
+	size_t high = export->n_names;
+	while (low < high) {
+		size_t mid = low + (high - low) / 2;
+		int cmp = strcmp(name, devicetree_export_name(export, mid));
+		if (cmp == 0) {
+			return mid;
+		}
+		if (cmp < 0) {
+			high = mid;
+		} else {
+			low = mid + 1;
+		}
+	}
+	return DEVICETREE_INDEX_NONE;
+}
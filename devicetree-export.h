@@ -0,0 +1,99 @@
+/*
+ * devicetree-export.h
+ * Brandon Azad
+ */
+#ifndef DEVICETREE_EXPORT__H_
+#define DEVICETREE_EXPORT__H_
+
+#include "devicetree-index.h"
+
+// An export file holds a devicetree together with everything needed to query it without parsing
+// it again: the index's node and property tables, the interned property names, and a display
+// type for each property. All sections are stored in the host's byte order at 8-byte aligned
+// offsets, so a mapped export is used in place.
+//
+// The file is laid out as a header followed by these sections:
+//
+//   data            the raw devicetree
+//   nodes           struct devicetree_index_node[n_nodes]
+//   properties      struct devicetree_index_property[n_properties], with offsets into data
+//   property_names  uint32_t[n_properties], the name ID of each property
+//   display_types   uint8_t[n_properties], chosen by whoever wrote the export
+//   names           uint32_t[n_names], the offset of each name in strings, in sorted order
+//   strings         the null-terminated names
+
+#define DEVICETREE_EXPORT_MAGIC		"DTEXPORT"
+#define DEVICETREE_EXPORT_VERSION	1
+
+struct devicetree_export_header {
+	char magic[8];
+	uint32_t version;
+	// The size of this header.
+	uint32_t header_size;
+	// The size of the whole file.
+	uint64_t file_size;
+	uint32_t n_nodes;
+	uint32_t n_properties;
+	uint32_t n_names;
+	uint32_t strings_size;
+	uint64_t data_offset;
+	uint64_t data_size;
+	uint64_t nodes_offset;
+	uint64_t properties_offset;
+	uint64_t property_names_offset;
+	uint64_t display_types_offset;
+	uint64_t names_offset;
+	uint64_t strings_offset;
+};
+
+struct devicetree_export {
+	// The index of the exported devicetree. Its tables point into the export, so it can be
+	// passed to any of the devicetree_index functions but must not be freed with
+	// devicetree_index_free().
+	struct devicetree_index index;
+	// The name ID of each property.
+	const uint32_t *property_names;
+	// The display type of each property.
+	const uint8_t *display_types;
+	// The offsets of the interned names in strings, sorted by name.
+	const uint32_t *names;
+	size_t n_names;
+	const char *strings;
+	// The mapping made by devicetree_open_index(), or NULL.
+	void *mapping;
+	size_t mapping_size;
+};
+
+// Check whether the data starts like an export file.
+bool devicetree_export_detect(const void *data, size_t size);
+
+// Write an export of the indexed devicetree to a file descriptor. display_types holds one byte for
+// each property of the index. The tables and the devicetree data are handed to writev() as is.
+// Returns false if a write fails.
+bool devicetree_export_write(const struct devicetree_index *index, const uint8_t *display_types,
+		int fd);
+
+// Use an export that is already in memory. The data must be 8-byte aligned and must remain valid
+// for as long as the export is used. The sections and every entry of the tables are checked in
+// time linear in their size, so that the index can be used as if devicetree_index_build() had
+// built it; the devicetree data and the display types themselves are not checked. Returns false
+// if the data is not a well-formed export.
+bool devicetree_export_load(const void *data, size_t size, struct devicetree_export *export);
+
+// Map an export file and load it. On failure, errno is set (EINVAL if the file is not a
+// well-formed export) and false is returned.
+bool devicetree_open_index(const char *path, struct devicetree_export *export);
+
+// Free the tables that queries built on the index and unmap the file, if it was mapped by
+// devicetree_open_index().
+void devicetree_close_index(struct devicetree_export *export);
+
+// Find the ID of a property name. Returns DEVICETREE_INDEX_NONE if no property has the name.
+uint32_t devicetree_export_find_name(const struct devicetree_export *export, const char *name);
+
+static inline const char *
+devicetree_export_name(const struct devicetree_export *export, uint32_t name_id) {
+	return export->strings + export->names[name_id];
+}
+
+#endif
@@ -0,0 +1,158 @@
+/*
+ * devicetree-hash.c
+ * Brandon Azad
+ */
+#include "devicetree-hash.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+// ---- MurmurHash3 x64_128 -----------------------------------------------------------------------
+
+// The hash state is kept in a struct so that 16-byte blocks can be fed in one at a time. Feeding a
+// list of child hashes this way gives the same result as hashing them all in one buffer, without
+// having to build the buffer.
+struct hash_state {
+	uint64_t h1;
+	uint64_t h2;
+	size_t length;
+};
+
+#define C1	0x87c37b91114253d5
+#define C2	0x4cf5ad432745937f
+
+static inline uint64_t
+rotl64(uint64_t x, int r) {
+	return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t
+fmix64(uint64_t k) {
+	k ^= k >> 33;
+	k *= 0xff51afd7ed558ccd;
+	k ^= k >> 33;
+	k *= 0xc4ceb9fe1a85ec53;
+	k ^= k >> 33;
+	return k;
+}
+
+static inline void
+hash_init(struct hash_state *state, uint64_t seed) {
+	state->h1 = seed;
+	state->h2 = seed;
+	state->length = 0;
+}
+
+static inline void
+hash_block(struct hash_state *state, uint64_t k1, uint64_t k2) {
+	uint64_t h1 = state->h1;
+	uint64_t h2 = state->h2;
+	k1 *= C1; k1 = rotl64(k1, 31); k1 *= C2; h1 ^= k1;
+	h1 = rotl64(h1, 27); h1 += h2; h1 = h1 * 5 + 0x52dce729;
+	k2 *= C2; k2 = rotl64(k2, 33); k2 *= C1; h2 ^= k2;
+	h2 = rotl64(h2, 31); h2 += h1; h2 = h2 * 5 + 0x38495ab5;
+	state->h1 = h1;
+	state->h2 = h2;
+	state->length += 16;
+}
+
+// Hash the final 0 to 15 bytes.
+static inline void
+hash_tail(struct hash_state *state, const uint8_t *tail, size_t size) {
+	uint64_t k1 = 0;
+	uint64_t k2 = 0;
+	for (size_t i = size; i > 8; i--) {
+		k2 = (k2 << 8) | tail[i - 1];
+	}
+	for (size_t i = (size < 8 ? size : 8); i > 0; i--) {
+		k1 = (k1 << 8) | tail[i - 1];
+	}
+	if (size > 8) {
+		k2 *= C2; k2 = rotl64(k2, 33); k2 *= C1; state->h2 ^= k2;
+	}
+	if (size > 0) {
+		k1 *= C1; k1 = rotl64(k1, 31); k1 *= C2; state->h1 ^= k1;
+	}
+	state->length += size;
+}
+
+static inline struct devicetree_hash
+hash_finish(struct hash_state *state) {
+	uint64_t h1 = state->h1 ^ state->length;
+	uint64_t h2 = state->h2 ^ state->length;
+	h1 += h2;
+	h2 += h1;
+	h1 = fmix64(h1);
+	h2 = fmix64(h2);
+	h1 += h2;
+	h2 += h1;
+	return (struct devicetree_hash) { h1, h2 };
+}
+
+static struct devicetree_hash
+hash_bytes(const void *data, size_t size, uint64_t seed) {
+	const uint8_t *p = data;
+	const uint8_t *end = p + size;
+	struct hash_state state;
+	hash_init(&state, seed);
+	// Property values are only 4-byte aligned, so read the blocks with memcpy().
+	for (; end - p >= 16; p += 16) {
+		uint64_t k[2];
+		memcpy(k, p, sizeof(k));
+		hash_block(&state, k[0], k[1]);
+	}
+	hash_tail(&state, p, end - p);
+	return hash_finish(&state);
+}
+
+// ---- Devicetree hashes -------------------------------------------------------------------------
+
+#define PROPERTY_NAME_SIZE	sizeof(((struct devicetree_property *)NULL)->name)
+
+void
+devicetree_hashes_compute(const struct devicetree_index *index,
+		struct devicetree_hashes *hashes) {
+	struct devicetree_hash *properties = malloc(index->n_properties * sizeof(*properties));
+	struct devicetree_hash *nodes = malloc(index->n_nodes * sizeof(*nodes));
+	assert((properties != NULL || index->n_properties == 0)
+			&& (nodes != NULL || index->n_nodes == 0));
+	// A property's hash is the hash of its value, seeded with the hash of its name and flag, so
+	// that setting or clearing the flag alone changes the hash.
+	for (size_t i = 0; i < index->n_properties; i++) {
+		const struct devicetree_index_property *prop = &index->properties[i];
+		const char *name = devicetree_index_property_name(index, prop);
+		size_t name_length = strnlen(name, PROPERTY_NAME_SIZE);
+		uint64_t seed = hash_bytes(name, name_length, prop->flags).lo;
+		properties[i] = hash_bytes(devicetree_index_property_value(index, prop),
+				prop->size, seed);
+	}
+	// Children come after their parents in tree order, so walking the nodes backwards means
+	// every child's subtree hash is ready before its parent needs it.
+	for (size_t id = index->n_nodes; id > 0; id--) {
+		const struct devicetree_index_node *node = &index->nodes[id - 1];
+		struct hash_state state;
+		hash_init(&state, 0);
+		hash_block(&state, node->n_properties, node->n_children);
+		const struct devicetree_hash *prop = &properties[node->first_property];
+		const struct devicetree_hash *props_end = prop + node->n_properties;
+		for (; prop < props_end; prop++) {
+			hash_block(&state, prop->lo, prop->hi);
+		}
+		for (uint32_t child = id; child < node->subtree_end;
+				child = index->nodes[child].subtree_end) {
+			hash_block(&state, nodes[child].lo, nodes[child].hi);
+		}
+		nodes[id - 1] = hash_finish(&state);
+	}
+	hashes->properties = properties;
+	hashes->nodes      = nodes;
+}
+
+void
+devicetree_hashes_free(struct devicetree_hashes *hashes) {
+	free(hashes->properties);
+	free(hashes->nodes);
+	hashes->properties = NULL;
+	hashes->nodes = NULL;
+}
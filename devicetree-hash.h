@@ -0,0 +1,38 @@
+/*
+ * devicetree-hash.h
+ * Brandon Azad
+ */
+#ifndef DEVICETREE_HASH__H_
+#define DEVICETREE_HASH__H_
+
+#include "devicetree-index.h"
+
+// A 128-bit content hash. This is a fast non-cryptographic hash (MurmurHash3), meant for change
+// detection and deduplication, not for authenticating untrusted data.
+struct devicetree_hash {
+	uint64_t lo;
+	uint64_t hi;
+};
+
+struct devicetree_hashes {
+	// The hash of each property in the index, covering the property's name, flag and value.
+	struct devicetree_hash *properties;
+	// The Merkle hash of each node's subtree, covering the node's properties and the subtree
+	// hashes of its children, in order. Two subtrees with the same hash have the same
+	// properties and the same children.
+	struct devicetree_hash *nodes;
+};
+
+// Compute the hash of every property and every subtree of the indexed devicetree. This takes a
+// single pass over the property values and a single pass over the nodes.
+void devicetree_hashes_compute(const struct devicetree_index *index,
+		struct devicetree_hashes *hashes);
+
+void devicetree_hashes_free(struct devicetree_hashes *hashes);
+
+static inline bool
+devicetree_hash_equal(struct devicetree_hash a, struct devicetree_hash b) {
+	return (a.lo == b.lo && a.hi == b.hi);
+}
+
+#endif
@@ -0,0 +1,639 @@
+/*
+ * devicetree-index.c
+ * Brandon Azad
+ */
+#include "devicetree-index.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct devicetree_path_entry {
+	uint64_t hash;
+	uint32_t node;
+};
+
+struct devicetree_path_table {
+	// The hash table, with linear probing. The capacity is a power of 2.
+	struct devicetree_path_entry *entries;
+	size_t capacity;
+	// The name of each node, as a pointer and length into the devicetree data.
+	const char **names;
+	uint32_t *name_lengths;
+};
+
+// Make sure that there is room for at least one more element in the table.
+static void *
+table_reserve(void *table, size_t count, size_t *capacity, size_t element_size) {
+	if (count < *capacity) {
+		return table;
+	}
+	size_t new_capacity = (*capacity == 0 ? 64 : 2 * *capacity);
+	void *new_table = realloc(table, new_capacity * element_size);
+	assert(new_table != NULL);
+	*capacity = new_capacity;
+	return new_table;
+}
+
+bool
+devicetree_index_build(const void *data, size_t size, struct devicetree_index *index) {
+	const uint8_t *base = data;
+	const uint8_t *p = base;
+	const uint8_t *end = base + size;
+	struct devicetree_index_node *nodes = NULL;
+	size_t n_nodes = 0;
+	size_t nodes_capacity = 0;
+	struct devicetree_index_property *properties = NULL;
+	size_t n_properties = 0;
+	size_t properties_capacity = 0;
+	// remaining[d] is the number of children of the open node at depth d that we have not yet
+	// finished. This stands in for the recursion in devicetree_iterate().
+	uint32_t *remaining = NULL;
+	size_t remaining_capacity = 0;
+	bool ok = false;
+	// All offsets are stored in 32 bits.
+	if (size > UINT32_MAX) {
+		goto fail;
+	}
+	uint32_t parent = DEVICETREE_INDEX_NONE;
+	uint32_t depth = 0;
+	for (;;) {
+		// Parse the node header.
+		const struct devicetree_node *header = (const struct devicetree_node *)p;
+		if (p + sizeof(*header) > end) {
+			goto fail;
+		}
+		nodes = table_reserve(nodes, n_nodes, &nodes_capacity, sizeof(*nodes));
+		uint32_t id = n_nodes++;
+		struct devicetree_index_node *node = &nodes[id];
+		node->offset         = p - base;
+		node->depth          = depth;
+		node->parent         = parent;
+		node->first_property = n_properties;
+		node->n_properties   = header->n_properties;
+		node->n_children     = header->n_children;
+		p += sizeof(*header);
+		// Record the node's properties.
+		for (size_t i = 0; i < node->n_properties; i++) {
+			const void *next = p;
+			const char *name;
+			const void *value;
+			size_t prop_size;
+			bool prop_ok = devicetree_next_property(&next, end, &name, &value, &prop_size);
+			if (!prop_ok) {
+				goto fail;
+			}
+			p = next;
+			properties = table_reserve(properties, n_properties, &properties_capacity,
+					sizeof(*properties));
+			struct devicetree_index_property *prop = &properties[n_properties++];
+			prop->name_offset  = (const uint8_t *)name - base;
+			prop->value_offset = (const uint8_t *)value - base;
+			prop->size         = prop_size;
+			prop->flags        = ((const struct devicetree_property *)name)->size
+				& DEVICETREE_PROPERTY_FLAG;
+		}
+		// If the node has children, descend into the first one.
+		if (node->n_children > 0) {
+			if (depth >= DEVICETREE_DEFAULT_MAX_DEPTH) {
+				goto fail;
+			}
+			remaining = table_reserve(remaining, depth, &remaining_capacity,
+					sizeof(*remaining));
+			remaining[depth] = node->n_children;
+			parent = id;
+			depth++;
+			continue;
+		}
+		// This node is a leaf, so its subtree is done. Close out every ancestor whose last
+		// child we just finished.
+		node->end = p - base;
+		node->subtree_end = n_nodes;
+		for (;;) {
+			if (parent == DEVICETREE_INDEX_NONE) {
+				ok = true;
+				goto done;
+			}
+			remaining[depth - 1]--;
+			if (remaining[depth - 1] > 0) {
+				break;
+			}
+			nodes[parent].end = p - base;
+			nodes[parent].subtree_end = n_nodes;
+			parent = nodes[parent].parent;
+			depth--;
+		}
+	}
+done:
+	index->data         = base;
+	index->size         = size;
+	index->nodes        = nodes;
+	index->n_nodes      = n_nodes;
+	index->properties   = properties;
+	index->n_properties = n_properties;
+	index->paths        = NULL;
+	index->compatibles  = NULL;
+	index->phandles     = NULL;
+	nodes = NULL;
+	properties = NULL;
+fail:
+	free(remaining);
+	free(properties);
+	free(nodes);
+	return ok;
+}
+
+static void devicetree_path_table_free(struct devicetree_path_table *table);
+static void devicetree_compatible_table_free(struct devicetree_compatible_table *table);
+static void devicetree_phandle_table_free(struct devicetree_phandle_table *table);
+
+void
+devicetree_index_free(struct devicetree_index *index) {
+	if (index->paths != NULL) {
+		devicetree_path_table_free(index->paths);
+	}
+	if (index->compatibles != NULL) {
+		devicetree_compatible_table_free(index->compatibles);
+	}
+	if (index->phandles != NULL) {
+		devicetree_phandle_table_free(index->phandles);
+	}
+	free(index->nodes);
+	free(index->properties);
+	memset(index, 0, sizeof(*index));
+}
+
+void
+devicetree_index_iterate(const struct devicetree_index *index,
+		devicetree_iterate_node_callback_t node_callback,
+		devicetree_iterate_property_callback_t property_callback) {
+	devicetree_index_iterate_range(index, 0, index->n_nodes, node_callback, property_callback);
+}
+
+void
+devicetree_index_iterate_range(const struct devicetree_index *index,
+		uint32_t first_node, uint32_t end_node,
+		devicetree_iterate_node_callback_t node_callback,
+		devicetree_iterate_property_callback_t property_callback) {
+	bool stop = false;
+	size_t next_id;
+	for (size_t id = first_node; id < end_node; id = next_id) {
+		const struct devicetree_index_node *node = &index->nodes[id];
+		next_id = id + 1;
+		if (node_callback != NULL) {
+			bool skip_children = false;
+			node_callback(node->depth, index->data + node->offset,
+					index->size - node->offset,
+					node->n_properties, node->n_children,
+					&skip_children, &stop);
+			if (stop) {
+				return;
+			}
+			// Jump straight past the node's descendants.
+			if (skip_children) {
+				next_id = node->subtree_end;
+			}
+		}
+		if (property_callback == NULL) {
+			continue;
+		}
+		const struct devicetree_index_property *prop = &index->properties[node->first_property];
+		const struct devicetree_index_property *props_end = prop + node->n_properties;
+		for (; prop < props_end; prop++) {
+			property_callback(node->depth + 1,
+					devicetree_index_property_name(index, prop),
+					devicetree_index_property_value(index, prop),
+					prop->size, &stop);
+			if (stop) {
+				return;
+			}
+		}
+	}
+}
+
+bool
+devicetree_index_find_property(const struct devicetree_index *index, uint32_t id,
+		const char *name, const void **value, size_t *size) {
+	const struct devicetree_index_node *node = &index->nodes[id];
+	const struct devicetree_index_property *prop = &index->properties[node->first_property];
+	const struct devicetree_index_property *props_end = prop + node->n_properties;
+	for (; prop < props_end; prop++) {
+		if (strcmp(devicetree_index_property_name(index, prop), name) == 0) {
+			*value = devicetree_index_property_value(index, prop);
+			*size = prop->size;
+			return true;
+		}
+	}
+	return false;
+}
+
+void
+devicetree_index_node_name(const struct devicetree_index *index, uint32_t id,
+		const char **name, uint32_t *length) {
+	const void *value;
+	size_t size;
+	bool found = devicetree_index_find_property(index, id, "name", &value, &size);
+	if (found) {
+		*name = value;
+		*length = strnlen(*name, size);
+		return;
+	}
+	// Nodes without a name get an empty name.
+	*name = "";
+	*length = 0;
+}
+
+// ---- Path lookup -------------------------------------------------------------------------------
+
+// Paths and compatible strings are hashed with 64-bit FNV-1a.
+#define FNV_HASH_INIT	0xcbf29ce484222325
+#define FNV_HASH_PRIME	0x100000001b3
+
+static uint64_t
+hash_bytes(uint64_t hash, const char *bytes, size_t length) {
+	for (size_t i = 0; i < length; i++) {
+		hash = (hash ^ (uint8_t)bytes[i]) * FNV_HASH_PRIME;
+	}
+	return hash;
+}
+
+// Paths are hashed one "/component" at a time, so the hash of a node's path is the hash of its
+// parent's path extended with the node's own name.
+static uint64_t
+path_hash_component(uint64_t hash, const char *name, size_t length) {
+	hash = (hash ^ '/') * FNV_HASH_PRIME;
+	return hash_bytes(hash, name, length);
+}
+
+static void
+devicetree_path_table_free(struct devicetree_path_table *table) {
+	free(table->entries);
+	free(table->names);
+	free(table->name_lengths);
+	free(table);
+}
+
+static struct devicetree_path_table *
+devicetree_path_table_build(const struct devicetree_index *index) {
+	struct devicetree_path_table *table = malloc(sizeof(*table));
+	assert(table != NULL);
+	size_t capacity = 16;
+	while (capacity < 2 * index->n_nodes) {
+		capacity *= 2;
+	}
+	table->capacity = capacity;
+	table->entries = malloc(capacity * sizeof(*table->entries));
+	table->names = malloc(index->n_nodes * sizeof(*table->names));
+	table->name_lengths = malloc(index->n_nodes * sizeof(*table->name_lengths));
+	uint64_t *hashes = malloc(index->n_nodes * sizeof(*hashes));
+	assert(table->entries != NULL && table->names != NULL && table->name_lengths != NULL
+			&& hashes != NULL);
+	for (size_t i = 0; i < capacity; i++) {
+		table->entries[i].node = DEVICETREE_INDEX_NONE;
+	}
+	// Parents come before their children, so a single pass in tree order sees every parent's
+	// hash before it is needed. Inserting in tree order also means that among nodes with the
+	// same path, the first one is found first.
+	for (uint32_t id = 0; id < index->n_nodes; id++) {
+		devicetree_index_node_name(index, id, &table->names[id], &table->name_lengths[id]);
+		uint32_t parent = index->nodes[id].parent;
+		uint64_t hash = FNV_HASH_INIT;
+		if (parent != DEVICETREE_INDEX_NONE) {
+			hash = path_hash_component(hashes[parent],
+					table->names[id], table->name_lengths[id]);
+		}
+		hashes[id] = hash;
+		size_t slot = hash & (capacity - 1);
+		while (table->entries[slot].node != DEVICETREE_INDEX_NONE) {
+			slot = (slot + 1) & (capacity - 1);
+		}
+		table->entries[slot].hash = hash;
+		table->entries[slot].node = id;
+	}
+	free(hashes);
+	return table;
+}
+
+// Check whether the node's path really is the given path, walking up the tree from the node while
+// walking backwards through the path.
+static bool
+path_matches(const struct devicetree_index *index, const struct devicetree_path_table *table,
+		uint32_t id, const char *path, const char *path_end) {
+	const char *p = path_end;
+	for (;;) {
+		// Skip over any trailing or repeated slashes.
+		while (p > path && p[-1] == '/') {
+			p--;
+		}
+		uint32_t parent = index->nodes[id].parent;
+		if (parent == DEVICETREE_INDEX_NONE) {
+			return (p == path);
+		}
+		const char *component_end = p;
+		while (p > path && p[-1] != '/') {
+			p--;
+		}
+		size_t length = component_end - p;
+		if (length != table->name_lengths[id]
+				|| memcmp(p, table->names[id], length) != 0) {
+			return false;
+		}
+		id = parent;
+	}
+}
+
+uint32_t
+devicetree_find_node(struct devicetree_index *index, const char *path) {
+	if (path[0] != '/' || index->n_nodes == 0) {
+		return DEVICETREE_INDEX_NONE;
+	}
+	if (index->paths == NULL) {
+		index->paths = devicetree_path_table_build(index);
+	}
+	const struct devicetree_path_table *table = index->paths;
+	// Hash the path one component at a time, ignoring empty components.
+	uint64_t hash = FNV_HASH_INIT;
+	const char *p = path;
+	for (;;) {
+		while (*p == '/') {
+			p++;
+		}
+		if (*p == 0) {
+			break;
+		}
+		const char *component = p;
+		while (*p != '/' && *p != 0) {
+			p++;
+		}
+		hash = path_hash_component(hash, component, p - component);
+	}
+	// Probe for a node with this hash and the same path.
+	size_t slot = hash & (table->capacity - 1);
+	for (;;) {
+		const struct devicetree_path_entry *entry = &table->entries[slot];
+		if (entry->node == DEVICETREE_INDEX_NONE) {
+			return DEVICETREE_INDEX_NONE;
+		}
+		if (entry->hash == hash && path_matches(index, table, entry->node, path, p)) {
+			return entry->node;
+		}
+		slot = (slot + 1) & (table->capacity - 1);
+	}
+}
+
+// ---- Compatible lookup -------------------------------------------------------------------------
+
+struct devicetree_compatible_entry {
+	uint64_t hash;
+	const char *compatible;
+	uint32_t length;
+	// The entry's nodes are nodes[first_node, first_node + n_nodes) in the table.
+	uint32_t first_node;
+	uint32_t n_nodes;
+};
+
+struct devicetree_compatible_table {
+	// The hash table, with linear probing. The capacity is a power of 2. Empty slots have a
+	// NULL compatible.
+	struct devicetree_compatible_entry *entries;
+	size_t capacity;
+	// The node lists of all entries, one after another.
+	uint32_t *nodes;
+};
+
+// One compatible entry of one node, found while scanning the tree.
+struct compatible_occurrence {
+	uint64_t hash;
+	const char *compatible;
+	uint32_t length;
+	uint32_t node;
+};
+
+static void
+devicetree_compatible_table_free(struct devicetree_compatible_table *table) {
+	free(table->entries);
+	free(table->nodes);
+	free(table);
+}
+
+static struct devicetree_compatible_entry *
+compatible_table_probe(const struct devicetree_compatible_table *table, uint64_t hash,
+		const char *compatible, size_t length) {
+	size_t slot = hash & (table->capacity - 1);
+	for (;;) {
+		struct devicetree_compatible_entry *entry = &table->entries[slot];
+		if (entry->compatible == NULL || (entry->hash == hash && entry->length == length
+					&& memcmp(entry->compatible, compatible, length) == 0)) {
+			return entry;
+		}
+		slot = (slot + 1) & (table->capacity - 1);
+	}
+}
+
+static struct devicetree_compatible_table *
+devicetree_compatible_table_build(const struct devicetree_index *index) {
+	// Collect every entry of every compatible property, in tree order.
+	struct compatible_occurrence *occurrences = NULL;
+	size_t n_occurrences = 0;
+	size_t occurrences_capacity = 0;
+	for (uint32_t id = 0; id < index->n_nodes; id++) {
+		const void *value;
+		size_t size;
+		bool found = devicetree_index_find_property(index, id, "compatible", &value, &size);
+		if (!found) {
+			continue;
+		}
+		const char *p = value;
+		const char *end = p + size;
+		while (p < end) {
+			const char *entry_end = memchr(p, 0, end - p);
+			if (entry_end == NULL) {
+				entry_end = end;
+			}
+			if (entry_end > p) {
+				occurrences = table_reserve(occurrences, n_occurrences,
+						&occurrences_capacity, sizeof(*occurrences));
+				struct compatible_occurrence *occurrence =
+					&occurrences[n_occurrences++];
+				size_t length = entry_end - p;
+				occurrence->hash       = hash_bytes(FNV_HASH_INIT, p, length);
+				occurrence->compatible = p;
+				occurrence->length     = length;
+				occurrence->node       = id;
+			}
+			p = entry_end + 1;
+		}
+	}
+	struct devicetree_compatible_table *table = malloc(sizeof(*table));
+	assert(table != NULL);
+	size_t capacity = 16;
+	while (capacity < 2 * n_occurrences) {
+		capacity *= 2;
+	}
+	table->capacity = capacity;
+	table->entries = calloc(capacity, sizeof(*table->entries));
+	table->nodes = malloc(n_occurrences * sizeof(*table->nodes));
+	assert(table->entries != NULL && (table->nodes != NULL || n_occurrences == 0));
+	// Count the nodes of each distinct entry. A node that lists the same string twice is only
+	// counted once.
+	for (size_t i = 0; i < n_occurrences; i++) {
+		struct compatible_occurrence *occurrence = &occurrences[i];
+		struct devicetree_compatible_entry *entry = compatible_table_probe(table,
+				occurrence->hash, occurrence->compatible, occurrence->length);
+		if (entry->compatible == NULL) {
+			entry->hash       = occurrence->hash;
+			entry->compatible = occurrence->compatible;
+			entry->length     = occurrence->length;
+			entry->first_node = DEVICETREE_INDEX_NONE;
+		} else if (entry->first_node == occurrence->node) {
+			occurrence->compatible = NULL;
+			continue;
+		}
+		// Until the lists are laid out, first_node holds the last node seen.
+		entry->first_node = occurrence->node;
+		entry->n_nodes++;
+	}
+	// Lay out the node lists and fill them in tree order.
+	uint32_t next = 0;
+	for (size_t slot = 0; slot < capacity; slot++) {
+		struct devicetree_compatible_entry *entry = &table->entries[slot];
+		if (entry->compatible != NULL) {
+			entry->first_node = next;
+			next += entry->n_nodes;
+			entry->n_nodes = 0;
+		}
+	}
+	for (size_t i = 0; i < n_occurrences; i++) {
+		struct compatible_occurrence *occurrence = &occurrences[i];
+		if (occurrence->compatible == NULL) {
+			continue;
+		}
+		struct devicetree_compatible_entry *entry = compatible_table_probe(table,
+				occurrence->hash, occurrence->compatible, occurrence->length);
+		table->nodes[entry->first_node + entry->n_nodes++] = occurrence->node;
+	}
+	free(occurrences);
+	return table;
+}
+
+size_t
+devicetree_find_compatible(struct devicetree_index *index, const char *compatible,
+		const uint32_t **nodes) {
+	if (index->compatibles == NULL) {
+		index->compatibles = devicetree_compatible_table_build(index);
+	}
+	const struct devicetree_compatible_table *table = index->compatibles;
+	size_t length = strlen(compatible);
+	const struct devicetree_compatible_entry *entry = compatible_table_probe(table,
+			hash_bytes(FNV_HASH_INIT, compatible, length), compatible, length);
+	if (entry->compatible == NULL) {
+		*nodes = NULL;
+		return 0;
+	}
+	*nodes = table->nodes + entry->first_node;
+	return entry->n_nodes;
+}
+
+// ---- Phandle lookup ----------------------------------------------------------------------------
+
+struct devicetree_phandle_entry {
+	uint32_t phandle;
+	uint32_t node;
+};
+
+struct devicetree_phandle_table {
+	// The hash table, with linear probing. The capacity is a power of 2. Empty slots have node
+	// DEVICETREE_INDEX_NONE.
+	struct devicetree_phandle_entry *entries;
+	size_t capacity;
+};
+
+static size_t
+phandle_slot(uint32_t phandle, size_t capacity) {
+	// Phandles are usually small consecutive integers, so scramble them with a multiplicative
+	// hash.
+	return (size_t)((phandle * 0x9e3779b97f4a7c15) >> 32) & (capacity - 1);
+}
+
+static void
+devicetree_phandle_table_free(struct devicetree_phandle_table *table) {
+	free(table->entries);
+	free(table);
+}
+
+static struct devicetree_phandle_table *
+devicetree_phandle_table_build(const struct devicetree_index *index) {
+	struct devicetree_phandle_table *table = malloc(sizeof(*table));
+	assert(table != NULL);
+	size_t capacity = 16;
+	while (capacity < 2 * index->n_nodes) {
+		capacity *= 2;
+	}
+	table->capacity = capacity;
+	table->entries = malloc(capacity * sizeof(*table->entries));
+	assert(table->entries != NULL);
+	for (size_t i = 0; i < capacity; i++) {
+		table->entries[i].node = DEVICETREE_INDEX_NONE;
+	}
+	for (uint32_t id = 0; id < index->n_nodes; id++) {
+		const void *value;
+		size_t size;
+		bool found = devicetree_index_find_property(index, id, "AAPL,phandle",
+				&value, &size);
+		if (!found || size != sizeof(uint32_t)) {
+			continue;
+		}
+		uint32_t phandle = *(const uint32_t *)value;
+		size_t slot = phandle_slot(phandle, capacity);
+		for (;;) {
+			struct devicetree_phandle_entry *entry = &table->entries[slot];
+			// Keep the first node with a given phandle.
+			if (entry->node != DEVICETREE_INDEX_NONE && entry->phandle == phandle) {
+				break;
+			}
+			if (entry->node == DEVICETREE_INDEX_NONE) {
+				entry->phandle = phandle;
+				entry->node = id;
+				break;
+			}
+			slot = (slot + 1) & (capacity - 1);
+		}
+	}
+	return table;
+}
+
+uint32_t
+devicetree_find_phandle(struct devicetree_index *index, uint32_t phandle) {
+	if (index->phandles == NULL) {
+		index->phandles = devicetree_phandle_table_build(index);
+	}
+	const struct devicetree_phandle_table *table = index->phandles;
+	size_t slot = phandle_slot(phandle, table->capacity);
+	for (;;) {
+		const struct devicetree_phandle_entry *entry = &table->entries[slot];
+		if (entry->node == DEVICETREE_INDEX_NONE || entry->phandle == phandle) {
+			return entry->node;
+		}
+		slot = (slot + 1) & (table->capacity - 1);
+	}
+}
+
+bool
+devicetree_resolve_function(struct devicetree_index *index, const void *value, size_t size,
+		struct devicetree_function *function) {
+	if (size < 2 * sizeof(uint32_t) || size % sizeof(uint32_t) != 0) {
+		return false;
+	}
+	const uint32_t *words = value;
+	uint32_t name = words[1];
+	function->phandle = words[0];
+	function->node    = devicetree_find_phandle(index, function->phandle);
+	function->name[0] = (char)(name >> 24);
+	function->name[1] = (char)(name >> 16);
+	function->name[2] = (char)(name >> 8);
+	function->name[3] = (char)name;
+	function->name[4] = 0;
+	function->args    = words + 2;
+	function->n_args  = size / sizeof(uint32_t) - 2;
+	return true;
+}
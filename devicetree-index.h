@@ -0,0 +1,149 @@
+/*
+ * devicetree-index.h
+ * Brandon Azad
+ */
+#ifndef DEVICETREE_INDEX__H_
+#define DEVICETREE_INDEX__H_
+
+#include "devicetree-parse.h"
+
+// The node ID used for "no node", e.g. the parent of the root.
+#define DEVICETREE_INDEX_NONE ((uint32_t)-1)
+
+struct devicetree_index_node {
+	// The byte offset of the node header.
+	uint32_t offset;
+	// The byte offset just past the last property of the node's last descendant.
+	uint32_t end;
+	// The depth of the node; the root is at depth 0.
+	uint32_t depth;
+	// The node ID of the parent, or DEVICETREE_INDEX_NONE for the root.
+	uint32_t parent;
+	// The index of the node's first property in the property table.
+	uint32_t first_property;
+	uint32_t n_properties;
+	uint32_t n_children;
+	// The node ID just past this node's subtree. Node IDs are assigned in tree order, so the
+	// descendants of a node are exactly the IDs in the range (id, subtree_end).
+	uint32_t subtree_end;
+};
+
+struct devicetree_index_property {
+	// The byte offset of the null-terminated property name.
+	uint32_t name_offset;
+	// The byte offset of the property value.
+	uint32_t value_offset;
+	// The size of the property value, without the flag bit.
+	uint32_t size;
+	// The flag bit of the size field: either 0 or DEVICETREE_PROPERTY_FLAG.
+	uint32_t flags;
+};
+
+struct devicetree_index {
+	// The devicetree data that was indexed. The index does not own the data.
+	const uint8_t *data;
+	size_t size;
+	// The nodes in tree order. The root is node 0.
+	struct devicetree_index_node *nodes;
+	size_t n_nodes;
+	// The properties of all nodes, in tree order.
+	struct devicetree_index_property *properties;
+	size_t n_properties;
+	// The hash table of node paths, built on the first call to devicetree_find_node().
+	struct devicetree_path_table *paths;
+	// The hash table of compatible strings, built on the first call to
+	// devicetree_find_compatible().
+	struct devicetree_compatible_table *compatibles;
+	// The hash table of phandles, built on the first call to devicetree_find_phandle().
+	struct devicetree_phandle_table *phandles;
+};
+
+// A reference from a "function-*" property: the node with the given phandle, a function name, and
+// the function's arguments.
+struct devicetree_function {
+	// The node with the phandle, or DEVICETREE_INDEX_NONE if there is no such node.
+	uint32_t node;
+	uint32_t phandle;
+	// The 4-character function name, like "GPIO", null-terminated.
+	char name[5];
+	// The remaining 32-bit words of the property.
+	const uint32_t *args;
+	size_t n_args;
+};
+
+// Build an index of the devicetree in a single pass over the data. The data must remain valid for
+// as long as the index is used. Returns false if the devicetree is malformed or deeper than
+// DEVICETREE_DEFAULT_MAX_DEPTH.
+bool devicetree_index_build(const void *data, size_t size, struct devicetree_index *index);
+
+void devicetree_index_free(struct devicetree_index *index);
+
+// Walk the indexed devicetree, invoking the callbacks exactly as devicetree_iterate() would but
+// without parsing the data again. Skipping the children of a node takes constant time.
+void devicetree_index_iterate(const struct devicetree_index *index,
+		devicetree_iterate_node_callback_t node_callback,
+		devicetree_iterate_property_callback_t property_callback);
+
+// Like devicetree_index_iterate(), but only visit the nodes with IDs in [first_node, end_node).
+void devicetree_index_iterate_range(const struct devicetree_index *index,
+		uint32_t first_node, uint32_t end_node,
+		devicetree_iterate_node_callback_t node_callback,
+		devicetree_iterate_property_callback_t property_callback);
+
+// Find the node with the given path, like "/arm-io/uart0". Path components are the values of the
+// nodes' "name" properties; the root is "/". If several nodes have the same path, the first one in
+// tree order is returned. Returns DEVICETREE_INDEX_NONE if there is no such node.
+//
+// The first call builds a hash table of every path in the tree; after that, each lookup takes
+// time proportional to the length of the path. The index must not be shared between threads
+// until the table has been built.
+uint32_t devicetree_find_node(struct devicetree_index *index, const char *path);
+
+// Find the nodes that list the given string as one of the null-separated entries of their
+// "compatible" property. Returns the number of such nodes and sets *nodes to their IDs in tree
+// order. The array belongs to the index.
+//
+// As with devicetree_find_node(), the first call builds a hash table from every compatible entry
+// to its nodes, after which each lookup is a single hash probe. The index must not be shared
+// between threads until the table has been built.
+size_t devicetree_find_compatible(struct devicetree_index *index, const char *compatible,
+		const uint32_t **nodes);
+
+// Find the node whose "AAPL,phandle" property has the given value. If several nodes have the same
+// phandle, the first one in tree order is returned. Returns DEVICETREE_INDEX_NONE if there is no
+// such node.
+//
+// The first call builds a hash table of every phandle in the tree. The index must not be shared
+// between threads until the table has been built.
+uint32_t devicetree_find_phandle(struct devicetree_index *index, uint32_t phandle);
+
+// Resolve the value of a "function-*" property. The value is a phandle, a function name stored as
+// a little-endian 32-bit integer (so "GPIO" is stored as the bytes "OIPG"), and any number of
+// 32-bit arguments. Returns false if the value is not in this format; a phandle that doesn't
+// match any node is not an error.
+bool devicetree_resolve_function(struct devicetree_index *index, const void *value, size_t size,
+		struct devicetree_function *function);
+
+// Find the first property of a node with the given name, using the property table rather than
+// parsing the node. Returns false if the node has no such property.
+bool devicetree_index_find_property(const struct devicetree_index *index, uint32_t id,
+		const char *name, const void **value, size_t *size);
+
+// Get the name of a node: the value of its "name" property, without the trailing null. Nodes
+// without a name get an empty name.
+void devicetree_index_node_name(const struct devicetree_index *index, uint32_t id,
+		const char **name, uint32_t *length);
+
+static inline const char *
+devicetree_index_property_name(const struct devicetree_index *index,
+		const struct devicetree_index_property *property) {
+	return (const char *)(index->data + property->name_offset);
+}
+
+static inline const void *
+devicetree_index_property_value(const struct devicetree_index *index,
+		const struct devicetree_index_property *property) {
+	return index->data + property->value_offset;
+}
+
+#endif
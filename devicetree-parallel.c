@@ -0,0 +1,151 @@
+/*
+ * devicetree-parallel.c
+ * Brandon Azad
+ */
+#include "devicetree-parallel.h"
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+// The number of chunks we aim to create per thread. More chunks balance better when subtree sizes
+// vary, fewer chunks cost less to hand out.
+#define CHUNKS_PER_THREAD	8
+
+// Don't bother making chunks smaller than this many bytes of devicetree data.
+#define MIN_CHUNK_SIZE		0x1000
+
+struct parallel_chunk {
+	uint32_t first_node;
+	uint32_t end_node;
+	void *result;
+	bool done;
+};
+
+struct parallel_state {
+	const struct devicetree_index *index;
+	devicetree_parallel_map_callback_t map_callback;
+	struct parallel_chunk *chunks;
+	size_t n_chunks;
+	// The fields below are protected by the lock.
+	pthread_mutex_t lock;
+	pthread_cond_t chunk_done;
+	size_t next_chunk;
+};
+
+// Split the tree into contiguous ranges of nodes of about chunk_size bytes each. A subtree that
+// fits in the current chunk is taken whole; otherwise we take just its root and consider each of
+// its children in turn.
+static size_t
+make_chunks(const struct devicetree_index *index, size_t chunk_size,
+		struct parallel_chunk **chunks) {
+	size_t capacity = 16;
+	size_t n_chunks = 0;
+	struct parallel_chunk *table = malloc(capacity * sizeof(*table));
+	assert(table != NULL);
+	uint32_t first = 0;
+	size_t weight = 0;
+	uint32_t id = 0;
+	while (id < index->n_nodes) {
+		const struct devicetree_index_node *node = &index->nodes[id];
+		size_t subtree_size = node->end - node->offset;
+		if (weight + subtree_size <= chunk_size || node->n_children == 0) {
+			weight += subtree_size;
+			id = node->subtree_end;
+		} else {
+			// The node's own header and properties end where its first child begins.
+			weight += index->nodes[id + 1].offset - node->offset;
+			id++;
+		}
+		if (weight >= chunk_size || id == index->n_nodes) {
+			if (n_chunks == capacity) {
+				capacity *= 2;
+				table = realloc(table, capacity * sizeof(*table));
+				assert(table != NULL);
+			}
+			table[n_chunks].first_node = first;
+			table[n_chunks].end_node = id;
+			table[n_chunks].result = NULL;
+			table[n_chunks].done = false;
+			n_chunks++;
+			first = id;
+			weight = 0;
+		}
+	}
+	*chunks = table;
+	return n_chunks;
+}
+
+static void *
+parallel_worker(void *arg) {
+	struct parallel_state *state = arg;
+	pthread_mutex_lock(&state->lock);
+	while (state->next_chunk < state->n_chunks) {
+		struct parallel_chunk *chunk = &state->chunks[state->next_chunk++];
+		pthread_mutex_unlock(&state->lock);
+		void *result = state->map_callback(state->index,
+				chunk->first_node, chunk->end_node);
+		pthread_mutex_lock(&state->lock);
+		chunk->result = result;
+		chunk->done = true;
+		pthread_cond_broadcast(&state->chunk_done);
+	}
+	pthread_mutex_unlock(&state->lock);
+	return NULL;
+}
+
+void
+devicetree_parallel_map(const struct devicetree_index *index, unsigned n_threads,
+		devicetree_parallel_map_callback_t map_callback,
+		devicetree_parallel_result_callback_t result_callback) {
+	if (n_threads == 0) {
+		long n_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		n_threads = (n_cpus > 0 ? n_cpus : 1);
+	}
+	size_t chunk_size = index->size / ((size_t)n_threads * CHUNKS_PER_THREAD);
+	if (chunk_size < MIN_CHUNK_SIZE) {
+		chunk_size = MIN_CHUNK_SIZE;
+	}
+	struct parallel_state state = {
+		.index        = index,
+		.map_callback = map_callback,
+		.next_chunk   = 0,
+	};
+	state.n_chunks = make_chunks(index, chunk_size, &state.chunks);
+	if (n_threads > state.n_chunks) {
+		n_threads = state.n_chunks;
+	}
+	pthread_mutex_init(&state.lock, NULL);
+	pthread_cond_init(&state.chunk_done, NULL);
+	pthread_t *threads = malloc(n_threads * sizeof(*threads));
+	assert(threads != NULL || n_threads == 0);
+	unsigned n_started = 0;
+	for (; n_started < n_threads; n_started++) {
+		int err = pthread_create(&threads[n_started], NULL, parallel_worker, &state);
+		if (err != 0) {
+			break;
+		}
+	}
+	// If we couldn't start any threads, do the work ourselves.
+	if (n_started == 0) {
+		parallel_worker(&state);
+	}
+	// Deliver the results in order as they become available.
+	for (size_t i = 0; i < state.n_chunks; i++) {
+		struct parallel_chunk *chunk = &state.chunks[i];
+		pthread_mutex_lock(&state.lock);
+		while (!chunk->done) {
+			pthread_cond_wait(&state.chunk_done, &state.lock);
+		}
+		pthread_mutex_unlock(&state.lock);
+		result_callback(chunk->first_node, chunk->end_node, chunk->result);
+	}
+	for (unsigned i = 0; i < n_started; i++) {
+		pthread_join(threads[i], NULL);
+	}
+	free(threads);
+	pthread_cond_destroy(&state.chunk_done);
+	pthread_mutex_destroy(&state.lock);
+	free(state.chunks);
+}
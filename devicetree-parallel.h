@@ -0,0 +1,31 @@
+/*
+ * devicetree-parallel.h
+ * Brandon Azad
+ */
+#ifndef DEVICETREE_PARALLEL__H_
+#define DEVICETREE_PARALLEL__H_
+
+#include "devicetree-index.h"
+
+// Process one chunk of the tree: the nodes with IDs in [first_node, end_node). This is called on
+// a worker thread, concurrently with other chunks. The returned value is passed to the result
+// callback.
+typedef void *(^devicetree_parallel_map_callback_t)(
+		const struct devicetree_index *index,
+		uint32_t first_node, uint32_t end_node);
+
+// Consume the result of one chunk. This is called on the calling thread, once per chunk, in tree
+// order.
+typedef void (^devicetree_parallel_result_callback_t)(
+		uint32_t first_node, uint32_t end_node,
+		void *result);
+
+// Split the indexed tree into chunks of roughly equal size and process them on n_threads worker
+// threads. Chunks are contiguous ranges of node IDs made of whole subtrees where possible, so
+// concatenating the results in the order they are delivered gives the same result as a single
+// walk. If n_threads is 0, one thread per CPU is used.
+void devicetree_parallel_map(const struct devicetree_index *index, unsigned n_threads,
+		devicetree_parallel_map_callback_t map_callback,
+		devicetree_parallel_result_callback_t result_callback);
+
+#endif
@@ -5,100 +5,247 @@
 #include "devicetree-parse.h"
 
 #include <assert.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
 
-struct devicetree_node {
-	uint32_t n_properties;
-	uint32_t n_children;
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+// The stack for devicetree_iterate() lives on the C stack when the depth limit is at most this.
+#define DEVICETREE_INLINE_STACK_DEPTH	DEVICETREE_DEFAULT_MAX_DEPTH
+
+// A property that has been parsed but not yet reported. Named iteration parses all of a node's
+// properties before calling the node callback, then reports them from this buffer.
+struct pending_property {
+	const char *name;
+	const void *value;
+	size_t size;
 };
 
-struct devicetree_property {
-	char name[32];
-	uint32_t size;
-	uint8_t data[0];
+struct pending_properties {
+	struct pending_property *properties;
+	size_t capacity;
 };
 
 static bool
-devicetree_iterate_node(const void **data, const void *data_end,
-		unsigned depth, bool *stop,
+pending_properties_reserve(struct pending_properties *pending, size_t count) {
+	if (count < pending->capacity) {
+		return true;
+	}
+	size_t new_capacity = (pending->capacity == 0 ? 32 : 2 * pending->capacity);
+	void *new_properties = realloc(pending->properties,
+			new_capacity * sizeof(*pending->properties));
+	if (new_properties == NULL) {
+		return false;
+	}
+	pending->properties = new_properties;
+	pending->capacity = new_capacity;
+	return true;
+}
+
+static bool
+devicetree_iterate_nodes(const void **data, const void *data_end,
+		uint32_t *remaining, unsigned max_depth,
+		struct pending_properties *pending,
 		devicetree_iterate_node_callback_t node_callback,
+		devicetree_iterate_named_node_callback_t named_node_callback,
 		devicetree_iterate_property_callback_t property_callback) {
-	assert(!*stop);
 	const uint8_t *p = *data;
 	const uint8_t *end = (const uint8_t *)data_end;
-	// We start by parsing the node header.
-	struct devicetree_node *node = (struct devicetree_node *)p;
-	p += sizeof(*node);
-	if (p > end) {
-		return false;
-	}
-	uint32_t n_properties = node->n_properties;
-	uint32_t n_children   = node->n_children;
-	// If we have a node callback, call it.
-	if (node_callback != NULL) {
-		node_callback(depth, (const void *)node, end - p + sizeof(*node),
-				n_properties, n_children, stop);
-		if (*stop) {
-			return true;
+	// remaining[d] is the number of children of the open node at depth d that we have not yet
+	// finished. The node we are about to parse is at depth "depth".
+	unsigned depth = 0;
+	// Nodes deeper than skip_depth are in a subtree that a node callback asked us to skip. We
+	// still have to parse their headers to find the end of the subtree, but we don't report
+	// them.
+	unsigned skip_depth = UINT_MAX;
+	bool stop = false;
+	for (;;) {
+		bool skipped = (depth > skip_depth);
+		if (!skipped) {
+			skip_depth = UINT_MAX;
 		}
-	}
-	// Iterate through all the node's properties.
-	for (size_t i = 0; i < n_properties; i++) {
-		// Parse out property header.
-		struct devicetree_property *prop = (struct devicetree_property *)p;
-		p += sizeof(*prop);
+		// We start by parsing the node header.
+		struct devicetree_node *node = (struct devicetree_node *)p;
+		p += sizeof(*node);
 		if (p > end) {
 			return false;
 		}
-		// Make sure that the property name is null-terminated.
-		if (prop->name[sizeof(prop->name) - 1] != 0) {
-			return false;
+		uint32_t n_properties = node->n_properties;
+		uint32_t n_children   = node->n_children;
+		// If we have a named node callback, read all the property headers first so that we
+		// can pass it the node's name. Then report the properties without parsing them
+		// again.
+		if (named_node_callback != NULL && !skipped) {
+			size_t n_parsed = 0;
+			const char *node_name = NULL;
+			size_t name_size = 0;
+			const char *compatible = NULL;
+			size_t compatible_size = 0;
+			bool props_ok = true;
+			for (size_t i = 0; i < n_properties; i++) {
+				const char *name;
+				const void *value;
+				size_t prop_size;
+				const void *next = p;
+				props_ok = devicetree_next_property(&next, end,
+						&name, &value, &prop_size);
+				if (!props_ok || !pending_properties_reserve(pending, n_parsed)) {
+					props_ok = false;
+					break;
+				}
+				p = next;
+				struct pending_property *prop = &pending->properties[n_parsed++];
+				prop->name  = name;
+				prop->value = value;
+				prop->size  = prop_size;
+				if (node_name == NULL && strcmp(name, "name") == 0) {
+					node_name = value;
+					name_size = prop_size;
+				} else if (compatible == NULL && strcmp(name, "compatible") == 0) {
+					compatible = value;
+					compatible_size = prop_size;
+				}
+			}
+			// If the properties are malformed, still report the node and the
+			// properties that did parse, but without trusting the name.
+			if (!props_ok) {
+				node_name = NULL;
+				compatible = NULL;
+				name_size = compatible_size = 0;
+			}
+			bool skip_children = false;
+			named_node_callback(depth, (const void *)node, end - (const uint8_t *)node,
+					n_properties, n_children,
+					node_name, name_size, compatible, compatible_size,
+					&skip_children, &stop);
+			if (stop) {
+				return true;
+			}
+			if (skip_children) {
+				skip_depth = depth;
+			}
+			for (size_t i = 0; property_callback != NULL && i < n_parsed; i++) {
+				struct pending_property *prop = &pending->properties[i];
+				property_callback(depth + 1, prop->name, prop->value, prop->size,
+						&stop);
+				if (stop) {
+					return true;
+				}
+			}
+			if (!props_ok) {
+				return false;
+			}
+			// The properties have been consumed; skip the loop below.
+			n_properties = 0;
 		}
-		// Properties are padded to a multiple of 4 bytes. There also appears to be a flag
-		// field (bit 31) which is set if iBoot should replace the value of the field with
-		// a syscfg property or other value. (We do not see this flag for device trees
-		// dumped from kernel memory.)
-		uint32_t prop_size = prop->size & ~0x80000000;
-		size_t padded_size = (prop_size + 0x3) & ~0x3;
-		p += padded_size;
-		if (p > end) {
-			if (p - padded_size + prop_size == end) {
-				// We're at the very end, ease up on the lack of padding.
-				p = end;
-			} else {
+		// If we have a node callback, call it.
+		if (node_callback != NULL && !skipped) {
+			bool skip_children = false;
+			node_callback(depth, (const void *)node, end - p + sizeof(*node),
+					n_properties, n_children, &skip_children, &stop);
+			if (stop) {
+				return true;
+			}
+			if (skip_children) {
+				skip_depth = depth;
+			}
+		}
+		// Iterate through all the node's properties.
+		for (size_t i = 0; i < n_properties; i++) {
+			const char *name;
+			const void *value;
+			size_t prop_size;
+			const void *next = p;
+			bool ok = devicetree_next_property(&next, end, &name, &value, &prop_size);
+			if (!ok) {
 				return false;
 			}
+			p = next;
+			// If we have a property callback, invoke it.
+			if (property_callback != NULL && !skipped) {
+				property_callback(depth + 1, name, value, prop_size, &stop);
+				if (stop) {
+					return true;
+				}
+			}
 		}
-		// If we have a property callback, invoke it.
-		if (property_callback != NULL) {
-			property_callback(depth + 1, prop->name, prop->data, prop_size, stop);
-			if (*stop) {
+		// Now that we've finished the properties, update the pointer to the head of the data.
+		*data = p;
+		// If the node has children, the next node is its first child.
+		if (n_children > 0) {
+			if (depth >= max_depth) {
+				return false;
+			}
+			remaining[depth] = n_children;
+			depth++;
+			continue;
+		}
+		// Otherwise pop every node whose last child we just finished. The next node is the
+		// sibling of the deepest node with children remaining.
+		for (;;) {
+			if (depth == 0) {
 				return true;
 			}
+			remaining[depth - 1]--;
+			if (remaining[depth - 1] > 0) {
+				break;
+			}
+			depth--;
 		}
 	}
-	// Now that we've finished the properties, update the pointer to the head of the data.
-	*data = p;
-	// Iterate through all the node's children recursively.
-	for (size_t i = 0; i < n_children; i++) {
-		bool ok = devicetree_iterate_node(data, end, depth + 1, stop,
-				node_callback, property_callback);
-		if (!ok) {
+}
+
+static bool
+devicetree_iterate_internal(const void **data, size_t size, unsigned max_depth,
+		devicetree_iterate_node_callback_t node_callback,
+		devicetree_iterate_named_node_callback_t named_node_callback,
+		devicetree_iterate_property_callback_t property_callback) {
+	const void *end = (const uint8_t *)*data + size;
+	// Preallocate the stack for the deepest tree we will accept.
+	uint32_t inline_stack[DEVICETREE_INLINE_STACK_DEPTH];
+	uint32_t *remaining = inline_stack;
+	if (max_depth > DEVICETREE_INLINE_STACK_DEPTH) {
+		remaining = malloc(max_depth * sizeof(*remaining));
+		if (remaining == NULL) {
 			return false;
 		}
-		if (*stop) {
-			return true;
-		}
 	}
-	return true;
+	struct pending_properties pending = { NULL, 0 };
+	bool ok = devicetree_iterate_nodes(data, end, remaining, max_depth, &pending,
+			node_callback, named_node_callback, property_callback);
+	free(pending.properties);
+	if (remaining != inline_stack) {
+		free(remaining);
+	}
+	return ok;
 }
 
 bool
 devicetree_iterate(const void **data, size_t size,
 		devicetree_iterate_node_callback_t node_callback,
 		devicetree_iterate_property_callback_t property_callback) {
-	const void *end = (const uint8_t *)*data + size;
-	bool stop = false;
-	return devicetree_iterate_node(data, end, 0, &stop, node_callback, property_callback);
+	return devicetree_iterate_internal(data, size, DEVICETREE_DEFAULT_MAX_DEPTH,
+			node_callback, NULL, property_callback);
+}
+
+bool
+devicetree_iterate_limited(const void **data, size_t size, unsigned max_depth,
+		devicetree_iterate_node_callback_t node_callback,
+		devicetree_iterate_property_callback_t property_callback) {
+	return devicetree_iterate_internal(data, size, max_depth,
+			node_callback, NULL, property_callback);
+}
+
+bool
+devicetree_iterate_named(const void **data, size_t size,
+		devicetree_iterate_named_node_callback_t node_callback,
+		devicetree_iterate_property_callback_t property_callback) {
+	return devicetree_iterate_internal(data, size, DEVICETREE_DEFAULT_MAX_DEPTH,
+			NULL, node_callback, property_callback);
 }
 
 bool
@@ -106,10 +253,254 @@ devicetree_node_scan_properties(const void *node, size_t size,
 		devicetree_iterate_property_callback_t property_callback) {
 	devicetree_iterate_node_callback_t do_not_scan_children =
 			^void(unsigned depth, const void *node, size_t size,
-					unsigned n_properties, unsigned n_children, bool *stop) {
+					unsigned n_properties, unsigned n_children,
+					bool *skip_children, bool *stop) {
 		if (depth != 0) {
 			*stop = true;
 		}
 	};
 	return devicetree_iterate(&node, size, do_not_scan_children, property_callback);
 }
+
+// Skip over the property at p. Returns a pointer just past the property's padded value, or NULL
+// if the property is malformed.
+static inline const uint8_t *
+skip_property(const uint8_t *p, const uint8_t *end) {
+	// Parse out property header.
+	const struct devicetree_property *prop = (const struct devicetree_property *)p;
+	p += sizeof(*prop);
+	if (p > end) {
+		return NULL;
+	}
+	// Make sure that the property name is null-terminated.
+	if (prop->name[sizeof(prop->name) - 1] != 0) {
+		return NULL;
+	}
+	// Properties are padded to a multiple of 4 bytes. There also appears to be a flag
+	// field (bit 31) which is set if iBoot should replace the value of the field with
+	// a syscfg property or other value. (We do not see this flag for device trees
+	// dumped from kernel memory.)
+	uint32_t prop_size = prop->size & ~0x80000000;
+	size_t padded_size = (prop_size + 0x3) & ~0x3;
+	p += padded_size;
+	if (p > end) {
+		if (p - padded_size + prop_size == end) {
+			// We're at the very end, ease up on the lack of padding.
+			p = end;
+		} else {
+			return NULL;
+		}
+	}
+	return p;
+}
+
+bool
+devicetree_next_property(const void **data, const void *data_end,
+		const char **name, const void **value, size_t *size) {
+	const struct devicetree_property *prop = *data;
+	const uint8_t *next = skip_property(*data, data_end);
+	if (next == NULL) {
+		return false;
+	}
+	*name = prop->name;
+	*value = prop->data;
+	*size = prop->size & ~0x80000000;
+	*data = next;
+	return true;
+}
+
+bool
+devicetree_validate(const void *data, size_t size, struct devicetree_validate_stats *stats) {
+	const uint8_t *start = data;
+	const uint8_t *p = start;
+	const uint8_t *end = start + size;
+	// This is the loop from devicetree_iterate_nodes() with the callbacks taken out.
+	uint32_t remaining[DEVICETREE_DEFAULT_MAX_DEPTH];
+	unsigned depth = 0;
+	size_t n_nodes = 0;
+	size_t n_properties = 0;
+	unsigned max_depth = 0;
+	bool ok = false;
+	for (;;) {
+		const struct devicetree_node *node = (const struct devicetree_node *)p;
+		if (p + sizeof(*node) > end) {
+			goto done;
+		}
+		p += sizeof(*node);
+		n_nodes++;
+		if (depth > max_depth) {
+			max_depth = depth;
+		}
+		uint32_t n_node_properties = node->n_properties;
+		for (uint32_t i = 0; i < n_node_properties; i++) {
+			const uint8_t *next = skip_property(p, end);
+			if (next == NULL) {
+				goto done;
+			}
+			p = next;
+		}
+		n_properties += n_node_properties;
+		if (node->n_children > 0) {
+			if (depth >= DEVICETREE_DEFAULT_MAX_DEPTH) {
+				p = (const uint8_t *)node;
+				goto done;
+			}
+			remaining[depth] = node->n_children;
+			depth++;
+			continue;
+		}
+		for (;;) {
+			if (depth == 0) {
+				// The tree must cover all of the data.
+				ok = (p == end);
+				goto done;
+			}
+			remaining[depth - 1]--;
+			if (remaining[depth - 1] > 0) {
+				break;
+			}
+			depth--;
+		}
+	}
+done:
+	if (stats != NULL) {
+		stats->n_nodes      = n_nodes;
+		stats->n_properties = n_properties;
+		stats->max_depth    = max_depth;
+		stats->error_offset = (ok ? size : p - start);
+	}
+	return ok;
+}
+
+// ---- Property lookup ---------------------------------------------------------------------------
+
+// Property names live in a fixed 32-byte field, so rather than calling strcmp() we compare the
+// whole field against a zero-padded copy of the name we're looking for. The mask selects the bytes
+// that must match: the name and its null terminator. Whatever follows the terminator is ignored.
+struct property_name_query {
+	char name[32];
+	uint32_t mask;
+	size_t length;
+};
+
+static inline __attribute__((always_inline)) bool
+property_name_equal_scalar(const char *name, const struct property_name_query *query) {
+	return memcmp(name, query->name, query->length + 1) == 0;
+}
+
+#if defined(__x86_64__)
+
+static inline __attribute__((always_inline)) bool
+property_name_equal_sse2(const char *name, const struct property_name_query *query) {
+	__m128i lo = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)name),
+			_mm_loadu_si128((const __m128i *)query->name));
+	__m128i hi = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(name + 16)),
+			_mm_loadu_si128((const __m128i *)(query->name + 16)));
+	uint32_t equal = (uint32_t)_mm_movemask_epi8(lo)
+		| ((uint32_t)_mm_movemask_epi8(hi) << 16);
+	return (equal & query->mask) == query->mask;
+}
+
+static inline __attribute__((always_inline, target("avx2"))) bool
+property_name_equal_avx2(const char *name, const struct property_name_query *query) {
+	__m256i eq = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)name),
+			_mm256_loadu_si256((const __m256i *)query->name));
+	uint32_t equal = (uint32_t)_mm256_movemask_epi8(eq);
+	return (equal & query->mask) == query->mask;
+}
+
+#endif
+
+typedef bool (*property_name_equal_fn)(const char *name, const struct property_name_query *query);
+
+// The lookup loop is always inlined into a wrapper for each instruction set so that the
+// comparison is inlined too.
+static inline __attribute__((always_inline)) bool
+find_property(const void *node, size_t size, const struct property_name_query *query,
+		property_name_equal_fn name_equal, const void **value, size_t *value_size) {
+	const uint8_t *p = node;
+	const uint8_t *end = p + size;
+	const struct devicetree_node *header = node;
+	p += sizeof(*header);
+	if (p > end) {
+		return false;
+	}
+	for (size_t i = 0; i < header->n_properties; i++) {
+		const void *next = p;
+		const char *name;
+		const void *prop_value;
+		size_t prop_size;
+		bool ok = devicetree_next_property(&next, end, &name, &prop_value, &prop_size);
+		if (!ok) {
+			return false;
+		}
+		if (name_equal(name, query)) {
+			*value = prop_value;
+			*value_size = prop_size;
+			return true;
+		}
+		p = next;
+	}
+	return false;
+}
+
+typedef bool (*find_property_fn)(const void *node, size_t size,
+		const struct property_name_query *query, const void **value, size_t *value_size);
+
+static bool
+find_property_scalar(const void *node, size_t size, const struct property_name_query *query,
+		const void **value, size_t *value_size) {
+	return find_property(node, size, query, property_name_equal_scalar, value, value_size);
+}
+
+#if defined(__x86_64__)
+
+static bool
+find_property_sse2(const void *node, size_t size, const struct property_name_query *query,
+		const void **value, size_t *value_size) {
+	return find_property(node, size, query, property_name_equal_sse2, value, value_size);
+}
+
+__attribute__((target("avx2")))
+static bool
+find_property_avx2(const void *node, size_t size, const struct property_name_query *query,
+		const void **value, size_t *value_size) {
+	return find_property(node, size, query, property_name_equal_avx2, value, value_size);
+}
+
+#endif
+
+static find_property_fn find_property_impl;
+static pthread_once_t find_property_once = PTHREAD_ONCE_INIT;
+
+static void
+select_find_property(void) {
+	find_property_fn find = find_property_scalar;
+#if defined(__x86_64__)
+	if (__builtin_cpu_supports("avx2")) {
+		find = find_property_avx2;
+	} else if (__builtin_cpu_supports("sse2")) {
+		find = find_property_sse2;
+	}
+#endif
+	find_property_impl = find;
+}
+
+bool
+devicetree_node_find_property(const void *node, size_t size, const char *name,
+		const void **value, size_t *value_size) {
+	struct property_name_query query;
+	// A name that doesn't fit in the field (with its terminator) can't match anything.
+	size_t length = strnlen(name, sizeof(query.name));
+	if (length >= sizeof(query.name)) {
+		return false;
+	}
+	memset(query.name, 0, sizeof(query.name));
+	memcpy(query.name, name, length);
+	query.length = length;
+	query.mask = (uint32_t)(((uint64_t)1 << (length + 1)) - 1);
+	// The library has no initialization call, and callers may be on several threads, so the
+	// implementation is chosen on first use under pthread_once().
+	pthread_once(&find_property_once, select_find_property);
+	return find_property_impl(node, size, &query, value, value_size);
+}
@@ -9,11 +9,46 @@
 #include <stddef.h>
 #include <stdint.h>
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct devicetree_node {
+	uint32_t n_properties;
+	uint32_t n_children;
+};
+
+struct devicetree_property {
+	char name[32];
+	uint32_t size;
+	uint8_t data[0];
+};
+
+// The flag bit in a property's size field, which is set if iBoot should replace the value with a
+// syscfg property or other value.
+#define DEVICETREE_PROPERTY_FLAG	0x80000000
+
+// The deepest node that devicetree_iterate() will visit. The root is at depth 0.
+#define DEVICETREE_DEFAULT_MAX_DEPTH	256
+
+// Set *skip_children to visit the node's properties but none of its descendants. Set *stop to end
+// the iteration.
 typedef void (^devicetree_iterate_node_callback_t)(
 		unsigned depth,
 		const void *node, size_t size,
 		unsigned n_properties, unsigned n_children,
-		bool *stop);
+		bool *skip_children, bool *stop);
+
+// Like devicetree_iterate_node_callback_t, but also given the values of the node's "name" and
+// "compatible" properties. These are NULL if the node doesn't have the property or if the node's
+// properties are malformed.
+typedef void (^devicetree_iterate_named_node_callback_t)(
+		unsigned depth,
+		const void *node, size_t size,
+		unsigned n_properties, unsigned n_children,
+		const char *name, size_t name_size,
+		const char *compatible, size_t compatible_size,
+		bool *skip_children, bool *stop);
 
 typedef void (^devicetree_iterate_property_callback_t)(
 		unsigned depth,
@@ -25,7 +60,51 @@ bool devicetree_iterate(const void **data, size_t size,
 		devicetree_iterate_node_callback_t node_callback,
 		devicetree_iterate_property_callback_t property_callback);
 
+// Like devicetree_iterate(), but fail if the tree has a node deeper than max_depth. The traversal
+// is iterative, so the depth limit only bounds the size of the preallocated stack.
+bool devicetree_iterate_limited(const void **data, size_t size, unsigned max_depth,
+		devicetree_iterate_node_callback_t node_callback,
+		devicetree_iterate_property_callback_t property_callback);
+
+// Like devicetree_iterate(), but the node callback is given the node's name and compatible
+// properties. Each property header is still read only once: a node's properties are parsed before
+// its node callback and reported from a buffer afterwards.
+bool devicetree_iterate_named(const void **data, size_t size,
+		devicetree_iterate_named_node_callback_t node_callback,
+		devicetree_iterate_property_callback_t property_callback);
+
 bool devicetree_node_scan_properties(const void *node, size_t size,
 		devicetree_iterate_property_callback_t property_callback);
 
+struct devicetree_validate_stats {
+	// The number of nodes and properties that were checked.
+	size_t n_nodes;
+	size_t n_properties;
+	// The depth of the deepest node.
+	unsigned max_depth;
+	// The offset of the node or property header where validation failed, or the size of the
+	// data if the devicetree is valid. If the devicetree is followed by extra data, this is the
+	// offset of the extra data.
+	size_t error_offset;
+};
+
+// Check the structure of the devicetree with the same rules as devicetree_iterate(), without
+// making any callbacks. Unlike devicetree_iterate(), the devicetree must fill the data exactly.
+// Returns true if the devicetree is valid. If stats is not NULL, it is filled in either way.
+bool devicetree_validate(const void *data, size_t size, struct devicetree_validate_stats *stats);
+
+// Find the property with the given name among the node's properties. The node and size are as
+// passed to a node callback. Returns false if the node has no such property or is malformed.
+bool devicetree_node_find_property(const void *node, size_t size, const char *name,
+		const void **value, size_t *value_size);
+
+// Parse the property header at *data and advance *data past the (padded) value. This applies the
+// same checks as devicetree_iterate(). Returns false if the property is malformed.
+bool devicetree_next_property(const void **data, const void *data_end,
+		const char **name, const void **value, size_t *size);
+
+#ifdef __cplusplus
+}
+#endif
+
 #endif
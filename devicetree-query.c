@@ -0,0 +1,400 @@
+/*
+ * devicetree-query.c
+ * Brandon Azad
+ */
+#include "devicetree-query.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define PROPERTY_NAME_SIZE	sizeof(((struct devicetree_property *)NULL)->name)
+
+// The set of steps that might match a node is kept in a bitmask, with a bit to spare.
+#define MAX_STEPS	63
+
+enum predicate_op {
+	PREDICATE_EXISTS,
+	PREDICATE_EQUALS,
+	PREDICATE_PREFIX,
+	PREDICATE_SUFFIX,
+	PREDICATE_CONTAINS,
+};
+
+struct query_predicate {
+	char property[PROPERTY_NAME_SIZE];
+	enum predicate_op op;
+	char *value;
+	size_t value_length;
+};
+
+struct query_step {
+	// Set for a "//" step, which matches any descendant instead of just children.
+	bool descendant;
+	// Set for a "*" step.
+	bool any_name;
+	char *name;
+	size_t name_length;
+	struct query_predicate *predicates;
+	unsigned n_predicates;
+};
+
+struct devicetree_query {
+	struct query_step *steps;
+	unsigned n_steps;
+	// Set if the last step also names a property of the nodes matched by the step before it.
+	bool final_property;
+};
+
+// ---- Compiling ---------------------------------------------------------------------------------
+
+// Characters that end a name in a query.
+static bool
+is_name_end(char c) {
+	return (c == 0 || strchr("/[]=~^$\"", c) != NULL);
+}
+
+static size_t
+parse_name(const char **p) {
+	const char *start = *p;
+	while (!is_name_end(**p)) {
+		(*p)++;
+	}
+	return *p - start;
+}
+
+// Parse a predicate value, either quoted or running up to the closing bracket.
+static bool
+parse_value(const char **p, struct query_predicate *predicate) {
+	const char *start = *p;
+	if (**p != '"') {
+		while (**p != ']' && **p != 0) {
+			(*p)++;
+		}
+		predicate->value_length = *p - start;
+		predicate->value = strndup(start, predicate->value_length);
+		assert(predicate->value != NULL);
+		return true;
+	}
+	(*p)++;
+	char *value = malloc(strlen(*p) + 1);
+	assert(value != NULL);
+	size_t length = 0;
+	for (;;) {
+		char c = **p;
+		if (c == 0) {
+			free(value);
+			return false;
+		}
+		(*p)++;
+		if (c == '"') {
+			break;
+		}
+		if (c == '\\' && (**p == '"' || **p == '\\')) {
+			c = **p;
+			(*p)++;
+		}
+		value[length++] = c;
+	}
+	value[length] = 0;
+	predicate->value = value;
+	predicate->value_length = length;
+	return true;
+}
+
+static bool
+parse_predicate(const char **p, struct query_predicate *predicate) {
+	// Skip the '['.
+	(*p)++;
+	const char *property = *p;
+	size_t length = parse_name(p);
+	if (length == 0 || length >= PROPERTY_NAME_SIZE) {
+		return false;
+	}
+	memset(predicate->property, 0, sizeof(predicate->property));
+	memcpy(predicate->property, property, length);
+	predicate->op = PREDICATE_EXISTS;
+	predicate->value = NULL;
+	predicate->value_length = 0;
+	if (**p != ']') {
+		switch (**p) {
+			case '=': predicate->op = PREDICATE_EQUALS;   break;
+			case '^': predicate->op = PREDICATE_PREFIX;   (*p)++; break;
+			case '$': predicate->op = PREDICATE_SUFFIX;   (*p)++; break;
+			case '~': predicate->op = PREDICATE_CONTAINS; (*p)++; break;
+			default: return false;
+		}
+		if (**p != '=') {
+			return false;
+		}
+		(*p)++;
+		if (!parse_value(p, predicate)) {
+			return false;
+		}
+		if (**p != ']') {
+			// The predicate isn't counted yet, so devicetree_query_free() won't see the
+			// value.
+			free(predicate->value);
+			return false;
+		}
+	}
+	(*p)++;
+	return true;
+}
+
+static bool
+parse_step(const char **p, struct query_step *step) {
+	memset(step, 0, sizeof(*step));
+	// Every step starts with "/" or "//".
+	if (**p != '/') {
+		return false;
+	}
+	(*p)++;
+	if (**p == '/') {
+		step->descendant = true;
+		(*p)++;
+	}
+	if (**p == '*') {
+		step->any_name = true;
+		(*p)++;
+	} else {
+		const char *name = *p;
+		step->name_length = parse_name(p);
+		if (step->name_length == 0) {
+			return false;
+		}
+		step->name = strndup(name, step->name_length);
+		assert(step->name != NULL);
+	}
+	while (**p == '[') {
+		step->predicates = realloc(step->predicates,
+				(step->n_predicates + 1) * sizeof(*step->predicates));
+		assert(step->predicates != NULL);
+		if (!parse_predicate(p, &step->predicates[step->n_predicates])) {
+			return false;
+		}
+		step->n_predicates++;
+	}
+	return true;
+}
+
+struct devicetree_query *
+devicetree_query_compile(const char *text, size_t *error_offset) {
+	struct devicetree_query *query = calloc(1, sizeof(*query));
+	assert(query != NULL);
+	query->steps = malloc(MAX_STEPS * sizeof(*query->steps));
+	assert(query->steps != NULL);
+	const char *p = text;
+	// The query "/" selects the root.
+	if (p[0] == '/' && p[1] == 0) {
+		return query;
+	}
+	do {
+		if (query->n_steps == MAX_STEPS) {
+			goto fail;
+		}
+		struct query_step *step = &query->steps[query->n_steps];
+		bool ok = parse_step(&p, step);
+		query->n_steps++;
+		if (!ok) {
+			goto fail;
+		}
+	} while (*p != 0);
+	const struct query_step *last = &query->steps[query->n_steps - 1];
+	query->final_property = (!last->descendant && !last->any_name && last->n_predicates == 0
+			&& last->name_length < PROPERTY_NAME_SIZE);
+	return query;
+fail:
+	*error_offset = p - text;
+	devicetree_query_free(query);
+	return NULL;
+}
+
+void
+devicetree_query_free(struct devicetree_query *query) {
+	for (unsigned i = 0; i < query->n_steps; i++) {
+		struct query_step *step = &query->steps[i];
+		for (unsigned j = 0; j < step->n_predicates; j++) {
+			free(step->predicates[j].value);
+		}
+		free(step->predicates);
+		free(step->name);
+	}
+	free(query->steps);
+	free(query);
+}
+
+// ---- Matching ----------------------------------------------------------------------------------
+
+static bool
+entry_matches(enum predicate_op op, const char *entry, size_t length,
+		const char *value, size_t value_length) {
+	if (value_length > length) {
+		return false;
+	}
+	switch (op) {
+		case PREDICATE_EQUALS:
+			return (length == value_length && memcmp(entry, value, length) == 0);
+		case PREDICATE_PREFIX:
+			return (memcmp(entry, value, value_length) == 0);
+		case PREDICATE_SUFFIX:
+			return (memcmp(entry + length - value_length, value, value_length) == 0);
+		default: // PREDICATE_CONTAINS
+			if (value_length == 0) {
+				return true;
+			}
+			for (size_t i = 0; i + value_length <= length; i++) {
+				if (entry[i] == value[0]
+						&& memcmp(entry + i, value, value_length) == 0) {
+					return true;
+				}
+			}
+			return false;
+	}
+}
+
+static bool
+predicate_matches(const struct query_predicate *predicate, const void *node, size_t size) {
+	const void *value;
+	size_t value_size;
+	bool found = devicetree_node_find_property(node, size, predicate->property,
+			&value, &value_size);
+	if (!found) {
+		return false;
+	}
+	if (predicate->op == PREDICATE_EXISTS) {
+		return true;
+	}
+	// Try each null-separated entry of the value.
+	const char *p = value;
+	const char *end = p + value_size;
+	do {
+		const char *entry_end = memchr(p, 0, end - p);
+		if (entry_end == NULL) {
+			entry_end = end;
+		}
+		if (entry_matches(predicate->op, p, entry_end - p,
+					predicate->value, predicate->value_length)) {
+			return true;
+		}
+		p = entry_end + 1;
+	} while (p < end);
+	return false;
+}
+
+static bool
+step_matches(const struct query_step *step, const void *node, size_t size,
+		const char *name, size_t name_length) {
+	if (!step->any_name && (name_length != step->name_length
+				|| memcmp(name, step->name, name_length) != 0)) {
+		return false;
+	}
+	for (unsigned i = 0; i < step->n_predicates; i++) {
+		if (!predicate_matches(&step->predicates[i], node, size)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+// Match a node against the steps its parent left pending. Returns a mask with bit i + 1 set for
+// each step i that the node matches, and adds the "//" steps that stay pending for the node's
+// children to node_pending.
+static uint64_t
+match_steps(const struct devicetree_query *query, uint64_t parent_pending,
+		const void *node, size_t size, const char *name, size_t name_length,
+		uint64_t *node_pending) {
+	uint64_t matched = 0;
+	for (unsigned i = 0; parent_pending != 0; i++, parent_pending >>= 1) {
+		if ((parent_pending & 1) == 0) {
+			continue;
+		}
+		const struct query_step *step = &query->steps[i];
+		if (step->descendant) {
+			*node_pending |= (1ull << i);
+		}
+		if (step_matches(step, node, size, name, name_length)) {
+			matched |= (2ull << i);
+		}
+	}
+	return matched;
+}
+
+bool
+devicetree_query_run(const struct devicetree_query *const *queries, size_t n_queries,
+		const void *data, size_t size,
+		devicetree_query_callback_t callback) {
+	// pending[depth * n_queries + q] is the set of steps of query q that the children of the
+	// open node at the given depth may match.
+	uint64_t *pending = malloc((DEVICETREE_DEFAULT_MAX_DEPTH + 1) * n_queries
+			* sizeof(*pending));
+	// path_lengths[depth] is the length of the path of the open node at the given depth.
+	size_t *path_lengths = malloc((DEVICETREE_DEFAULT_MAX_DEPTH + 1) * sizeof(*path_lengths));
+	__block char *path = malloc(256);
+	__block size_t path_capacity = 256;
+	assert(pending != NULL && path_lengths != NULL && path != NULL);
+	devicetree_iterate_named_node_callback_t node_cb =
+			^(unsigned depth, const void *node, size_t size,
+					unsigned n_properties, unsigned n_children,
+					const char *name, size_t name_size,
+					const char *compatible, size_t compatible_size,
+					bool *skip_children, bool *stop) {
+		// Keep track of the node's path.
+		size_t name_length = (name != NULL ? strnlen(name, name_size) : 0);
+		size_t path_length = 0;
+		if (depth > 0) {
+			path_length = path_lengths[depth - 1] + 1 + name_length;
+			if (path_length + 2 > path_capacity) {
+				path_capacity = 2 * path_length + 2;
+				path = realloc(path, path_capacity);
+				assert(path != NULL);
+			}
+			path[path_lengths[depth - 1]] = '/';
+			memcpy(path + path_lengths[depth - 1] + 1, name, name_length);
+		}
+		path[path_length] = 0;
+		path_lengths[depth] = path_length;
+		const char *node_path = (depth > 0 ? path : "/");
+		bool any_pending = false;
+		for (size_t q = 0; q < n_queries && !*stop; q++) {
+			const struct devicetree_query *query = queries[q];
+			uint64_t node_pending = 0;
+			// The root stands in for the match of the step before the first.
+			uint64_t matched = 1;
+			if (depth > 0) {
+				matched = match_steps(query, pending[(depth - 1) * n_queries + q],
+						node, size, name, name_length, &node_pending);
+			}
+			// The steps after the matched steps are pending for the children.
+			node_pending |= matched & ((1ull << query->n_steps) - 1);
+			pending[depth * n_queries + q] = node_pending;
+			any_pending |= (node_pending != 0);
+			// Report the matches of the last step and of its property.
+			unsigned n_steps = query->n_steps;
+			if ((matched >> n_steps) & 1) {
+				callback(q, node_path, node, size, NULL, NULL, 0, stop);
+			}
+			if (query->final_property && ((matched >> (n_steps - 1)) & 1) && !*stop) {
+				const struct query_step *last = &query->steps[n_steps - 1];
+				const void *value;
+				size_t value_size;
+				bool found = devicetree_node_find_property(node, size, last->name,
+						&value, &value_size);
+				if (found) {
+					callback(q, node_path, node, size, last->name,
+							value, value_size, stop);
+				}
+			}
+		}
+		// Prune subtrees in which nothing can match.
+		if (!any_pending) {
+			*skip_children = true;
+		}
+	};
+	const void *p = data;
+	bool ok = devicetree_iterate_named(&p, size, node_cb, NULL);
+	free(pending);
+	free(path_lengths);
+	free(path);
+	return ok;
+}
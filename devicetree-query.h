@@ -0,0 +1,59 @@
+/*
+ * devicetree-query.h
+ * Brandon Azad
+ */
+#ifndef DEVICETREE_QUERY__H_
+#define DEVICETREE_QUERY__H_
+
+#include "devicetree-parse.h"
+
+// A compiled query. The query language is a small subset of XPath/CSS selectors over node paths:
+//
+//     /arm-io/uart0                 the child "uart0" of the child "arm-io" of the root
+//     /arm-io/*[name^="i2c"]        any child of "arm-io" whose name starts with "i2c"
+//     //*[compatible~="uart"]/reg   the "reg" property of any node with a compatible entry
+//                                   containing "uart"
+//
+// A query is a list of steps. Each step starts with "/" to select children or "//" to select
+// descendants, followed by a node name or "*", and then any number of predicates:
+//
+//     [prop]           the node has the property
+//     [prop="value"]   an entry of the property equals value
+//     [prop^="value"]  an entry of the property starts with value
+//     [prop$="value"]  an entry of the property ends with value
+//     [prop~="value"]  an entry of the property contains value
+//
+// A property's entries are its null-separated strings, so these work for both single strings and
+// string lists like "compatible". Values may be quoted with double quotes, in which case \" and
+// \\ are escapes.
+//
+// If the last step is a "/" step with a plain name and no predicates, it also selects the property
+// with that name of the nodes matched by the previous steps. Node names are the values of the
+// "name" properties; the root is "/".
+struct devicetree_query;
+
+// Compile a query. On failure, returns NULL and sets *error_offset to the offset in the text
+// where the error was found.
+struct devicetree_query *devicetree_query_compile(const char *text, size_t *error_offset);
+
+void devicetree_query_free(struct devicetree_query *query);
+
+// Report a match of the query with the given index. The node and size are as passed to a node
+// callback, and path is the node's path. If the match is a property, property is its name and
+// value and value_size its value; otherwise property is NULL.
+typedef void (^devicetree_query_callback_t)(
+		size_t query,
+		const char *path,
+		const void *node, size_t size,
+		const char *property,
+		const void *value, size_t value_size,
+		bool *stop);
+
+// Run several queries over the devicetree in a single traversal. Matches are reported in tree
+// order. Subtrees in which no query can match are skipped. Returns false if the devicetree is
+// malformed.
+bool devicetree_query_run(const struct devicetree_query *const *queries, size_t n_queries,
+		const void *data, size_t size,
+		devicetree_query_callback_t callback);
+
+#endif
@@ -0,0 +1,340 @@
+/*
+ * devicetree-stream.c
+ * Brandon Azad
+ */
+#include "devicetree-stream.h"
+
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+
+enum stream_state {
+	STREAM_NODE_HEADER,
+	STREAM_PROPERTY_HEADER,
+	STREAM_PROPERTY_VALUE,
+	STREAM_PROPERTY_PADDING,
+	STREAM_DONE,
+	STREAM_STOPPED,
+	STREAM_ERROR,
+};
+
+// How we deliver the value of the current property.
+enum value_mode {
+	// The value is skipped, either because it's in a skipped subtree or because there is no
+	// property callback.
+	VALUE_SKIP,
+	// The value is passed to the property callback, copied into the value buffer if needed.
+	VALUE_WHOLE,
+	// The value is passed to the value callback in pieces.
+	VALUE_PIECES,
+};
+
+struct devicetree_stream {
+	size_t max_buffered_value;
+	devicetree_iterate_node_callback_t node_callback;
+	devicetree_iterate_property_callback_t property_callback;
+	devicetree_stream_value_callback_t value_callback;
+	enum stream_state state;
+	// A node or property header that spans chunks is assembled here.
+	uint8_t header[sizeof(struct devicetree_property)];
+	size_t header_size;
+	// The node whose properties we are parsing.
+	struct devicetree_node node;
+	uint32_t properties_left;
+	unsigned depth;
+	// Nodes deeper than skip_depth are in a skipped subtree.
+	unsigned skip_depth;
+	// remaining[d] is the number of children of the open node at depth d that we have not yet
+	// finished.
+	uint32_t remaining[DEVICETREE_DEFAULT_MAX_DEPTH];
+	// The property whose value we are reading.
+	char name[sizeof(((struct devicetree_property *)NULL)->name)];
+	size_t value_size;
+	size_t value_offset;
+	size_t padding_left;
+	enum value_mode value_mode;
+	// A value that spans chunks in VALUE_WHOLE mode is assembled here.
+	uint8_t *value_buffer;
+	size_t value_buffer_capacity;
+};
+
+struct devicetree_stream *
+devicetree_stream_create(size_t max_buffered_value,
+		devicetree_iterate_node_callback_t node_callback,
+		devicetree_iterate_property_callback_t property_callback,
+		devicetree_stream_value_callback_t value_callback) {
+	struct devicetree_stream *stream = calloc(1, sizeof(*stream));
+	if (stream == NULL) {
+		return NULL;
+	}
+	stream->max_buffered_value = max_buffered_value;
+	stream->node_callback      = node_callback;
+	stream->property_callback  = property_callback;
+	stream->value_callback     = value_callback;
+	stream->state              = STREAM_NODE_HEADER;
+	stream->skip_depth         = UINT_MAX;
+	return stream;
+}
+
+void
+devicetree_stream_free(struct devicetree_stream *stream) {
+	free(stream->value_buffer);
+	free(stream);
+}
+
+// Gather a header of the given size. If the header lies entirely within the input we use it in
+// place; otherwise we copy it piece by piece into stream->header. Returns a pointer to the header
+// once it is complete, or NULL if we need more data.
+static const void *
+gather_header(struct devicetree_stream *stream, const uint8_t **p, const uint8_t *end,
+		size_t size) {
+	if (stream->header_size == 0 && (size_t)(end - *p) >= size) {
+		const void *header = *p;
+		*p += size;
+		return header;
+	}
+	size_t needed = size - stream->header_size;
+	size_t available = end - *p;
+	size_t copy = (needed < available ? needed : available);
+	memcpy(stream->header + stream->header_size, *p, copy);
+	stream->header_size += copy;
+	*p += copy;
+	if (stream->header_size < size) {
+		return NULL;
+	}
+	stream->header_size = 0;
+	return stream->header;
+}
+
+// We just finished the properties of the current node. Move on to the next node, like the end of
+// the loop in devicetree_iterate().
+static void
+node_done(struct devicetree_stream *stream) {
+	if (stream->node.n_children > 0) {
+		if (stream->depth >= DEVICETREE_DEFAULT_MAX_DEPTH) {
+			stream->state = STREAM_ERROR;
+			return;
+		}
+		stream->remaining[stream->depth] = stream->node.n_children;
+		stream->depth++;
+		stream->state = STREAM_NODE_HEADER;
+		return;
+	}
+	for (;;) {
+		if (stream->depth == 0) {
+			stream->state = STREAM_DONE;
+			return;
+		}
+		stream->remaining[stream->depth - 1]--;
+		if (stream->remaining[stream->depth - 1] > 0) {
+			stream->state = STREAM_NODE_HEADER;
+			return;
+		}
+		stream->depth--;
+	}
+}
+
+static void
+property_done(struct devicetree_stream *stream) {
+	stream->properties_left--;
+	if (stream->properties_left > 0) {
+		stream->state = STREAM_PROPERTY_HEADER;
+	} else {
+		node_done(stream);
+	}
+}
+
+static void
+parse_node_header(struct devicetree_stream *stream, const struct devicetree_node *header) {
+	bool skipped = (stream->depth > stream->skip_depth);
+	if (!skipped) {
+		stream->skip_depth = UINT_MAX;
+	}
+	stream->node = *header;
+	stream->properties_left = header->n_properties;
+	if (stream->node_callback != NULL && !skipped) {
+		bool skip_children = false;
+		bool stop = false;
+		stream->node_callback(stream->depth, &stream->node, sizeof(stream->node),
+				stream->node.n_properties, stream->node.n_children,
+				&skip_children, &stop);
+		if (stop) {
+			stream->state = STREAM_STOPPED;
+			return;
+		}
+		if (skip_children) {
+			stream->skip_depth = stream->depth;
+		}
+	}
+	if (stream->properties_left > 0) {
+		stream->state = STREAM_PROPERTY_HEADER;
+	} else {
+		node_done(stream);
+	}
+}
+
+static void
+parse_property_header(struct devicetree_stream *stream, const struct devicetree_property *prop) {
+	// Make sure that the property name is null-terminated.
+	if (prop->name[sizeof(prop->name) - 1] != 0) {
+		stream->state = STREAM_ERROR;
+		return;
+	}
+	memcpy(stream->name, prop->name, sizeof(stream->name));
+	// See devicetree_next_property() for the flag bit and the padding.
+	uint32_t prop_size = prop->size & ~0x80000000;
+	stream->value_size = prop_size;
+	stream->value_offset = 0;
+	stream->padding_left = ((prop_size + 0x3) & ~0x3) - prop_size;
+	bool skipped = (stream->depth > stream->skip_depth);
+	if (skipped || stream->property_callback == NULL) {
+		stream->value_mode = VALUE_SKIP;
+	} else if (stream->value_callback != NULL && prop_size > stream->max_buffered_value) {
+		stream->value_mode = VALUE_PIECES;
+	} else {
+		stream->value_mode = VALUE_WHOLE;
+	}
+	stream->state = STREAM_PROPERTY_VALUE;
+}
+
+static void
+deliver_value(struct devicetree_stream *stream, const void *value) {
+	bool stop = false;
+	stream->property_callback(stream->depth + 1, stream->name, value, stream->value_size,
+			&stop);
+	if (stop) {
+		stream->state = STREAM_STOPPED;
+	}
+}
+
+// Consume as much of the current property value as we can.
+static void
+parse_property_value(struct devicetree_stream *stream, const uint8_t **p, const uint8_t *end) {
+	size_t needed = stream->value_size - stream->value_offset;
+	size_t available = end - *p;
+	size_t take = (needed < available ? needed : available);
+	const uint8_t *piece = *p;
+	*p += take;
+	switch (stream->value_mode) {
+		case VALUE_SKIP:
+			break;
+		case VALUE_WHOLE:
+			// If the whole value is here, pass it along in place.
+			if (stream->value_offset == 0 && take == stream->value_size) {
+				deliver_value(stream, piece);
+				break;
+			}
+			if (stream->value_offset == 0
+					&& stream->value_size > stream->value_buffer_capacity) {
+				void *buffer = realloc(stream->value_buffer, stream->value_size);
+				if (buffer == NULL) {
+					stream->state = STREAM_ERROR;
+					return;
+				}
+				stream->value_buffer = buffer;
+				stream->value_buffer_capacity = stream->value_size;
+			}
+			memcpy(stream->value_buffer + stream->value_offset, piece, take);
+			if (take == needed) {
+				deliver_value(stream, stream->value_buffer);
+			}
+			break;
+		case VALUE_PIECES:
+			if (take > 0) {
+				bool stop = false;
+				stream->value_callback(stream->depth + 1, stream->name,
+						stream->value_offset, piece, take,
+						stream->value_size, &stop);
+				if (stop) {
+					stream->state = STREAM_STOPPED;
+				}
+			}
+			break;
+	}
+	stream->value_offset += take;
+	if (stream->state != STREAM_PROPERTY_VALUE
+			|| stream->value_offset < stream->value_size) {
+		return;
+	}
+	if (stream->padding_left > 0) {
+		stream->state = STREAM_PROPERTY_PADDING;
+	} else {
+		property_done(stream);
+	}
+}
+
+bool
+devicetree_stream_feed(struct devicetree_stream *stream, const void *data, size_t size) {
+	const uint8_t *p = data;
+	const uint8_t *end = p + size;
+	for (;;) {
+		switch (stream->state) {
+			case STREAM_STOPPED:
+				return true;
+			case STREAM_ERROR:
+				return false;
+			case STREAM_DONE:
+				// There should be nothing after the root node.
+				if (p != end) {
+					stream->state = STREAM_ERROR;
+					return false;
+				}
+				return true;
+			default:
+				break;
+		}
+		// Everything below needs at least one byte, except an empty property value.
+		if (p == end && !(stream->state == STREAM_PROPERTY_VALUE
+					&& stream->value_offset == stream->value_size)) {
+			return true;
+		}
+		switch (stream->state) {
+			case STREAM_NODE_HEADER: {
+				const void *header = gather_header(stream, &p, end,
+						sizeof(struct devicetree_node));
+				if (header != NULL) {
+					parse_node_header(stream, header);
+				}
+				break;
+			}
+			case STREAM_PROPERTY_HEADER: {
+				const void *header = gather_header(stream, &p, end,
+						sizeof(struct devicetree_property));
+				if (header != NULL) {
+					parse_property_header(stream, header);
+				}
+				break;
+			}
+			case STREAM_PROPERTY_VALUE:
+				parse_property_value(stream, &p, end);
+				break;
+			case STREAM_PROPERTY_PADDING: {
+				size_t available = end - p;
+				size_t skip = (stream->padding_left < available
+						? stream->padding_left : available);
+				p += skip;
+				stream->padding_left -= skip;
+				if (stream->padding_left == 0) {
+					property_done(stream);
+				}
+				break;
+			}
+			default:
+				break;
+		}
+	}
+}
+
+bool
+devicetree_stream_finish(struct devicetree_stream *stream) {
+	// Handle an empty final property value.
+	devicetree_stream_feed(stream, NULL, 0);
+	// Like devicetree_iterate(), we don't require the very last property to be padded, but if
+	// any of its padding is there, all of it must be.
+	size_t padding = ((stream->value_size + 0x3) & ~0x3) - stream->value_size;
+	if (stream->state == STREAM_PROPERTY_PADDING && stream->padding_left == padding) {
+		stream->padding_left = 0;
+		property_done(stream);
+	}
+	return (stream->state == STREAM_DONE || stream->state == STREAM_STOPPED);
+}
@@ -0,0 +1,46 @@
+/*
+ * devicetree-stream.h
+ * Brandon Azad
+ */
+#ifndef DEVICETREE_STREAM__H_
+#define DEVICETREE_STREAM__H_
+
+#include "devicetree-parse.h"
+
+// A push parser for devicetree data that arrives in pieces, for example from a pipe or a socket.
+// It reports the same events as devicetree_iterate(), with these differences:
+//
+//   - The node passed to the node callback is a copy of the node header, and the size is the size
+//     of the header. The rest of the node is not available yet.
+//   - A property value that lies entirely within one fed chunk is passed to the property callback
+//     without being copied. A value that spans chunks is copied into a buffer and reported once it
+//     is complete, unless it is larger than max_buffered_value and a value callback was supplied.
+//     In that case the property callback is not called for it; instead the value callback is
+//     called with each piece of the value as it arrives.
+struct devicetree_stream;
+
+// Receive a piece of a large property value: the bytes [offset, offset + size) of a value that is
+// total_size bytes long.
+typedef void (^devicetree_stream_value_callback_t)(
+		unsigned depth,
+		const char *name,
+		size_t offset, const void *data, size_t size,
+		size_t total_size,
+		bool *stop);
+
+struct devicetree_stream *devicetree_stream_create(size_t max_buffered_value,
+		devicetree_iterate_node_callback_t node_callback,
+		devicetree_iterate_property_callback_t property_callback,
+		devicetree_stream_value_callback_t value_callback);
+
+// Parse the next size bytes of the devicetree. Returns false if the data is malformed or continues
+// past the end of the tree. Once a callback sets *stop, the rest of the input is ignored.
+bool devicetree_stream_feed(struct devicetree_stream *stream, const void *data, size_t size);
+
+// Finish parsing. Returns true if the stream held a complete devicetree (or a callback stopped
+// the parse).
+bool devicetree_stream_finish(struct devicetree_stream *stream);
+
+void devicetree_stream_free(struct devicetree_stream *stream);
+
+#endif
@@ -0,0 +1,199 @@
+/*
+ * devicetree-walk.hpp
+ * Brandon Azad
+ */
+#ifndef DEVICETREE_WALK__HPP_
+#define DEVICETREE_WALK__HPP_
+
+// A header-only C++17 version of devicetree_iterate(). Instead of taking blocks, walk() takes a
+// visitor object whose member functions are resolved at compile time, so they can be inlined into
+// the traversal loop. A visitor provides either or both of:
+//
+//     action node(unsigned depth, const void *node, size_t size,
+//                 unsigned n_properties, unsigned n_children);
+//     action property(unsigned depth, const char *name, const void *value, size_t size);
+//
+// Either member may return void instead of an action. Members that the visitor leaves out are
+// compiled out of the traversal entirely.
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <type_traits>
+#include <utility>
+
+namespace devicetree {
+
+enum class action {
+	// Keep going.
+	next,
+	// From a node: visit the node's properties but none of its descendants.
+	skip_children,
+	// End the walk.
+	stop,
+};
+
+// The deepest node that walk() will visit by default. The root is at depth 0.
+constexpr unsigned default_max_depth = 256;
+
+namespace detail {
+
+struct node_header {
+	uint32_t n_properties;
+	uint32_t n_children;
+};
+
+struct property_header {
+	char name[32];
+	uint32_t size;
+};
+
+template<typename Visitor, typename = void>
+struct has_node : std::false_type {};
+
+template<typename Visitor>
+struct has_node<Visitor, std::void_t<decltype(std::declval<Visitor &>().node(
+		0u, static_cast<const void *>(nullptr), std::size_t(0), 0u, 0u))>>
+	: std::true_type {};
+
+template<typename Visitor, typename = void>
+struct has_property : std::false_type {};
+
+template<typename Visitor>
+struct has_property<Visitor, std::void_t<decltype(std::declval<Visitor &>().property(
+		0u, static_cast<const char *>(nullptr), static_cast<const void *>(nullptr),
+		std::size_t(0)))>>
+	: std::true_type {};
+
+// Call a visitor member, treating a void return as action::next.
+template<typename Call>
+inline action
+invoke(Call &&call) {
+	if constexpr (std::is_void_v<decltype(call())>) {
+		call();
+		return action::next;
+	} else {
+		return call();
+	}
+}
+
+} // namespace detail
+
+// Walk the devicetree with the same checks and callback order as devicetree_iterate(). If
+// processed is not null, it is set to the number of bytes consumed, with the same meaning as the
+// updated data pointer from devicetree_iterate(). Returns false if the devicetree is malformed or
+// deeper than max_depth.
+template<typename Visitor>
+bool
+walk(const void *data, size_t size, Visitor &&visitor,
+		size_t *processed = nullptr, unsigned max_depth = default_max_depth) {
+	using visitor_type = std::remove_reference_t<Visitor>;
+	constexpr bool visit_nodes      = detail::has_node<visitor_type>::value;
+	constexpr bool visit_properties = detail::has_property<visitor_type>::value;
+	const uint8_t *start = static_cast<const uint8_t *>(data);
+	const uint8_t *p = start;
+	const uint8_t *end = start + size;
+	const uint8_t *committed = p;
+	// remaining[d] is the number of children of the open node at depth d that we have not yet
+	// finished.
+	uint32_t inline_stack[default_max_depth];
+	std::unique_ptr<uint32_t[]> heap_stack;
+	uint32_t *remaining = inline_stack;
+	if (max_depth > default_max_depth) {
+		heap_stack.reset(new uint32_t[max_depth]);
+		remaining = heap_stack.get();
+	}
+	auto finish = [&](bool ok) {
+		if (processed != nullptr) {
+			*processed = committed - start;
+		}
+		return ok;
+	};
+	unsigned depth = 0;
+	unsigned skip_depth = ~0u;
+	for (;;) {
+		bool skipped = (depth > skip_depth);
+		if (!skipped) {
+			skip_depth = ~0u;
+		}
+		auto node = reinterpret_cast<const detail::node_header *>(p);
+		p += sizeof(*node);
+		if (p > end) {
+			return finish(false);
+		}
+		uint32_t n_properties = node->n_properties;
+		uint32_t n_children   = node->n_children;
+		if constexpr (visit_nodes) {
+			if (!skipped) {
+				action act = detail::invoke([&] {
+					return visitor.node(depth, static_cast<const void *>(node),
+							size_t(end - p + sizeof(*node)),
+							n_properties, n_children);
+				});
+				if (act == action::stop) {
+					return finish(true);
+				}
+				if (act == action::skip_children) {
+					skip_depth = depth;
+				}
+			}
+		}
+		for (uint32_t i = 0; i < n_properties; i++) {
+			auto prop = reinterpret_cast<const detail::property_header *>(p);
+			p += sizeof(*prop);
+			if (p > end) {
+				return finish(false);
+			}
+			if (prop->name[sizeof(prop->name) - 1] != 0) {
+				return finish(false);
+			}
+			// See devicetree_next_property() for the flag bit and padding rules.
+			uint32_t prop_size = prop->size & ~0x80000000;
+			size_t padded_size = (prop_size + 0x3) & ~0x3;
+			const uint8_t *value = p;
+			p += padded_size;
+			if (p > end) {
+				if (p - padded_size + prop_size == end) {
+					p = end;
+				} else {
+					return finish(false);
+				}
+			}
+			if constexpr (visit_properties) {
+				if (!skipped) {
+					action act = detail::invoke([&] {
+						return visitor.property(depth + 1, prop->name,
+								static_cast<const void *>(value),
+								size_t(prop_size));
+					});
+					if (act == action::stop) {
+						return finish(true);
+					}
+				}
+			}
+		}
+		committed = p;
+		if (n_children > 0) {
+			if (depth >= max_depth) {
+				return finish(false);
+			}
+			remaining[depth] = n_children;
+			depth++;
+			continue;
+		}
+		for (;;) {
+			if (depth == 0) {
+				return finish(true);
+			}
+			remaining[depth - 1]--;
+			if (remaining[depth - 1] > 0) {
+				break;
+			}
+			depth--;
+		}
+	}
+}
+
+} // namespace devicetree
+
+#endif
@@ -0,0 +1,178 @@
+/*
+ * img4.c
+ * Brandon Azad
+ */
+#include "img4.h"
+
+#include <stdint.h>
+#include <string.h>
+
+// ---- DER reader --------------------------------------------------------------------------------
+
+// DER tags, with only the single-byte form supported.
+#define DER_INTEGER		0x02
+#define DER_OCTET_STRING	0x04
+#define DER_IA5_STRING		0x16
+#define DER_SEQUENCE		0x30
+
+struct der_value {
+	uint8_t tag;
+	const uint8_t *data;
+	size_t size;
+};
+
+// Read the tag and length of the DER value at *p, advancing *p to the contents. Returns false if
+// the header doesn't fit before end or uses an encoding that DER doesn't allow.
+static bool
+der_read_header(const uint8_t **p, const uint8_t *end, uint8_t *tag, size_t *length) {
+	const uint8_t *q = *p;
+	if (end - q < 2) {
+		return false;
+	}
+	*tag = *q++;
+	// High tag numbers don't appear in IMG4 files.
+	if ((*tag & 0x1f) == 0x1f) {
+		return false;
+	}
+	*length = *q++;
+	if (*length & 0x80) {
+		// Long form. The indefinite form (0x80) isn't allowed in DER.
+		size_t n_bytes = *length & 0x7f;
+		if (n_bytes == 0 || n_bytes > sizeof(uint32_t) || (size_t)(end - q) < n_bytes) {
+			return false;
+		}
+		*length = 0;
+		for (size_t i = 0; i < n_bytes; i++) {
+			*length = (*length << 8) | *q++;
+		}
+	}
+	*p = q;
+	return true;
+}
+
+// Read the DER value at *p, advancing *p past it. Returns false if the value doesn't fit before
+// end.
+static bool
+der_read(const uint8_t **p, const uint8_t *end, struct der_value *value) {
+	const uint8_t *q = *p;
+	size_t length;
+	if (!der_read_header(&q, end, &value->tag, &length) || (size_t)(end - q) < length) {
+		return false;
+	}
+	value->data = q;
+	value->size = length;
+	*p = q + length;
+	return true;
+}
+
+static bool
+der_is_string(const struct der_value *value, const char *string) {
+	size_t length = strlen(string);
+	return (value->tag == DER_IA5_STRING && value->size == length
+			&& memcmp(value->data, string, length) == 0);
+}
+
+// ---- IMG4 --------------------------------------------------------------------------------------
+
+static bool
+has_prefix(const struct der_value *value, const char *prefix) {
+	size_t length = strlen(prefix);
+	return (value->size >= length && memcmp(value->data, prefix, length) == 0);
+}
+
+// Parse the contents of an IM4P sequence:
+//
+//     IM4P ::= SEQUENCE {
+//         IA5String "IM4P",
+//         IA5String type,
+//         IA5String description,
+//         OCTET STRING payload,
+//         OCTET STRING keybag OPTIONAL,
+//         SEQUENCE { INTEGER algorithm, INTEGER size } compression OPTIONAL,
+//     }
+static enum img4_status
+parse_im4p(const uint8_t *p, const uint8_t *end,
+		const void **payload, size_t *payload_size, char type[5]) {
+	struct der_value magic, type_value, description, data;
+	if (!der_read(&p, end, &magic) || !der_is_string(&magic, "IM4P")) {
+		return IMG4_MALFORMED;
+	}
+	if (!der_read(&p, end, &type_value) || type_value.tag != DER_IA5_STRING
+			|| type_value.size != 4) {
+		return IMG4_MALFORMED;
+	}
+	if (!der_read(&p, end, &description) || description.tag != DER_IA5_STRING) {
+		return IMG4_MALFORMED;
+	}
+	if (!der_read(&p, end, &data) || data.tag != DER_OCTET_STRING) {
+		return IMG4_MALFORMED;
+	}
+	// Anything after the payload is a keybag or compression info.
+	while (p < end) {
+		struct der_value extra;
+		if (!der_read(&p, end, &extra)) {
+			return IMG4_MALFORMED;
+		}
+		if (extra.tag == DER_OCTET_STRING) {
+			return IMG4_ENCRYPTED;
+		}
+		if (extra.tag == DER_SEQUENCE) {
+			return IMG4_COMPRESSED;
+		}
+	}
+	// Older files have compressed payloads without compression info.
+	if (has_prefix(&data, "bvx") || has_prefix(&data, "complzss")) {
+		return IMG4_COMPRESSED;
+	}
+	memcpy(type, type_value.data, 4);
+	type[4] = 0;
+	*payload = data.data;
+	*payload_size = data.size;
+	return IMG4_OK;
+}
+
+enum img4_status
+img4_find_payload(const void *data, size_t size,
+		const void **payload, size_t *payload_size, char type[5]) {
+	const uint8_t *p = data;
+	const uint8_t *end = p + size;
+	// Both IM4P and IMG4 files are a sequence starting with a magic string. The header of a raw
+	// devicetree won't parse as a sequence that starts with one of those strings. Look for the
+	// magic before checking the sequence's length, so that a truncated file is reported as
+	// malformed rather than parsed as a devicetree.
+	uint8_t tag;
+	size_t length;
+	struct der_value magic;
+	if (!der_read_header(&p, end, &tag, &length) || tag != DER_SEQUENCE) {
+		return IMG4_NOT_WRAPPED;
+	}
+	const uint8_t *q = p;
+	if (!der_read(&q, end, &magic)
+			|| !(der_is_string(&magic, "IM4P") || der_is_string(&magic, "IMG4"))) {
+		return IMG4_NOT_WRAPPED;
+	}
+	if ((size_t)(end - p) < length) {
+		return IMG4_MALFORMED;
+	}
+	const uint8_t *outer_end = p + length;
+	if (der_is_string(&magic, "IM4P")) {
+		return parse_im4p(p, outer_end, payload, payload_size, type);
+	}
+	// IMG4 ::= SEQUENCE { IA5String "IMG4", IM4P, [0] IM4M OPTIONAL, [1] IM4R OPTIONAL }
+	struct der_value im4p;
+	if (!der_read(&q, outer_end, &im4p) || im4p.tag != DER_SEQUENCE) {
+		return IMG4_MALFORMED;
+	}
+	return parse_im4p(im4p.data, im4p.data + im4p.size, payload, payload_size, type);
+}
+
+const char *
+img4_status_description(enum img4_status status) {
+	switch (status) {
+		case IMG4_OK:          return "ok";
+		case IMG4_NOT_WRAPPED: return "not an IMG4 file";
+		case IMG4_MALFORMED:   return "malformed IMG4 file";
+		case IMG4_ENCRYPTED:   return "the IMG4 payload is encrypted; decrypt it first";
+		default:               return "the IMG4 payload is compressed; decompress it first";
+	}
+}
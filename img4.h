@@ -0,0 +1,34 @@
+/*
+ * img4.h
+ * Brandon Azad
+ */
+#ifndef IMG4__H_
+#define IMG4__H_
+
+#include <stdbool.h>
+#include <stddef.h>
+
+enum img4_status {
+	// The data is an IM4P or IMG4 file and the payload was found.
+	IMG4_OK,
+	// The data is not wrapped in an IM4P or IMG4 file.
+	IMG4_NOT_WRAPPED,
+	// The data looks like an IM4P or IMG4 file but its DER structure is broken.
+	IMG4_MALFORMED,
+	// The payload is encrypted: the IM4P has a keybag.
+	IMG4_ENCRYPTED,
+	// The payload is compressed (LZFSE or LZSS).
+	IMG4_COMPRESSED,
+};
+
+// Find the payload of an IM4P file, or of the IM4P inside an IMG4 file. Only the DER structure
+// is checked; signatures are not. On IMG4_OK, *payload points into data (nothing is copied) and
+// type is set to the 4-character payload type, like "dtre". Encrypted and compressed payloads are
+// reported rather than returned, since they can't be parsed as they are.
+enum img4_status img4_find_payload(const void *data, size_t size,
+		const void **payload, size_t *payload_size, char type[5]);
+
+// Get a description of a status for error messages.
+const char *img4_status_description(enum img4_status status);
+
+#endif
@@ -0,0 +1,228 @@
+/*
+ * input-file.c
+ * Brandon Azad
+ */
+#include "input-file.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Read a regular file of known size with pread().
+static bool
+pread_all(int fd, size_t size, struct input_file *file) {
+	uint8_t *buffer = malloc(size > 0 ? size : 1);
+	assert(buffer != NULL);
+	size_t offset = 0;
+	while (offset < size) {
+		ssize_t count = pread(fd, buffer + offset, size - offset, offset);
+		if (count < 0 && errno == EINTR) {
+			continue;
+		}
+		if (count < 0) {
+			perror("pread");
+			free(buffer);
+			return false;
+		}
+		if (count == 0) {
+			// The file shrank.
+			break;
+		}
+		offset += count;
+	}
+	file->buffer = buffer;
+	file->data   = buffer;
+	file->size   = offset;
+	return true;
+}
+
+// Read a file of unknown size, like a pipe or a procfs file, until end of file. The first
+// head_size bytes have already been read into head.
+static bool
+read_all(int fd, const void *head, size_t head_size, struct input_file *file) {
+	size_t capacity = 0x10000;
+	while (capacity < head_size) {
+		capacity *= 2;
+	}
+	size_t size = head_size;
+	uint8_t *buffer = malloc(capacity);
+	assert(buffer != NULL);
+	memcpy(buffer, head, head_size);
+	for (;;) {
+		if (size == capacity) {
+			capacity *= 2;
+			buffer = realloc(buffer, capacity);
+			assert(buffer != NULL);
+		}
+		ssize_t count = read(fd, buffer + size, capacity - size);
+		if (count < 0 && errno == EINTR) {
+			continue;
+		}
+		if (count < 0) {
+			perror("read");
+			free(buffer);
+			return false;
+		}
+		if (count == 0) {
+			break;
+		}
+		size += count;
+	}
+	file->buffer = buffer;
+	file->data   = buffer;
+	file->size   = size;
+	return true;
+}
+
+static bool
+mmap_all(int fd, size_t size, unsigned flags, struct input_file *file) {
+	int mmap_flags = MAP_PRIVATE;
+#ifdef MAP_POPULATE
+	if (flags & INPUT_POPULATE) {
+		mmap_flags |= MAP_POPULATE;
+	}
+#endif
+	void *mapping = mmap(NULL, size, PROT_READ, mmap_flags, fd, 0);
+	if (mapping == MAP_FAILED) {
+		return false;
+	}
+	if (flags & INPUT_SEQUENTIAL) {
+		madvise(mapping, size, MADV_SEQUENTIAL);
+	}
+#ifndef MAP_POPULATE
+	if (flags & INPUT_POPULATE) {
+		madvise(mapping, size, MADV_WILLNEED);
+	}
+#endif
+	file->mapping = mapping;
+	file->data    = mapping;
+	file->size    = size;
+	return true;
+}
+
+bool
+input_file_open(const char *path, enum input_backend backend, unsigned flags,
+		struct input_file *file) {
+	memset(file, 0, sizeof(*file));
+	bool success = false;
+	bool is_stdin = (strcmp(path, "-") == 0);
+	int fd = (is_stdin ? STDIN_FILENO : open(path, O_RDONLY));
+	if (fd < 0) {
+		perror("open");
+		goto fail_0;
+	}
+	struct stat st;
+	int err = fstat(fd, &st);
+	if (err != 0) {
+		perror("fstat");
+		goto fail_1;
+	}
+	// Files that report a size of 0, like those in procfs, may still have contents, so read
+	// them to the end.
+	if (!S_ISREG(st.st_mode) || st.st_size == 0) {
+		success = read_all(fd, NULL, 0, file);
+		goto fail_1;
+	}
+	size_t size = st.st_size;
+	if (backend == INPUT_BACKEND_MMAP) {
+		success = mmap_all(fd, size, flags, file);
+		if (success) {
+			goto fail_1;
+		}
+	}
+	success = pread_all(fd, size, file);
+fail_1:
+	if (!is_stdin) {
+		close(fd);
+	}
+fail_0:
+	return success;
+}
+
+void
+input_file_close(struct input_file *file) {
+	if (file->mapping != NULL) {
+		munmap(file->mapping, file->size);
+	}
+	free(file->buffer);
+	memset(file, 0, sizeof(*file));
+}
+
+bool
+input_file_is_stream(const char *path) {
+	struct stat st;
+	int err = (strcmp(path, "-") == 0 ? fstat(STDIN_FILENO, &st) : stat(path, &st));
+	if (err != 0) {
+		// Let input_file_open() report the error.
+		return false;
+	}
+	return (!S_ISREG(st.st_mode) || st.st_size == 0);
+}
+
+bool
+input_stream_open(const char *path, struct input_stream *stream) {
+	stream->owns_fd = (strcmp(path, "-") != 0);
+	stream->fd = (stream->owns_fd ? open(path, O_RDONLY) : STDIN_FILENO);
+	if (stream->fd < 0) {
+		perror("open");
+		return false;
+	}
+	return true;
+}
+
+ssize_t
+input_stream_read(struct input_stream *stream, void *buffer, size_t size) {
+	for (;;) {
+		ssize_t count = read(stream->fd, buffer, size);
+		if (count < 0 && errno == EINTR) {
+			continue;
+		}
+		if (count < 0) {
+			perror("read");
+		}
+		return count;
+	}
+}
+
+bool
+input_stream_read_all(struct input_stream *stream, const void *head, size_t head_size,
+		struct input_file *file) {
+	memset(file, 0, sizeof(*file));
+	return read_all(stream->fd, head, head_size, file);
+}
+
+void
+input_stream_close(struct input_stream *stream) {
+	if (stream->owns_fd) {
+		close(stream->fd);
+	}
+	stream->fd = -1;
+}
+
+void
+input_file_prefetch(const char *path) {
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		return;
+	}
+#if defined(F_RDADVISE)
+	struct stat st;
+	if (fstat(fd, &st) == 0 && st.st_size > 0) {
+		struct radvisory advice = {
+			.ra_offset = 0,
+			.ra_count  = (st.st_size < INT32_MAX ? (int)st.st_size : INT32_MAX),
+		};
+		fcntl(fd, F_RDADVISE, &advice);
+	}
+#elif defined(POSIX_FADV_WILLNEED)
+	posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+#endif
+	close(fd);
+}
@@ -0,0 +1,75 @@
+/*
+ * input-file.h
+ * Brandon Azad
+ */
+#ifndef INPUT_FILE__H_
+#define INPUT_FILE__H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+// How to get the contents of an input file into memory.
+enum input_backend {
+	// Map regular files, falling back to reading them if they can't be mapped (pipes, procfs).
+	INPUT_BACKEND_MMAP,
+	// Read the whole file into a buffer, with pread() for regular files and read() otherwise.
+	INPUT_BACKEND_READ,
+};
+
+// Hints for the mmap backend.
+enum {
+	// The file will be read from front to back.
+	INPUT_SEQUENTIAL = 0x1,
+	// Fault in the whole file up front rather than page by page.
+	INPUT_POPULATE   = 0x2,
+};
+
+struct input_file {
+	const void *data;
+	size_t size;
+	// Either the mapping or the buffer is set, depending on how the file was read.
+	void *mapping;
+	void *buffer;
+};
+
+// Open and read an input file. The path "-" means standard input. On failure, an error is printed
+// and false is returned.
+bool input_file_open(const char *path, enum input_backend backend, unsigned flags,
+		struct input_file *file);
+
+// Release the file's mapping or buffer.
+void input_file_close(struct input_file *file);
+
+// Check whether an input can only be read front to back: standard input or a pipe, or a file that
+// reports no size. input_file_open() reads such inputs into a buffer that holds all of them.
+bool input_file_is_stream(const char *path);
+
+// An input that is read from front to back a chunk at a time, rather than held in memory.
+struct input_stream {
+	int fd;
+	// Whether the stream opened fd and should close it.
+	bool owns_fd;
+};
+
+// Open an input for reading it as a stream. The path "-" means standard input. On failure, an
+// error is printed and false is returned.
+bool input_stream_open(const char *path, struct input_stream *stream);
+
+// Read the next chunk of up to size bytes of the input. Returns the number of bytes read, 0 at the
+// end of the input, or -1 after printing an error.
+ssize_t input_stream_read(struct input_stream *stream, void *buffer, size_t size);
+
+// Read the rest of a stream into memory, as input_file_open() would have read all of it. The
+// first head_size bytes of the input have already been read into head. On failure, an error is
+// printed and false is returned.
+bool input_stream_read_all(struct input_stream *stream, const void *head, size_t head_size,
+		struct input_file *file);
+
+void input_stream_close(struct input_stream *stream);
+
+// Ask the kernel to start reading a file in the background, so that a later input_file_open()
+// finds it in the page cache. This does not wait for any I/O.
+void input_file_prefetch(const char *path);
+
+#endif
@@ -1,21 +1,55 @@
 #include <assert.h>
-#include <ctype.h>
+#include <dirent.h>
 #include <fcntl.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <sys/mman.h>
 #include <sys/stat.h>
+#include <time.h>
 #include <unistd.h>
 
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+#include "devicetree-diff.h"
+#include "devicetree-export.h"
+#include "devicetree-hash.h"
+#include "devicetree-parallel.h"
 #include "devicetree-parse.h"
+#include "devicetree-query.h"
+#include "devicetree-stream.h"
+#include "img4.h"
+#include "input-file.h"
+#include "output-sink.h"
+#include "work-pool.h"
 
 
 // ---- Options -----------------------------------------------------------------------------------
 
+// The most threads that -p will start.
+#define MAX_THREADS	1024
+
 static bool print_verbose;
 static bool print_tree;
+static bool print_parallel;
+static unsigned print_threads;
+static bool check_only;
+static bool print_hashes;
+static bool diff;
+static const char **query_texts;
+static size_t n_query_texts;
+// The compiled -q queries, compiled once in main() and shared by every file.
+static struct devicetree_query **queries;
+static bool machine_readable;
+static bool json_output;
+static bool json_base64;
+static bool batch;
+static enum input_backend input_backend = INPUT_BACKEND_MMAP;
+static unsigned input_flags = INPUT_SEQUENTIAL;
+static const char *output_dir;
+static const char *export_path;
 
 // ---- DeviceTree structures ---------------------------------------------------------------------
 
@@ -45,16 +79,11 @@ read_uint(const void *data, size_t size) {
 	}
 }
 
-static bool
-all_printable_ascii(const void *data, size_t size) {
-	const uint8_t *p = data;
-	const uint8_t *end = p + size;
-	for (; p < end; p++) {
-		if (!isprint(*p)) {
-			return false;
-		}
-	}
-	return true;
+// Printable characters are 0x20 through 0x7e, as for isprint() in the C locale, but without
+// depending on the locale.
+static inline __attribute__((always_inline)) bool
+is_printable(uint8_t c) {
+	return (uint8_t)(c - 0x20) < 0x5f;
 }
 
 struct measure_string_info {
@@ -68,45 +97,190 @@ struct measure_string_info {
 	size_t null_count;
 	// The number of characters in a printable run of length 8 or more.
 	size_t printable_run_count;
+	// Bit i is set if byte i is printable, for the first 64 bytes.
+	uint64_t printable_prefix;
+	// The size of the string, and how much of it has been measured so far. The counts above
+	// only cover the measured part.
+	size_t size;
+	size_t measured;
+	// The printable and run_end bitmasks of the last block, carried into the next one.
+	uint64_t last_printable;
+	uint64_t last_run_end;
 };
 
-static void
-measure_string(const void *data, size_t size, struct measure_string_info *string_info) {
-	string_info->printable = 0;
-	string_info->first_null = size;
-	string_info->after_null = 0;
-	string_info->null_count = 0;
-	string_info->printable_run_count = 0;
-	const uint8_t *bytes = (const uint8_t *)data;
-	size_t current_printable_run = 0;
+// Classify 64 bytes at once, setting bit i of *printable and *null if byte i is printable or null.
+typedef void (*classify_block_fn)(const uint8_t *data, uint64_t *printable, uint64_t *null);
+
+// Classify the last, partial block.
+static inline __attribute__((always_inline)) void
+classify_block_scalar(const uint8_t *data, size_t size, uint64_t *printable, uint64_t *null) {
+	uint64_t printable_bits = 0;
+	uint64_t null_bits = 0;
 	for (size_t i = 0; i < size; i++) {
-		uint8_t byte = bytes[i];
-		if (byte == 0) {
-			string_info->null_count++;
-		}
-		if (isprint(byte)) {
-			string_info->printable++;
-			current_printable_run++;
+		printable_bits |= (uint64_t)is_printable(data[i]) << i;
+		null_bits |= (uint64_t)(data[i] == 0) << i;
+	}
+	*printable = printable_bits;
+	*null = null_bits;
+}
+
+// Measure the string from string_info->measured up to end, a block of 64 bytes at a time. Only
+// those bytes need to be in memory: data points to the byte at string_info->measured. The
+// measurements all come from the printable and null bitmasks of each block; in particular, the
+// bytes in long printable runs are counted from the positions that end 8 printable bytes in a
+// row. Like find_property() in devicetree-parse.c, this is inlined into a wrapper for each
+// instruction set.
+static inline __attribute__((always_inline)) void
+measure_string_blocks(const void *data, struct measure_string_info *string_info, size_t end,
+		classify_block_fn classify_block) {
+	size_t start = string_info->measured;
+	const uint8_t *bytes = data;
+	size_t size = string_info->size;
+	size_t printable_count = string_info->printable;
+	size_t null_count = string_info->null_count;
+	size_t run_count = string_info->printable_run_count;
+	size_t first_null = string_info->first_null;
+	uint64_t prefix = string_info->printable_prefix;
+	uint64_t prev_printable = string_info->last_printable;
+	uint64_t prev_run_end = string_info->last_run_end;
+	for (size_t i = start; i < end; i += 64) {
+		uint64_t printable, null;
+		if (classify_block != NULL && end - i >= 64) {
+			classify_block(bytes + (i - start), &printable, &null);
 		} else {
-			if (current_printable_run >= 8) {
-				string_info->printable_run_count += current_printable_run;
-			}
-			current_printable_run = 0;
+			size_t block_size = (end - i < 64 ? end - i : 64);
+			classify_block_scalar(bytes + (i - start), block_size, &printable, &null);
+		}
+		if (i == 0) {
+			prefix = printable;
 		}
-		if (string_info->first_null != size && byte != 0) {
-			string_info->after_null++;
+		printable_count += __builtin_popcountll(printable);
+		null_count += __builtin_popcountll(null);
+		if (null != 0 && first_null == size) {
+			first_null = i + __builtin_ctzll(null);
 		}
-		if (byte == 0 && string_info->first_null == size) {
-			string_info->first_null = i;
+		// Bit j of run_end is set if bytes j - 7 through j are all printable. A run of
+		// length n >= 8 sets n - 7 of these bits, the first of which is a run_start.
+		uint64_t run_end = printable;
+		for (unsigned k = 1; k < 8; k++) {
+			run_end &= (printable << k) | (prev_printable >> (64 - k));
 		}
+		uint64_t run_start = run_end & ~((run_end << 1) | (prev_run_end >> 63));
+		run_count += __builtin_popcountll(run_end) + 7 * __builtin_popcountll(run_start);
+		prev_printable = printable;
+		prev_run_end = run_end;
+	}
+	string_info->printable = printable_count;
+	string_info->first_null = first_null;
+	// Every byte after the first null is either another null or counted here.
+	string_info->after_null = (first_null == size ? 0 : end - first_null - null_count);
+	string_info->null_count = null_count;
+	string_info->printable_run_count = run_count;
+	string_info->printable_prefix = prefix;
+	string_info->measured = end;
+	string_info->last_printable = prev_printable;
+	string_info->last_run_end = prev_run_end;
+}
+
+typedef void (*measure_string_fn)(const void *data, struct measure_string_info *string_info,
+		size_t end);
+
+static void
+measure_string_scalar(const void *data, struct measure_string_info *string_info, size_t end) {
+	measure_string_blocks(data, string_info, end, NULL);
+}
+
+#if defined(__x86_64__)
+
+// A byte is printable if it is greater than 0x1f as a signed byte, which excludes everything
+// above 0x7f, and isn't 0x7f.
+static inline __attribute__((always_inline)) void
+classify_block_sse2(const uint8_t *data, uint64_t *printable, uint64_t *null) {
+	uint64_t printable_bits = 0;
+	uint64_t null_bits = 0;
+	for (unsigned i = 0; i < 4; i++) {
+		__m128i bytes = _mm_loadu_si128((const __m128i *)(data + 16 * i));
+		__m128i is_printable = _mm_andnot_si128(_mm_cmpeq_epi8(bytes, _mm_set1_epi8(0x7f)),
+				_mm_cmpgt_epi8(bytes, _mm_set1_epi8(0x1f)));
+		__m128i is_null = _mm_cmpeq_epi8(bytes, _mm_setzero_si128());
+		printable_bits |= (uint64_t)(uint16_t)_mm_movemask_epi8(is_printable) << (16 * i);
+		null_bits |= (uint64_t)(uint16_t)_mm_movemask_epi8(is_null) << (16 * i);
 	}
-	if (current_printable_run >= 8) {
-		string_info->printable_run_count += current_printable_run;
+	*printable = printable_bits;
+	*null = null_bits;
+}
+
+static inline __attribute__((always_inline, target("avx2"))) void
+classify_block_avx2(const uint8_t *data, uint64_t *printable, uint64_t *null) {
+	uint64_t printable_bits = 0;
+	uint64_t null_bits = 0;
+	for (unsigned i = 0; i < 2; i++) {
+		__m256i bytes = _mm256_loadu_si256((const __m256i *)(data + 32 * i));
+		__m256i is_printable = _mm256_andnot_si256(
+				_mm256_cmpeq_epi8(bytes, _mm256_set1_epi8(0x7f)),
+				_mm256_cmpgt_epi8(bytes, _mm256_set1_epi8(0x1f)));
+		__m256i is_null = _mm256_cmpeq_epi8(bytes, _mm256_setzero_si256());
+		uint32_t printable_mask = _mm256_movemask_epi8(is_printable);
+		uint32_t null_mask = _mm256_movemask_epi8(is_null);
+		printable_bits |= (uint64_t)printable_mask << (32 * i);
+		null_bits |= (uint64_t)null_mask << (32 * i);
+	}
+	*printable = printable_bits;
+	*null = null_bits;
+}
+
+static void
+measure_string_sse2(const void *data, struct measure_string_info *string_info, size_t end) {
+	measure_string_blocks(data, string_info, end, classify_block_sse2);
+}
+
+__attribute__((target("avx2")))
+static void
+measure_string_avx2(const void *data, struct measure_string_info *string_info, size_t end) {
+	measure_string_blocks(data, string_info, end, classify_block_avx2);
+}
+
+#endif
+
+static measure_string_fn measure_string_impl;
+
+static void
+select_measure_string(void) {
+	measure_string_fn measure = measure_string_scalar;
+#if defined(__x86_64__)
+	if (__builtin_cpu_supports("avx2")) {
+		measure = measure_string_avx2;
+	} else if (__builtin_cpu_supports("sse2")) {
+		measure = measure_string_sse2;
 	}
+#endif
+	measure_string_impl = measure;
+}
+
+static void
+measure_string_start(struct measure_string_info *string_info, size_t size) {
+	memset(string_info, 0, sizeof(*string_info));
+	string_info->first_null = size;
+	string_info->size = size;
+}
+
+// Measure the string up to byte end, continuing from where the last call left off. Since the
+// string is measured in blocks of 64 bytes, end must be a multiple of 64 or the size.
+static void
+measure_string_continue(const void *data, struct measure_string_info *string_info, size_t end) {
+	measure_string_impl((const uint8_t *)data + string_info->measured, string_info, end);
 }
 
+#ifdef DEVICETREE_PARSE_TEST
+// The number of bytes that check_phys_ranges() has looked at, for the tests.
+static size_t test_phys_ranges_checked;
+#endif
+
 static int
 check_phys_ranges(const void *data, size_t size) {
+#ifdef DEVICETREE_PARSE_TEST
+	test_phys_ranges_checked += size;
+#endif
 	const struct phys_range *phys_range = data;
 	size_t count = size / sizeof(*phys_range);
 	for (size_t i = 0; i < count; i++) {
@@ -134,60 +308,193 @@ enum display_type {
 	DISP_SEGMENT_RANGES,
 };
 
+// The result of one of the rules in choose_display_type(). Since the value may only have been
+// partly measured, a rule may not be decided yet.
+enum rule_result {
+	RULE_NO,
+	RULE_MAYBE,
+	RULE_YES,
+};
+
+static enum rule_result
+rule_and(enum rule_result a, enum rule_result b) {
+	return (a < b ? a : b);
+}
+
+// Check whether a count that is known to lie in [low, high] is at least the threshold.
+static enum rule_result
+rule_at_least(size_t low, size_t high, double threshold) {
+	if (low >= threshold) {
+		return RULE_YES;
+	}
+	if (high < threshold) {
+		return RULE_NO;
+	}
+	return RULE_MAYBE;
+}
+
+// The display types that the rules considered so far allow.
+struct display_type_choice {
+	// The first display type that is still possible, if found is set.
+	enum display_type type;
+	bool found;
+	// Whether type is certain.
+	bool certain;
+	// Whether a type that would be formatted differently from type is possible too.
+	bool ambiguous;
+	// The number of characters of the formatted value that will be shown.
+	size_t limit;
+	const struct measure_string_info *string;
+};
+
+// Display types that produce the same first choice->limit characters are interchangeable.
 static enum display_type
-compute_display_type(const char *name, const void *data, size_t size) {
-	const uint8_t *bytes = (const uint8_t *)data;
-	if (size == 1 || size == 2) {
-		return DISP_HEX_INT;
+display_type_class(const struct display_type_choice *choice, enum display_type type) {
+	const struct measure_string_info *string = choice->string;
+	switch (type) {
+		case DISP_FUNCTION_PROP:
+			return DISP_HEX_STRING;
+		case DISP_STRING:
+			// The string stops at the first null, which only matters if we'd show it.
+			if (string->measured >= choice->limit
+					&& string->first_null >= choice->limit) {
+				return DISP_HEX_STRING;
+			}
+			return DISP_STRING;
+		default:
+			return type;
 	}
-	if (name[0] == '#') {
-		return DISP_DEC_INT;
+}
+
+static bool
+choice_open(const struct display_type_choice *choice) {
+	return !choice->certain && !choice->ambiguous;
+}
+
+static void
+choose(struct display_type_choice *choice, enum rule_result rule, enum display_type type) {
+	if (!choice_open(choice) || rule == RULE_NO) {
+		return;
 	}
-	if (size > 0 && size % sizeof(struct segment_range) == 0) {
-		bool is_segment_ranges = strcmp(name, "segment-ranges") == 0;
-		if (is_segment_ranges) {
-			return DISP_SEGMENT_RANGES;
-		}
+	if (!choice->found) {
+		choice->type = type;
+		choice->found = true;
+	} else if (display_type_class(choice, type) != display_type_class(choice, choice->type)) {
+		choice->ambiguous = true;
+		return;
 	}
-	struct measure_string_info string;
-	measure_string(data, size, &string);
-	if (string.printable == string.first_null && string.after_null == 0) {
-		if ((size != 4 && size != 8) || string.printable >= size - 1) {
-			return DISP_STRING;
-		}
+	if (rule == RULE_YES) {
+		choice->certain = true;
+	}
+}
+
+// Apply the rules of compute_display_type() that depend on the contents of the value. The rules
+// are evaluated against bounds on the final measurements, so they can settle on a display type
+// before the whole value has been measured. Returns false if the type isn't settled yet.
+//
+// The physical range rule looks at the whole value, so its result is kept in *phys_ranges across
+// calls for the same value; it starts out as -1 and is checked at most once.
+static bool
+choose_display_type(const char *name, const void *data, size_t size,
+		const struct measure_string_info *string, size_t limit, int *phys_ranges,
+		enum display_type *type) {
+	struct display_type_choice choice = { .limit = limit, .string = string };
+	size_t unseen = size - string->measured;
+	size_t measured_first_null = (string->first_null < string->measured
+			? string->first_null : string->measured);
+	bool string_violated = string->printable != measured_first_null
+		|| string->measured - measured_first_null != string->null_count;
+	enum rule_result is_string = (string_violated ? RULE_NO
+			: unseen == 0 ? RULE_YES : RULE_MAYBE);
+	if (size == 4 || size == 8) {
+		is_string = rule_and(is_string, rule_at_least(string->printable,
+					string->printable + unseen, size - 1));
 	}
+	choose(&choice, is_string, DISP_STRING);
 	bool function_prop = strncmp(name, "function-", strlen("function-")) == 0;
 	if (function_prop && size >= 8 && size % 4 == 0) {
-		bool has_ascii = all_printable_ascii(bytes + 4, 4);
-		if (has_ascii) {
-			return DISP_FUNCTION_PROP;
+		// The function name is bytes 4 through 7.
+		bool has_ascii = ((string->printable_prefix >> 4) & 0xf) == 0xf;
+		choose(&choice, (has_ascii ? RULE_YES : RULE_NO), DISP_FUNCTION_PROP);
+	}
+	choose(&choice, rule_at_least(string->printable, string->printable + unseen, 0.75 * size),
+			DISP_HEX_STRING);
+	if (choice_open(&choice) && size > 0 && size % sizeof(struct phys_range) == 0) {
+		if (*phys_ranges < 0) {
+			bool is_reg = strstr(name, "reg") != NULL;
+			*phys_ranges = is_reg || check_phys_ranges(data, size);
 		}
+		choose(&choice, (*phys_ranges ? RULE_YES : RULE_NO), DISP_PHYS_RANGES);
 	}
-	if (string.printable >= 0.75 * size) {
-		return DISP_HEX_STRING;
+	if (size >= 24) {
+		size_t text = string->printable + string->null_count;
+		choose(&choice, rule_and(rule_at_least(string->printable,
+						string->printable + unseen, 2),
+					rule_at_least(text, text + unseen, 0.90 * size)),
+				DISP_HEX_STRING);
+		// A printable run at the end of the measured part can grow into a long run.
+		size_t run_slack = (unseen > 0 ? unseen + 7 : 0);
+		size_t runs = string->printable_run_count;
+		size_t run_text = runs + string->null_count;
+		choose(&choice, rule_and(rule_at_least(runs, runs + run_slack, 1),
+					rule_at_least(run_text, run_text + run_slack, 0.6 * size)),
+				DISP_HEX_STRING);
 	}
-	if (size > 0 && size % sizeof(struct phys_range) == 0) {
-		bool is_reg = strstr(name, "reg") != NULL;
-		if (is_reg) {
-			return DISP_PHYS_RANGES;
-		}
-		bool valid = check_phys_ranges(data, size);
-		if (valid) {
-			return DISP_PHYS_RANGES;
-		}
+	choose(&choice, RULE_YES, (size == 4 || size == 8 ? DISP_HEX_INT : DISP_HEX_DUMP));
+	*type = choice.type;
+	return !choice.ambiguous;
+}
+
+// How much of a large value to measure before checking whether the display type is settled.
+#define DISPLAY_TYPE_MEASURE_STEP	0x1000
+
+// Apply the rules of compute_display_type() that only depend on the name and size of the value.
+// Returns false if the contents of the value decide the type.
+static bool
+display_type_from_name(const char *name, size_t size, enum display_type *type) {
+	if (size == 1 || size == 2) {
+		*type = DISP_HEX_INT;
+		return true;
 	}
-	if (string.printable >= 2 && size >= 24
-			&& string.printable + string.null_count >= 0.90 * size) {
-		return DISP_HEX_STRING;
+	if (name[0] == '#') {
+		*type = DISP_DEC_INT;
+		return true;
+	}
+	if (size > 0 && size % sizeof(struct segment_range) == 0) {
+		bool is_segment_ranges = strcmp(name, "segment-ranges") == 0;
+		if (is_segment_ranges) {
+			*type = DISP_SEGMENT_RANGES;
+			return true;
+		}
 	}
-	if (string.printable_run_count > 0 && size >= 24
-			&& string.printable_run_count + string.null_count >= 0.6 * size) {
-		return DISP_HEX_STRING;
+	return false;
+}
+
+// Compute the display type of a value of which only the first limit characters, once formatted,
+// will be shown. With a smaller limit than SIZE_MAX, the result may differ from the exact type,
+// but only if the two would format the value with the same first limit characters. This lets us
+// stop looking at a large value as soon as the rest of it can't change what we print.
+static enum display_type
+compute_display_type(const char *name, const void *data, size_t size, size_t limit) {
+	enum display_type type;
+	if (display_type_from_name(name, size, &type)) {
+		return type;
 	}
-	if (size == 4 || size == 8) {
-		return DISP_HEX_INT;
+	struct measure_string_info string;
+	measure_string_start(&string, size);
+	int phys_ranges = -1;
+	for (;;) {
+		size_t end = size;
+		if (limit < size && size - string.measured > DISPLAY_TYPE_MEASURE_STEP) {
+			end = string.measured + DISPLAY_TYPE_MEASURE_STEP;
+		}
+		measure_string_continue(data, &string, end);
+		bool settled = choose_display_type(name, data, size, &string, limit, &phys_ranges,
+				&type);
+		if (settled) {
+			return type;
+		}
 	}
-	return DISP_HEX_DUMP;
 }
 
 struct strbuf {
@@ -266,20 +573,380 @@ strbuf_printf(struct strbuf *strbuf, const char *fmt, ...) {
 	return true;
 }
 
+// Make room for size more characters and a trailing null, growing the buffer if we can. Returns
+// where to write the characters, or NULL if they don't fit within the maximum capacity.
+static char *
+strbuf_reserve(struct strbuf *strbuf, size_t size) {
+	size_t req_cap = strbuf->pos + size + 1;
+	if (req_cap > strbuf->cap) {
+		if (req_cap > strbuf->max) {
+			return NULL;
+		}
+		size_t new_cap = 2 * strbuf->cap;
+		if (new_cap < req_cap) {
+			new_cap = req_cap;
+		}
+		if (new_cap > strbuf->max) {
+			new_cap = strbuf->max;
+		}
+		char *new_str = realloc(strbuf->str, new_cap);
+		assert(new_str != NULL);
+		strbuf->str = new_str;
+		strbuf->cap = new_cap;
+	}
+	return strbuf->str + strbuf->pos;
+}
+
+// The length of the string in the buffer, which is shorter than pos if a write was truncated.
+static size_t
+strbuf_length(const struct strbuf *strbuf) {
+	return (strbuf->pos < strbuf->cap ? strbuf->pos : strbuf->cap - 1);
+}
+
+// The number of characters that can still be written, growing the buffer as needed.
+static size_t
+strbuf_limit(const struct strbuf *strbuf) {
+	return (strbuf->pos + 1 < strbuf->max ? strbuf->max - 1 - strbuf->pos : 0);
+}
+
+// Finish a write of size characters into the space from strbuf_reserve().
+static void
+strbuf_commit(struct strbuf *strbuf, size_t size) {
+	strbuf->pos += size;
+	strbuf->str[strbuf->pos] = 0;
+}
+
+// The number of characters that can still be written without growing the buffer.
+static size_t
+strbuf_room(const struct strbuf *strbuf) {
+	return (strbuf->pos + 1 < strbuf->cap ? strbuf->cap - 1 - strbuf->pos : 0);
+}
+
+// Finish a write of size characters that didn't fit, after the first strbuf_room() of them have
+// been written in place. Like strbuf_printf(), this leaves the truncated string in the buffer and
+// moves pos past the end of the write.
 static bool
-print_property_hex_dump(struct strbuf *sb, const void *data, size_t size) {
+strbuf_truncate(struct strbuf *strbuf, size_t size) {
+	if (strbuf->pos < strbuf->cap) {
+		strbuf->str[strbuf->cap - 1] = 0;
+	}
+	strbuf->pos += size;
+	return false;
+}
+
+#define HEX_ROW(h)	h"0" h"1" h"2" h"3" h"4" h"5" h"6" h"7" \
+			h"8" h"9" h"a" h"b" h"c" h"d" h"e" h"f"
+
+// The two hex digits of each byte.
+static const char hex_pairs[2 * 256 + 1] =
+	HEX_ROW("0") HEX_ROW("1") HEX_ROW("2") HEX_ROW("3")
+	HEX_ROW("4") HEX_ROW("5") HEX_ROW("6") HEX_ROW("7")
+	HEX_ROW("8") HEX_ROW("9") HEX_ROW("a") HEX_ROW("b")
+	HEX_ROW("c") HEX_ROW("d") HEX_ROW("e") HEX_ROW("f");
+
+#undef HEX_ROW
+
+// The length of each byte once escaped for a quoted string: printable characters stand for
+// themselves, backslash, quote and null get a backslash, and anything else becomes "\xNN".
+static const uint8_t escape_length[256] = {
+	[0x00]          = 2,
+	[0x01 ... 0x1f] = 4,
+	[0x20 ... 0x21] = 1,
+	['"']           = 2,
+	[0x23 ... 0x5b] = 1,
+	['\\']          = 2,
+	[0x5d ... 0x7e] = 1,
+	[0x7f ... 0xff] = 4,
+};
+
+static inline __attribute__((always_inline)) size_t
+escape_byte(char *out, uint8_t c) {
+	switch (escape_length[c]) {
+		case 1:
+			out[0] = c;
+			return 1;
+		case 2:
+			out[0] = '\\';
+			out[1] = (c == 0 ? '0' : c);
+			return 2;
+		default:
+			out[0] = '\\';
+			out[1] = 'x';
+			out[2] = hex_pairs[2 * c];
+			out[3] = hex_pairs[2 * c + 1];
+			return 4;
+	}
+}
+
+// Escape a byte for a JSON string. Bytes above 0x7f stand for the Latin-1 characters with the
+// same codes, since values aren't necessarily UTF-8.
+static inline __attribute__((always_inline)) size_t
+json_escape_byte(char *out, uint8_t c) {
+	if (escape_length[c] == 1) {
+		out[0] = c;
+		return 1;
+	}
+	out[0] = '\\';
+	switch (c) {
+		case '"':
+		case '\\':
+			out[1] = c;
+			return 2;
+		case '\n':
+			out[1] = 'n';
+			return 2;
+		case '\r':
+			out[1] = 'r';
+			return 2;
+		case '\t':
+			out[1] = 't';
+			return 2;
+		default:
+			memcpy(out + 1, "u00", 3);
+			out[4] = hex_pairs[2 * c];
+			out[5] = hex_pairs[2 * c + 1];
+			return 6;
+	}
+}
+
+// Write each byte as two hex digits and a space, 3 * size characters in all.
+typedef void (*hex_dump_fn)(char *out, const uint8_t *data, size_t size);
+
+// Write each byte as two hex digits, 2 * size characters in all.
+typedef void (*hex_encode_fn)(char *out, const uint8_t *data, size_t size);
+
+// Escape the bytes for a quoted string, at most 4 * size characters for escape_byte() and 6 * size
+// for json_escape_byte(). Returns the end of the output.
+typedef char *(*escape_string_fn)(char *out, const uint8_t *data, size_t size);
+
+typedef size_t (*escape_byte_fn)(char *out, uint8_t c);
+
+static void
+hex_dump_scalar(char *out, const uint8_t *data, size_t size) {
+	for (size_t i = 0; i < size; i++) {
+		out[3 * i]     = hex_pairs[2 * data[i]];
+		out[3 * i + 1] = hex_pairs[2 * data[i] + 1];
+		out[3 * i + 2] = ' ';
+	}
+}
+
+static void
+hex_encode_scalar(char *out, const uint8_t *data, size_t size) {
+	for (size_t i = 0; i < size; i++) {
+		memcpy(out + 2 * i, hex_pairs + 2 * data[i], 2);
+	}
+}
+
+// Copy a block of bytes to out as if none needed escaping, and return a mask of those that do.
+typedef uint32_t (*copy_plain_block_fn)(char *out, const uint8_t *data);
+
+// The escape loop is always inlined into a wrapper for each instruction set, like find_property()
+// in devicetree-parse.c. Runs of plain characters are copied a block at a time.
+static inline __attribute__((always_inline)) char *
+escape_string(char *out, const uint8_t *data, size_t size, size_t block_size,
+		copy_plain_block_fn copy_plain_block, escape_byte_fn escape_byte) {
 	const uint8_t *p = data;
 	const uint8_t *end = p + size;
-	const uint8_t *print_end = end;
-	bool ok = true;
-	for (; ok && p < print_end; p++) {
-		const char *sep = " ";
-		if (p == print_end - 1) {
-			sep = (print_end == end ? "" : "...");
+	// Each escape makes the output longer, so there is always room to store a whole block.
+	while (copy_plain_block != NULL && (size_t)(end - p) >= block_size) {
+		uint32_t special = copy_plain_block(out, p);
+		if (special == 0) {
+			out += block_size;
+			p += block_size;
+			continue;
 		}
-		ok = strbuf_printf(sb, "%02x%s", *p, sep);
+		unsigned plain = __builtin_ctz(special);
+		out += plain;
+		p += plain;
+		out += escape_byte(out, *p);
+		p++;
 	}
-	return ok;
+	for (; p < end; p++) {
+		out += escape_byte(out, *p);
+	}
+	return out;
+}
+
+static char *
+escape_string_scalar(char *out, const uint8_t *data, size_t size) {
+	return escape_string(out, data, size, 0, NULL, escape_byte);
+}
+
+static char *
+json_escape_string_scalar(char *out, const uint8_t *data, size_t size) {
+	return escape_string(out, data, size, 0, NULL, json_escape_byte);
+}
+
+#if defined(__x86_64__)
+
+__attribute__((target("ssse3")))
+static void
+hex_dump_ssse3(char *out, const uint8_t *data, size_t size) {
+	const __m128i digits = _mm_setr_epi8('0', '1', '2', '3', '4', '5', '6', '7',
+			'8', '9', 'a', 'b', 'c', 'd', 'e', 'f');
+	const __m128i nibble = _mm_set1_epi8(0x0f);
+	// Each 16-byte block becomes 48 characters. The shuffles pick each output character's digit
+	// from the digit pairs of the first or second 8 bytes, and leave zeros for the spaces.
+	const __m128i shuffle_0  = _mm_setr_epi8(0, 1, -1, 2, 3, -1, 4, 5,
+			-1, 6, 7, -1, 8, 9, -1, 10);
+	const __m128i shuffle_1a = _mm_setr_epi8(11, -1, 12, 13, -1, 14, 15, -1,
+			-1, -1, -1, -1, -1, -1, -1, -1);
+	const __m128i shuffle_1b = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1,
+			0, 1, -1, 2, 3, -1, 4, 5);
+	const __m128i shuffle_2  = _mm_setr_epi8(-1, 6, 7, -1, 8, 9, -1, 10,
+			11, -1, 12, 13, -1, 14, 15, -1);
+	const __m128i spaces_0 = _mm_setr_epi8(0, 0, ' ', 0, 0, ' ', 0, 0,
+			' ', 0, 0, ' ', 0, 0, ' ', 0);
+	const __m128i spaces_1 = _mm_setr_epi8(0, ' ', 0, 0, ' ', 0, 0, ' ',
+			0, 0, ' ', 0, 0, ' ', 0, 0);
+	const __m128i spaces_2 = _mm_setr_epi8(' ', 0, 0, ' ', 0, 0, ' ', 0,
+			0, ' ', 0, 0, ' ', 0, 0, ' ');
+	size_t i = 0;
+	for (; i + 16 <= size; i += 16) {
+		__m128i bytes = _mm_loadu_si128((const __m128i *)(data + i));
+		__m128i high = _mm_shuffle_epi8(digits,
+				_mm_and_si128(_mm_srli_epi16(bytes, 4), nibble));
+		__m128i low = _mm_shuffle_epi8(digits, _mm_and_si128(bytes, nibble));
+		__m128i pairs_lo = _mm_unpacklo_epi8(high, low);
+		__m128i pairs_hi = _mm_unpackhi_epi8(high, low);
+		__m128i out_0 = _mm_or_si128(_mm_shuffle_epi8(pairs_lo, shuffle_0), spaces_0);
+		__m128i out_1 = _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(pairs_lo, shuffle_1a),
+					_mm_shuffle_epi8(pairs_hi, shuffle_1b)), spaces_1);
+		__m128i out_2 = _mm_or_si128(_mm_shuffle_epi8(pairs_hi, shuffle_2), spaces_2);
+		_mm_storeu_si128((__m128i *)(out + 3 * i), out_0);
+		_mm_storeu_si128((__m128i *)(out + 3 * i + 16), out_1);
+		_mm_storeu_si128((__m128i *)(out + 3 * i + 32), out_2);
+	}
+	hex_dump_scalar(out + 3 * i, data + i, size - i);
+}
+
+__attribute__((target("ssse3")))
+static void
+hex_encode_ssse3(char *out, const uint8_t *data, size_t size) {
+	const __m128i digits = _mm_setr_epi8('0', '1', '2', '3', '4', '5', '6', '7',
+			'8', '9', 'a', 'b', 'c', 'd', 'e', 'f');
+	const __m128i nibble = _mm_set1_epi8(0x0f);
+	size_t i = 0;
+	for (; i + 16 <= size; i += 16) {
+		__m128i bytes = _mm_loadu_si128((const __m128i *)(data + i));
+		__m128i high = _mm_shuffle_epi8(digits,
+				_mm_and_si128(_mm_srli_epi16(bytes, 4), nibble));
+		__m128i low = _mm_shuffle_epi8(digits, _mm_and_si128(bytes, nibble));
+		_mm_storeu_si128((__m128i *)(out + 2 * i), _mm_unpacklo_epi8(high, low));
+		_mm_storeu_si128((__m128i *)(out + 2 * i + 16), _mm_unpackhi_epi8(high, low));
+	}
+	hex_encode_scalar(out + 2 * i, data + i, size - i);
+}
+
+// A byte needs escaping if it is a backslash, a quote, 0x7f, or less than 0x20 as a signed byte,
+// which covers both the control characters and everything above 0x7f.
+static inline __attribute__((always_inline)) uint32_t
+copy_plain_block_sse2(char *out, const uint8_t *data) {
+	__m128i bytes = _mm_loadu_si128((const __m128i *)data);
+	_mm_storeu_si128((__m128i *)out, bytes);
+	__m128i special = _mm_or_si128(
+			_mm_or_si128(_mm_cmplt_epi8(bytes, _mm_set1_epi8(0x20)),
+				_mm_cmpeq_epi8(bytes, _mm_set1_epi8(0x7f))),
+			_mm_or_si128(_mm_cmpeq_epi8(bytes, _mm_set1_epi8('\\')),
+				_mm_cmpeq_epi8(bytes, _mm_set1_epi8('"'))));
+	return (uint32_t)_mm_movemask_epi8(special);
+}
+
+static inline __attribute__((always_inline, target("avx2"))) uint32_t
+copy_plain_block_avx2(char *out, const uint8_t *data) {
+	__m256i bytes = _mm256_loadu_si256((const __m256i *)data);
+	_mm256_storeu_si256((__m256i *)out, bytes);
+	__m256i special = _mm256_or_si256(
+			_mm256_or_si256(_mm256_cmpgt_epi8(_mm256_set1_epi8(0x20), bytes),
+				_mm256_cmpeq_epi8(bytes, _mm256_set1_epi8(0x7f))),
+			_mm256_or_si256(_mm256_cmpeq_epi8(bytes, _mm256_set1_epi8('\\')),
+				_mm256_cmpeq_epi8(bytes, _mm256_set1_epi8('"'))));
+	return (uint32_t)_mm256_movemask_epi8(special);
+}
+
+static char *
+escape_string_sse2(char *out, const uint8_t *data, size_t size) {
+	return escape_string(out, data, size, 16, copy_plain_block_sse2, escape_byte);
+}
+
+__attribute__((target("avx2")))
+static char *
+escape_string_avx2(char *out, const uint8_t *data, size_t size) {
+	return escape_string(out, data, size, 32, copy_plain_block_avx2, escape_byte);
+}
+
+static char *
+json_escape_string_sse2(char *out, const uint8_t *data, size_t size) {
+	return escape_string(out, data, size, 16, copy_plain_block_sse2, json_escape_byte);
+}
+
+__attribute__((target("avx2")))
+static char *
+json_escape_string_avx2(char *out, const uint8_t *data, size_t size) {
+	return escape_string(out, data, size, 32, copy_plain_block_avx2, json_escape_byte);
+}
+
+#endif
+
+static hex_dump_fn hex_dump_impl;
+static hex_encode_fn hex_encode_impl;
+static escape_string_fn escape_string_impl;
+static escape_string_fn json_escape_string_impl;
+
+static void
+select_encoders(void) {
+	hex_dump_fn hex_dump = hex_dump_scalar;
+	hex_encode_fn hex_encode = hex_encode_scalar;
+	escape_string_fn escape = escape_string_scalar;
+	escape_string_fn json_escape = json_escape_string_scalar;
+#if defined(__x86_64__)
+	if (__builtin_cpu_supports("ssse3")) {
+		hex_dump = hex_dump_ssse3;
+		hex_encode = hex_encode_ssse3;
+	}
+	if (__builtin_cpu_supports("avx2")) {
+		escape = escape_string_avx2;
+		json_escape = json_escape_string_avx2;
+	} else if (__builtin_cpu_supports("sse2")) {
+		escape = escape_string_sse2;
+		json_escape = json_escape_string_sse2;
+	}
+#endif
+	hex_dump_impl = hex_dump;
+	hex_encode_impl = hex_encode;
+	escape_string_impl = escape;
+	json_escape_string_impl = json_escape;
+}
+
+// Choose the implementations of the classifier and encoders for this CPU. This is called once at
+// startup, before any threads are started, so the choices are never written while being read.
+static void
+select_implementations(void) {
+	select_measure_string();
+	select_encoders();
+}
+
+static bool
+print_property_hex_dump(struct strbuf *sb, const void *data, size_t size) {
+	const uint8_t *bytes = data;
+	if (size == 0) {
+		return true;
+	}
+	// The bytes are separated by spaces, with none after the last one.
+	size_t length = 3 * size - 1;
+	char *out = strbuf_reserve(sb, length);
+	if (out != NULL) {
+		hex_dump_impl(out, bytes, size);
+		strbuf_commit(sb, length);
+		return true;
+	}
+	// Only the start of the dump fits, so format just that much.
+	size_t room = strbuf_room(sb);
+	out = sb->str + sb->pos;
+	for (size_t i = 0; i < room; i++) {
+		out[i] = (i % 3 == 2 ? ' ' : hex_pairs[2 * bytes[i / 3] + i % 3]);
+	}
+	return strbuf_truncate(sb, length);
 }
 
 static bool
@@ -298,32 +965,44 @@ print_property_dec_int(struct strbuf *sb, const void *data, size_t size) {
 
 static bool
 print_property_hex_string(struct strbuf *sb, const void *data, size_t size) {
-	const char *p = data;
-	const char *end = p + size;
-	bool ok = strbuf_printf(sb, "\"");
-	for (; ok && p < end; p++) {
-		uint8_t c = *p;
-		if (c == '\\' || c == '"') {
-			ok = strbuf_printf(sb, "\\");
-		}
-		if (c == 0) {
-			ok = strbuf_printf(sb, "\\0");
-		} else if (isprint(c)) {
-			ok = strbuf_printf(sb, "%c", c);
-		} else {
-			ok = strbuf_printf(sb, "\\x%02x", (unsigned)c);
-		}
+	const uint8_t *bytes = data;
+	char *out = strbuf_reserve(sb, 4 * size + 2);
+	if (out != NULL) {
+		char *start = out;
+		*out++ = '"';
+		out = escape_string_impl(out, bytes, size);
+		*out++ = '"';
+		strbuf_commit(sb, out - start);
+		return true;
 	}
-	if (ok) {
-		ok = strbuf_printf(sb, "\"");
+	// The worst case doesn't fit, so emit the opening quote, each escaped byte, and the closing
+	// quote in turn until we run out of room.
+	size_t room = strbuf_room(sb);
+	out = sb->str + sb->pos;
+	size_t length = 0;
+	for (size_t i = 0; i < size + 2; i++) {
+		char escaped[4] = { '"' };
+		size_t escaped_length = 1;
+		if (i > 0 && i <= size) {
+			escaped_length = escape_byte(escaped, bytes[i - 1]);
+		}
+		if (length + escaped_length > room) {
+			memcpy(out + length, escaped, room - length);
+			return strbuf_truncate(sb, length + escaped_length);
+		}
+		memcpy(out + length, escaped, escaped_length);
+		length += escaped_length;
 	}
-	return ok;
+	strbuf_commit(sb, length);
+	return true;
 }
 
 static bool
 print_property_string(struct strbuf *sb, const void *data, size_t size) {
 	assert(size > 0);
-	size_t len = strnlen((const char *)data, size);
+	// Past the limit, the string will be truncated no matter where the null is.
+	size_t max_len = strbuf_limit(sb);
+	size_t len = strnlen((const char *)data, (size < max_len ? size : max_len));
 	return print_property_hex_string(sb, data, len);
 }
 
@@ -366,8 +1045,7 @@ print_property_segment_ranges(struct strbuf *sb, const void *data, size_t size)
 }
 
 static bool
-print_property(struct strbuf *sb, const char *name, const void *value, size_t size) {
-	enum display_type disp = compute_display_type(name, value, size);
+print_property_as(struct strbuf *sb, enum display_type disp, const void *value, size_t size) {
 	switch (disp) {
 		default: // DISP_HEX_DUMP
 			return print_property_hex_dump(sb, value, size);
@@ -388,95 +1066,1408 @@ print_property(struct strbuf *sb, const char *name, const void *value, size_t si
 	}
 }
 
+static bool
+print_property(struct strbuf *sb, const char *name, const void *value, size_t size) {
+	enum display_type disp = compute_display_type(name, value, size, strbuf_limit(sb));
+	return print_property_as(sb, disp, value, size);
+}
+
+// Indentation to copy from: the spaces of the plain format and the bars of the tree format.
+#define INDENT_BARS	"|   |   |   |   |   |   |   |   "
+static const char indent_spaces[128] = { [0 ... 127] = ' ' };
+static const char indent_bars[] = INDENT_BARS INDENT_BARS INDENT_BARS INDENT_BARS;
+#undef INDENT_BARS
+
+// Write length characters of a repeating pattern, using a buffer that holds a whole number of
+// repetitions.
+static void
+print_repeated(struct output_sink *out, const char *pattern, size_t pattern_size, size_t length) {
+	while (length > 0) {
+		size_t chunk = (length < pattern_size ? length : pattern_size);
+		output_sink_write(out, pattern, chunk);
+		length -= chunk;
+	}
+}
+
 static void
-print_indent(unsigned depth) {
+print_indent(struct output_sink *out, unsigned depth) {
 	if (print_tree) {
 		if (depth > 0) {
-			for (unsigned i = 0; i < depth - 1; i++) {
-				printf("|   ");
-			}
-			printf("|-- ");
+			print_repeated(out, indent_bars, sizeof(indent_bars) - 1,
+					4 * (size_t)(depth - 1));
+			output_sink_write(out, "|-- ", 4);
 		}
 	} else {
-		for (unsigned i = 0; i < 4 * depth; i++) {
-			printf(" ");
-		}
+		print_repeated(out, indent_spaces, sizeof(indent_spaces), 4 * (size_t)depth);
+	}
+}
+
+static void
+print_decimal(struct output_sink *out, uint64_t value) {
+	char digits[20];
+	char *p = digits + sizeof(digits);
+	do {
+		*--p = '0' + value % 10;
+		value /= 10;
+	} while (value != 0);
+	output_sink_write(out, p, digits + sizeof(digits) - p);
+}
+
+static void
+print_node(struct output_sink *out, unsigned depth, const char *name, size_t name_size) {
+	if (name == NULL) {
+		name = "NODE";
+		name_size = strlen(name);
+	}
+	print_indent(out, depth);
+	output_sink_write(out, name, strnlen(name, name_size));
+	output_sink_write(out, ":\n", 2);
+}
+
+// Print the size and value of a property, followed by a newline, using sb as scratch space for
+// the (possibly truncated) value. The value is shown with the stored display type if there is
+// one, and classified otherwise.
+static void
+print_size_and_value(struct output_sink *out, struct strbuf *sb, const char *name,
+		const void *value, size_t size, const uint8_t *stored_type) {
+	output_sink_write(out, " (", 2);
+	print_decimal(out, size);
+	if (size == 0) {
+		output_sink_write(out, ")\n", 2);
+		return;
+	}
+	output_sink_write(out, "): ", 3);
+	sb->pos = 0;
+	bool complete = (stored_type != NULL
+			? print_property_as(sb, *stored_type, value, size)
+			: print_property(sb, name, value, size));
+	output_sink_write(out, sb->str, strbuf_length(sb));
+	if (!complete) {
+		output_sink_write(out, "...", 3);
 	}
+	output_sink_write(out, "\n", 1);
 }
 
+static void
+print_property_line(struct output_sink *out, struct strbuf *sb, unsigned depth,
+		const char *name, const void *value, size_t size, const uint8_t *stored_type) {
+	print_indent(out, depth);
+	output_sink_write_string(out, name);
+	print_size_and_value(out, sb, name, value, size, stored_type);
+}
+
+// Format the device tree into out.
 static bool
-devicetree_print(const void *data, size_t size) {
-	__block const char *node_name;
+devicetree_print(const void *data, size_t size, struct output_sink *out) {
 	__block struct strbuf sb;
 	strbuf_alloc(&sb, print_verbose ? -1 : 64);
-	devicetree_iterate_property_callback_t find_node_name_cb =
-			^(unsigned depth, const char *name,
-					const void *value, size_t size, bool *stop) {
-		if (strcmp(name, "name") == 0) {
-			node_name = (const char *)value;
-		}
-	};
-	devicetree_iterate_node_callback_t node_cb =
+	devicetree_iterate_named_node_callback_t node_cb =
 			^(unsigned depth, const void *node, size_t size,
-					unsigned n_properties, unsigned n_children, bool *stop) {
-		bool ok = devicetree_node_scan_properties(node, size, find_node_name_cb);
-		if (!ok) {
-			node_name = "NODE";
-		}
-		print_indent(depth);
-		printf("%s:\n", node_name);
+					unsigned n_properties, unsigned n_children,
+					const char *name, size_t name_size,
+					const char *compatible, size_t compatible_size,
+					bool *skip_children, bool *stop) {
+		print_node(out, depth, name, name_size);
 	};
 	devicetree_iterate_property_callback_t property_cb =
 			^(unsigned depth, const char *name,
 					const void *value, size_t size, bool *stop) {
-		print_indent(depth);
-		printf("%s (%zu)%s", name, size, (size > 0 ? ": " : ""));
-		if (size > 0) {
-			sb.pos = 0;
-			bool complete = print_property(&sb, name, value, size);
-			printf("%s%s", sb.str, complete ? "" : "...");
-		}
-		printf("\n");
+		print_property_line(out, &sb, depth, name, value, size, NULL);
 	};
 	const void *processed = data;
-	bool ok = devicetree_iterate(&processed, size, node_cb, property_cb);
+	bool ok = devicetree_iterate_named(&processed, size, node_cb, property_cb);
 	strbuf_free(&sb);
 	return (ok && (processed == (uint8_t *)data + size));
 }
 
-// ---- devicetree-parse tool ---------------------------------------------------------------------
+// ---- Stream printing ---------------------------------------------------------------------------
 
-static bool
-mmap_file(const char *path, void **data, size_t *size) {
-	bool success = false;
-	int fd = open(path, O_RDONLY);
-	if (fd < 0) {
-		perror("open");
-		goto fail_0;
-	}
-	struct stat st;
-	int err = fstat(fd, &st);
-	if (err != 0) {
-		perror("fstat");
-		goto fail_1;
-	}
-	size_t filesize = st.st_size;
-	*size = filesize;
-	void *mapped = mmap(NULL, filesize, PROT_READ, MAP_PRIVATE, fd, 0);
-	if (mapped == MAP_FAILED) {
-		perror("mmap");
-		goto fail_1;
-	}
-	*data = mapped;
-	success = true;
-fail_1:
-	close(fd);
-fail_0:
-	return success;
+// The largest value that the stream printer holds in memory without -v. Larger values are
+// measured as they arrive and only their start is kept.
+#define STREAM_MAX_BUFFERED_VALUE	0x10000
+
+// How much of a large value to keep for printing. A truncated line shows far less of the value
+// than this, whatever its display type.
+#define STREAM_VALUE_PREFIX		0x1000
+
+// A value larger than STREAM_MAX_BUFFERED_VALUE that arrives in pieces. It gets the same
+// measurements as compute_display_type() would make, without ever being in memory as a whole.
+struct stream_value {
+	struct measure_string_info string;
+	// The bytes of a partial 64-byte block, which is measured once it is complete.
+	uint8_t block[64];
+	size_t block_size;
+	// Whether the complete 16-byte entries so far pass check_phys_ranges(), and the bytes of a
+	// partial entry.
+	bool phys_ranges;
+	uint8_t entry[sizeof(struct phys_range)];
+	size_t entry_size;
+	uint8_t prefix[STREAM_VALUE_PREFIX];
+	size_t prefix_size;
+};
+
+static void
+stream_value_start(struct stream_value *value, size_t size) {
+	measure_string_start(&value->string, size);
+	value->block_size = 0;
+	value->phys_ranges = (size % sizeof(struct phys_range) == 0);
+	value->entry_size = 0;
+	value->prefix_size = 0;
 }
 
-int
+// Measure the next piece of the value in place, collecting the bytes of blocks that are split
+// between pieces.
+static void
+stream_value_measure(struct stream_value *value, const uint8_t *data, size_t size) {
+	struct measure_string_info *string = &value->string;
+	while (size > 0) {
+		if (value->block_size == 0 && size >= sizeof(value->block)) {
+			size_t blocks = size & ~(sizeof(value->block) - 1);
+			measure_string_impl(data, string, string->measured + blocks);
+			data += blocks;
+			size -= blocks;
+			continue;
+		}
+		size_t copy = sizeof(value->block) - value->block_size;
+		copy = (copy < size ? copy : size);
+		memcpy(value->block + value->block_size, data, copy);
+		value->block_size += copy;
+		data += copy;
+		size -= copy;
+		size_t end = string->measured + value->block_size;
+		if (value->block_size == sizeof(value->block) || end == string->size) {
+			measure_string_impl(value->block, string, end);
+			value->block_size = 0;
+		}
+	}
+}
+
+// Check the next piece of the value as physical ranges, like measuring it.
+static void
+stream_value_check_phys_ranges(struct stream_value *value, const uint8_t *data, size_t size) {
+	while (size > 0 && value->phys_ranges) {
+		if (value->entry_size == 0 && size >= sizeof(value->entry)) {
+			size_t entries = size - size % sizeof(value->entry);
+			value->phys_ranges = check_phys_ranges(data, entries);
+			data += entries;
+			size -= entries;
+			continue;
+		}
+		size_t copy = sizeof(value->entry) - value->entry_size;
+		copy = (copy < size ? copy : size);
+		memcpy(value->entry + value->entry_size, data, copy);
+		value->entry_size += copy;
+		data += copy;
+		size -= copy;
+		if (value->entry_size == sizeof(value->entry)) {
+			value->phys_ranges = check_phys_ranges(value->entry, sizeof(value->entry));
+			value->entry_size = 0;
+		}
+	}
+}
+
+static void
+stream_value_add(struct stream_value *value, const void *data, size_t size) {
+	if (value->prefix_size < sizeof(value->prefix)) {
+		size_t copy = sizeof(value->prefix) - value->prefix_size;
+		copy = (copy < size ? copy : size);
+		memcpy(value->prefix + value->prefix_size, data, copy);
+		value->prefix_size += copy;
+	}
+	stream_value_measure(value, data, size);
+	stream_value_check_phys_ranges(value, data, size);
+}
+
+// Get the display type of a value that has arrived in full. All of it has been measured, so the
+// rules of compute_display_type() settle on its exact type.
+static enum display_type
+stream_value_display_type(const char *name, struct stream_value *value) {
+	enum display_type type;
+	if (display_type_from_name(name, value->string.size, &type)) {
+		return type;
+	}
+	int phys_ranges = (strstr(name, "reg") != NULL || value->phys_ranges);
+	choose_display_type(name, value->prefix, value->string.size, &value->string, SIZE_MAX,
+			&phys_ranges, &type);
+	return type;
+}
+
+// Format a devicetree that is read in pieces into out, with the same output as devicetree_print().
+// The next_chunk block returns each piece in turn, and false once there are no more. The output of
+// a node's properties is held back until its "name" property is seen. Without -v, values larger
+// than STREAM_MAX_BUFFERED_VALUE are never held in memory as a whole; with -v, every value is
+// printed in full, so each is held while it is printed.
+//
+// The one difference is in a node whose properties turn out to be malformed after its name has
+// been printed: devicetree_print() doesn't trust the name of such a node, and prints it as "NODE".
+static bool
+devicetree_print_stream(struct output_sink *out,
+		bool (^next_chunk)(const void **data, size_t *size)) {
+	__block struct strbuf sb;
+	strbuf_alloc(&sb, print_verbose ? -1 : 64);
+	// The node that is waiting for its name, and the lines of its properties so far.
+	__block bool name_pending = false;
+	__block unsigned node_depth = 0;
+	// Whether the null that ends a name that arrives in pieces has been seen.
+	__block bool name_ended = false;
+	__block struct output_sink held;
+	output_sink_init_memory(&held);
+	struct stream_value *value = malloc(sizeof(*value));
+	assert(value != NULL);
+	void (^print_pending_node)(const char *, size_t) = ^(const char *name, size_t name_size) {
+		if (name_pending) {
+			print_node(out, node_depth, name, name_size);
+			output_sink_write(out, held.buffer, held.size);
+			held.size = 0;
+			name_pending = false;
+		}
+	};
+	devicetree_iterate_node_callback_t node_cb =
+			^(unsigned depth, const void *node, size_t size,
+					unsigned n_properties, unsigned n_children,
+					bool *skip_children, bool *stop) {
+		// A node without a name is printed once the next node starts.
+		print_pending_node(NULL, 0);
+		name_pending = true;
+		node_depth = depth;
+	};
+	devicetree_iterate_property_callback_t property_cb =
+			^(unsigned depth, const char *name,
+					const void *data, size_t size, bool *stop) {
+		if (name_pending && strcmp(name, "name") == 0) {
+			print_pending_node(data, size);
+		}
+		print_property_line((name_pending ? &held : out), &sb, depth, name, data, size,
+				NULL);
+	};
+	devicetree_stream_value_callback_t value_cb =
+			^(unsigned depth, const char *name,
+					size_t offset, const void *data, size_t size,
+					size_t total_size, bool *stop) {
+		if (offset == 0) {
+			stream_value_start(value, total_size);
+		}
+		stream_value_add(value, data, size);
+		// Print a node name that arrives in pieces as it arrives, like print_node().
+		bool node_name = (name_pending && strcmp(name, "name") == 0);
+		if (node_name && offset == 0) {
+			print_indent(out, node_depth);
+			name_ended = false;
+		}
+		if (node_name && !name_ended) {
+			size_t length = strnlen(data, size);
+			output_sink_write(out, data, length);
+			name_ended = (length < size);
+		}
+		if (offset + size < total_size) {
+			return;
+		}
+		if (node_name) {
+			output_sink_write(out, ":\n", 2);
+			output_sink_write(out, held.buffer, held.size);
+			held.size = 0;
+			name_pending = false;
+		}
+		// Like all of the value, the start of it formats into more than fits in the line.
+		struct output_sink *line = (name_pending ? &held : out);
+		enum display_type type = stream_value_display_type(name, value);
+		print_indent(line, depth);
+		output_sink_write_string(line, name);
+		output_sink_write(line, " (", 2);
+		print_decimal(line, total_size);
+		output_sink_write(line, "): ", 3);
+		// The range printers only take whole records.
+		size_t prefix_size = value->prefix_size;
+		if (type == DISP_PHYS_RANGES) {
+			prefix_size -= prefix_size % sizeof(struct phys_range);
+		} else if (type == DISP_SEGMENT_RANGES) {
+			prefix_size -= prefix_size % sizeof(struct segment_range);
+		}
+		sb.pos = 0;
+		bool complete = print_property_as(&sb, type, value->prefix, prefix_size);
+		output_sink_write(line, sb.str, strbuf_length(&sb));
+		if (!complete) {
+			output_sink_write(line, "...", 3);
+		}
+		output_sink_write(line, "\n", 1);
+	};
+	struct devicetree_stream *stream = devicetree_stream_create(STREAM_MAX_BUFFERED_VALUE,
+			node_cb, property_cb, (print_verbose ? NULL : value_cb));
+	assert(stream != NULL);
+	bool ok = true;
+	const void *data;
+	size_t size;
+	while (ok && next_chunk(&data, &size)) {
+		ok = devicetree_stream_feed(stream, data, size);
+	}
+	ok = ok && devicetree_stream_finish(stream);
+	// Print the last node if it has no name, or whatever of a malformed node did parse.
+	print_pending_node(NULL, 0);
+	devicetree_stream_free(stream);
+	output_sink_close(&held);
+	free(value);
+	strbuf_free(&sb);
+	return ok;
+}
+
+// Find the "name" property of an indexed node. In an export, the properties are matched by their
+// interned name IDs rather than by comparing their names; name_id is the ID of "name".
+static bool
+index_node_name(const struct devicetree_index *index, const struct devicetree_export *export,
+		uint32_t name_id, uint32_t id, const void **name, size_t *name_size) {
+	if (export == NULL) {
+		return devicetree_index_find_property(index, id, "name", name, name_size);
+	}
+	const struct devicetree_index_node *node = &index->nodes[id];
+	for (uint32_t i = 0; i < node->n_properties; i++) {
+		uint32_t prop_id = node->first_property + i;
+		if (export->property_names[prop_id] == name_id) {
+			const struct devicetree_index_property *prop = &index->properties[prop_id];
+			*name = devicetree_index_property_value(index, prop);
+			*name_size = prop->size;
+			return true;
+		}
+	}
+	return false;
+}
+
+// Print the nodes of an indexed device tree with IDs in [first_node, end_node) into out. If
+// export is not NULL, the index is the export's, and the export's name IDs and display types are
+// used instead of comparing names and classifying values.
+static void
+print_index_nodes(struct output_sink *out, struct strbuf *sb,
+		const struct devicetree_index *index, const struct devicetree_export *export,
+		uint32_t first_node, uint32_t end_node) {
+	const uint8_t *display_types = (export != NULL ? export->display_types : NULL);
+	uint32_t name_id = (export != NULL ? devicetree_export_find_name(export, "name")
+			: DEVICETREE_INDEX_NONE);
+	for (uint32_t id = first_node; id < end_node; id++) {
+		const struct devicetree_index_node *node = &index->nodes[id];
+		const void *name;
+		size_t name_size;
+		bool found = index_node_name(index, export, name_id, id, &name, &name_size);
+		print_node(out, node->depth, (found ? name : NULL), name_size);
+		const struct devicetree_index_property *prop =
+			&index->properties[node->first_property];
+		const struct devicetree_index_property *props_end = prop + node->n_properties;
+		for (; prop < props_end; prop++) {
+			const uint8_t *stored_type = (display_types != NULL
+					? &display_types[prop - index->properties] : NULL);
+			print_property_line(out, sb, node->depth + 1,
+					devicetree_index_property_name(index, prop),
+					devicetree_index_property_value(index, prop),
+					prop->size, stored_type);
+		}
+	}
+}
+
+// Print an indexed device tree into out, formatting chunks of it on several threads if n_threads
+// is not 1. If export is not NULL, the index is the export's.
+static void
+devicetree_print_index(const struct devicetree_index *index,
+		const struct devicetree_export *export, unsigned n_threads,
+		struct output_sink *out) {
+	if (n_threads == 1) {
+		struct strbuf sb;
+		strbuf_alloc(&sb, print_verbose ? -1 : 64);
+		print_index_nodes(out, &sb, index, export, 0, index->n_nodes);
+		strbuf_free(&sb);
+		return;
+	}
+	devicetree_parallel_map_callback_t format_chunk =
+			^void *(const struct devicetree_index *index,
+					uint32_t first_node, uint32_t end_node) {
+		struct output_sink *chunk = malloc(sizeof(*chunk));
+		assert(chunk != NULL);
+		output_sink_init_memory(chunk);
+		struct strbuf sb;
+		strbuf_alloc(&sb, print_verbose ? -1 : 64);
+		print_index_nodes(chunk, &sb, index, export, first_node, end_node);
+		strbuf_free(&sb);
+		return chunk;
+	};
+	devicetree_parallel_result_callback_t write_chunk =
+			^(uint32_t first_node, uint32_t end_node, void *result) {
+		struct output_sink *chunk = result;
+		output_sink_write(out, chunk->buffer, chunk->size);
+		output_sink_close(chunk);
+		free(chunk);
+	};
+	devicetree_parallel_map(index, n_threads, format_chunk, write_chunk);
+}
+
+// Print the device tree into out by formatting chunks of it on several threads.
+static bool
+devicetree_print_parallel(const void *data, size_t size, unsigned n_threads,
+		struct output_sink *out) {
+	struct devicetree_index index;
+	bool ok = devicetree_index_build(data, size, &index);
+	if (!ok) {
+		// Let the sequential printer print everything up to the error.
+		return devicetree_print(data, size, out);
+	}
+	devicetree_print_index(&index, NULL, n_threads, out);
+	ok = (index.nodes[0].end == size);
+	devicetree_index_free(&index);
+	return ok;
+}
+
+// ---- JSON output -------------------------------------------------------------------------------
+
+// How many bytes to encode at a time, so that the worst-case output fits in one reservation from
+// the output sink.
+#define JSON_ENCODE_STEP	0x1000
+
+// The names of the display types in JSON output.
+static const char *
+json_type_name(enum display_type type) {
+	switch (type) {
+		case DISP_HEX_INT:        return "hex-int";
+		case DISP_DEC_INT:        return "dec-int";
+		case DISP_STRING:         return "string";
+		case DISP_HEX_STRING:     return "hex-string";
+		case DISP_FUNCTION_PROP:  return "function";
+		case DISP_PHYS_RANGES:    return "phys-ranges";
+		case DISP_SEGMENT_RANGES: return "segment-ranges";
+		default:                  return "bytes";
+	}
+}
+
+// Write a JSON string, escaping it a step at a time straight into the output buffer.
+static void
+json_print_string(struct output_sink *out, const void *data, size_t size) {
+	const uint8_t *bytes = data;
+	output_sink_write(out, "\"", 1);
+	for (size_t offset = 0; offset < size; offset += JSON_ENCODE_STEP) {
+		size_t step = (size - offset < JSON_ENCODE_STEP ? size - offset : JSON_ENCODE_STEP);
+		char *start = output_sink_reserve(out, 6 * step);
+		char *end = json_escape_string_impl(start, bytes + offset, step);
+		output_sink_commit(out, end - start);
+	}
+	output_sink_write(out, "\"", 1);
+}
+
+static void
+json_print_hex(struct output_sink *out, const void *data, size_t size) {
+	const uint8_t *bytes = data;
+	output_sink_write(out, "\"", 1);
+	for (size_t offset = 0; offset < size; offset += JSON_ENCODE_STEP) {
+		size_t step = (size - offset < JSON_ENCODE_STEP ? size - offset : JSON_ENCODE_STEP);
+		hex_encode_impl(output_sink_reserve(out, 2 * step), bytes + offset, step);
+		output_sink_commit(out, 2 * step);
+	}
+	output_sink_write(out, "\"", 1);
+}
+
+static const char base64_digits[] =
+	"ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+static void
+json_print_base64(struct output_sink *out, const void *data, size_t size) {
+	const uint8_t *bytes = data;
+	output_sink_write(out, "\"", 1);
+	// Steps are a multiple of 3 bytes, so only the last one needs padding.
+	const size_t base64_step = 3 * (JSON_ENCODE_STEP / 3);
+	for (size_t offset = 0; offset < size; offset += base64_step) {
+		size_t step = (size - offset < base64_step ? size - offset : base64_step);
+		const uint8_t *p = bytes + offset;
+		const uint8_t *end = p + step;
+		char *start = output_sink_reserve(out, 4 * ((step + 2) / 3));
+		char *q = start;
+		for (; end - p >= 3; p += 3, q += 4) {
+			uint32_t group = ((uint32_t)p[0] << 16) | ((uint32_t)p[1] << 8) | p[2];
+			q[0] = base64_digits[(group >> 18) & 0x3f];
+			q[1] = base64_digits[(group >> 12) & 0x3f];
+			q[2] = base64_digits[(group >> 6) & 0x3f];
+			q[3] = base64_digits[group & 0x3f];
+		}
+		if (p < end) {
+			uint32_t group = (uint32_t)p[0] << 16;
+			if (end - p == 2) {
+				group |= (uint32_t)p[1] << 8;
+			}
+			q[0] = base64_digits[(group >> 18) & 0x3f];
+			q[1] = base64_digits[(group >> 12) & 0x3f];
+			q[2] = (end - p == 2 ? base64_digits[(group >> 6) & 0x3f] : '=');
+			q[3] = '=';
+			q += 4;
+		}
+		output_sink_commit(out, q - start);
+	}
+	output_sink_write(out, "\"", 1);
+}
+
+// Write the decoded value of a property of the given display type.
+static void
+json_print_value(struct output_sink *out, enum display_type type, const void *value,
+		size_t size) {
+	switch (type) {
+		case DISP_HEX_INT:
+			print_decimal(out, read_uint(value, size));
+			break;
+		case DISP_DEC_INT: {
+			// Like the text format, values of unusual sizes read as -1.
+			int64_t number = read_uint(value, size);
+			if (number < 0) {
+				output_sink_write(out, "-", 1);
+			}
+			print_decimal(out, (number < 0 ? -(uint64_t)number : (uint64_t)number));
+			break;
+		}
+		case DISP_STRING:
+			json_print_string(out, value, strnlen(value, size));
+			break;
+		case DISP_FUNCTION_PROP: {
+			// The phandle, the function name as a little-endian 32-bit integer, and the
+			// arguments; see devicetree_resolve_function().
+			const uint32_t *words = value;
+			const uint8_t *function = (const uint8_t *)(words + 1);
+			char name[4] = { function[3], function[2], function[1], function[0] };
+			output_sink_write(out, "{\"phandle\":", 11);
+			print_decimal(out, words[0]);
+			output_sink_write(out, ",\"function\":", 12);
+			json_print_string(out, name, sizeof(name));
+			output_sink_write(out, ",\"args\":[", 9);
+			for (size_t i = 2; i < size / sizeof(*words); i++) {
+				if (i > 2) {
+					output_sink_write(out, ",", 1);
+				}
+				print_decimal(out, words[i]);
+			}
+			output_sink_write(out, "]}", 2);
+			break;
+		}
+		case DISP_PHYS_RANGES: {
+			const struct phys_range *range = value;
+			size_t count = size / sizeof(*range);
+			output_sink_write(out, "[", 1);
+			for (size_t i = 0; i < count; i++) {
+				output_sink_write(out, (i > 0 ? ",{" : "{"), (i > 0 ? 2 : 1));
+				output_sink_write(out, "\"phys\":", 7);
+				print_decimal(out, range[i].phys);
+				output_sink_write(out, ",\"size\":", 8);
+				print_decimal(out, range[i].size);
+				output_sink_write(out, "}", 1);
+			}
+			output_sink_write(out, "]", 1);
+			break;
+		}
+		case DISP_SEGMENT_RANGES: {
+			const struct segment_range *range = value;
+			size_t count = size / sizeof(*range);
+			output_sink_write(out, "[", 1);
+			for (size_t i = 0; i < count; i++) {
+				output_sink_write(out, (i > 0 ? ",{" : "{"), (i > 0 ? 2 : 1));
+				output_sink_write(out, "\"phys\":", 7);
+				print_decimal(out, range[i].phys);
+				output_sink_write(out, ",\"virt\":", 8);
+				print_decimal(out, range[i].virt);
+				output_sink_write(out, ",\"remap\":", 9);
+				print_decimal(out, range[i].remap);
+				output_sink_write(out, ",\"size\":", 8);
+				print_decimal(out, range[i].size);
+				output_sink_write(out, ",\"flags\":", 9);
+				print_decimal(out, range[i].flags);
+				output_sink_write(out, "}", 1);
+			}
+			output_sink_write(out, "]", 1);
+			break;
+		}
+		default: // DISP_HEX_STRING
+			json_print_string(out, value, size);
+			break;
+	}
+}
+
+// Write a property as a JSON object with its name, size, display type, decoded value (except for
+// plain bytes), and raw bytes.
+static void
+json_print_property(struct output_sink *out, const char *name, const void *value, size_t size,
+		enum display_type type) {
+	output_sink_write(out, "{\"name\":", 8);
+	json_print_string(out, name, strlen(name));
+	output_sink_write(out, ",\"size\":", 8);
+	print_decimal(out, size);
+	output_sink_write(out, ",\"type\":\"", 9);
+	output_sink_write_string(out, json_type_name(type));
+	output_sink_write(out, "\"", 1);
+	if (size > 0 && type != DISP_HEX_DUMP) {
+		output_sink_write(out, ",\"value\":", 9);
+		json_print_value(out, type, value, size);
+	}
+	if (json_base64) {
+		output_sink_write(out, ",\"base64\":", 10);
+		json_print_base64(out, value, size);
+	} else {
+		output_sink_write(out, ",\"hex\":", 7);
+		json_print_hex(out, value, size);
+	}
+	output_sink_write(out, "}", 1);
+}
+
+// The state of devicetree_print_json() between callbacks.
+struct json_writer {
+	struct output_sink *out;
+	// has_children[d] is set once the open node at depth d has started its array of children.
+	bool has_children[DEVICETREE_DEFAULT_MAX_DEPTH + 1];
+	// The depth of the deepest open node, or -1 before the root.
+	int open_depth;
+	bool first_property;
+	// The display type of each property in tree order, or NULL to classify the values.
+	const uint8_t *display_types;
+	size_t n_properties;
+};
+
+static void
+json_close_node(struct json_writer *json) {
+	if (json->has_children[json->open_depth]) {
+		output_sink_write(json->out, "]}", 2);
+	} else {
+		output_sink_write(json->out, "],\"children\":[]}", 16);
+	}
+	json->open_depth--;
+}
+
+static void
+json_open_node(struct json_writer *json, unsigned depth, const char *name, size_t name_size) {
+	struct output_sink *out = json->out;
+	while (json->open_depth >= (int)depth) {
+		json_close_node(json);
+	}
+	if (json->open_depth >= 0) {
+		if (json->has_children[json->open_depth]) {
+			output_sink_write(out, ",\n", 2);
+		} else {
+			output_sink_write(out, "],\"children\":[\n", 15);
+			json->has_children[json->open_depth] = true;
+		}
+	}
+	output_sink_write(out, "{\"name\":", 8);
+	if (name != NULL) {
+		json_print_string(out, name, strnlen(name, name_size));
+	} else {
+		output_sink_write(out, "null", 4);
+	}
+	output_sink_write(out, ",\"properties\":[", 15);
+	json->has_children[depth] = false;
+	json->open_depth = depth;
+	json->first_property = true;
+}
+
+// Write the device tree as one JSON object per node, with its name, an array of properties and
+// an array of child nodes. Objects are written as the tree is parsed, so the document is never
+// held in memory. Each node and property goes on its own line. If display_types is not NULL, it
+// gives the display type of each property in tree order.
+static bool
+devicetree_print_json(const void *data, size_t size, const uint8_t *display_types,
+		struct output_sink *out) {
+	struct json_writer writer = {
+		.out = out,
+		.open_depth = -1,
+		.display_types = display_types,
+	};
+	struct json_writer *json = &writer;
+	devicetree_iterate_named_node_callback_t node_cb =
+			^(unsigned depth, const void *node, size_t size,
+					unsigned n_properties, unsigned n_children,
+					const char *name, size_t name_size,
+					const char *compatible, size_t compatible_size,
+					bool *skip_children, bool *stop) {
+		json_open_node(json, depth, name, name_size);
+	};
+	devicetree_iterate_property_callback_t property_cb =
+			^(unsigned depth, const char *name,
+					const void *value, size_t size, bool *stop) {
+		if (json->first_property) {
+			output_sink_write(out, "\n", 1);
+		} else {
+			output_sink_write(out, ",\n", 2);
+		}
+		json->first_property = false;
+		enum display_type type = (json->display_types != NULL
+				? json->display_types[json->n_properties]
+				: compute_display_type(name, value, size, SIZE_MAX));
+		json->n_properties++;
+		json_print_property(out, name, value, size, type);
+	};
+	const void *processed = data;
+	bool ok = devicetree_iterate_named(&processed, size, node_cb, property_cb);
+	// Close whatever is still open, even after an error, so that the document is well formed.
+	while (json->open_depth >= 0) {
+		json_close_node(json);
+	}
+	output_sink_write(out, "\n", 1);
+	return (ok && (processed == (uint8_t *)data + size));
+}
+
+// ---- DeviceTree hashing ------------------------------------------------------------------------
+
+static void
+print_hash(struct output_sink *out, struct devicetree_hash hash) {
+	output_sink_printf(out, "%016llx%016llx  ", hash.hi, hash.lo);
+}
+
+// Print the subtree hash of every node followed by its path, and with -v the hash of every
+// property too.
+static bool
+devicetree_print_hashes(const void *data, size_t size, struct output_sink *out) {
+	struct devicetree_index index;
+	bool ok = devicetree_index_build(data, size, &index);
+	if (!ok) {
+		return false;
+	}
+	struct devicetree_hashes hashes;
+	devicetree_hashes_compute(&index, &hashes);
+	// path_lengths[d] is the length of the path of the open node at depth d.
+	size_t path_lengths[DEVICETREE_DEFAULT_MAX_DEPTH + 1];
+	struct strbuf path;
+	strbuf_alloc(&path, -1);
+	for (uint32_t id = 0; id < index.n_nodes; id++) {
+		const struct devicetree_index_node *node = &index.nodes[id];
+		path.pos = 0;
+		if (node->depth > 0) {
+			const void *name = "";
+			size_t name_size = 0;
+			devicetree_node_find_property(index.data + node->offset,
+					index.size - node->offset, "name", &name, &name_size);
+			path.pos = path_lengths[node->depth - 1];
+			strbuf_printf(&path, "/%.*s", (int)strnlen(name, name_size), name);
+		}
+		path_lengths[node->depth] = path.pos;
+		print_hash(out, hashes.nodes[id]);
+		output_sink_printf(out, "%s\n", (node->depth > 0 ? path.str : "/"));
+		if (print_verbose) {
+			for (uint32_t i = 0; i < node->n_properties; i++) {
+				uint32_t prop = node->first_property + i;
+				print_hash(out, hashes.properties[prop]);
+				output_sink_printf(out, "%s:%s\n",
+						(node->depth > 0 ? path.str : "/"),
+						devicetree_index_property_name(&index,
+							&index.properties[prop]));
+			}
+		}
+	}
+	ok = (index.nodes[0].end == size);
+	strbuf_free(&path);
+	devicetree_hashes_free(&hashes);
+	devicetree_index_free(&index);
+	return ok;
+}
+
+// ---- DeviceTree queries ------------------------------------------------------------------------
+
+// Compile the -q queries into queries. On failure, an error is printed and false is returned.
+static bool
+compile_queries(void) {
+	queries = malloc(n_query_texts * sizeof(*queries));
+	assert(queries != NULL);
+	for (size_t i = 0; i < n_query_texts; i++) {
+		size_t error_offset;
+		queries[i] = devicetree_query_compile(query_texts[i], &error_offset);
+		if (queries[i] == NULL) {
+			fprintf(stderr, "invalid query at offset %zu: %s\n", error_offset,
+					query_texts[i]);
+			return false;
+		}
+	}
+	return true;
+}
+
+// Print the matches of all queries, in tree order: the path of each matching node, or a property
+// line for each matching property.
+static bool
+devicetree_print_queries(const struct devicetree_query *const *queries, size_t n_queries,
+		const void *data, size_t size, struct output_sink *out) {
+	__block struct strbuf sb;
+	strbuf_alloc(&sb, print_verbose ? -1 : 64);
+	devicetree_query_callback_t print_match =
+			^(size_t query, const char *path, const void *node, size_t size,
+					const char *property, const void *value, size_t value_size,
+					bool *stop) {
+		output_sink_write_string(out, path);
+		if (property == NULL) {
+			output_sink_write(out, "\n", 1);
+		} else {
+			output_sink_write(out, ":", 1);
+			output_sink_write_string(out, property);
+			print_size_and_value(out, &sb, property, value, value_size, NULL);
+		}
+	};
+	bool ok = devicetree_query_run(queries, n_queries, data, size, print_match);
+	strbuf_free(&sb);
+	return ok;
+}
+
+// ---- DeviceTree diffing -------------------------------------------------------------------------
+
+static const char *
+diff_kind_name(enum devicetree_diff_kind kind) {
+	switch (kind) {
+		case DEVICETREE_DIFF_NODE_ADDED:       return "node-added";
+		case DEVICETREE_DIFF_NODE_REMOVED:     return "node-removed";
+		case DEVICETREE_DIFF_PROPERTY_ADDED:   return "property-added";
+		case DEVICETREE_DIFF_PROPERTY_REMOVED: return "property-removed";
+		default:                               return "property-changed";
+	}
+}
+
+// Print one side of a property difference, like a property line of the tree printer.
+static void
+print_diff_property(struct output_sink *out, struct strbuf *sb, char sign, const char *path,
+		const struct devicetree_index *index, uint32_t property) {
+	const struct devicetree_index_property *prop = &index->properties[property];
+	const char *name = devicetree_index_property_name(index, prop);
+	const void *value = devicetree_index_property_value(index, prop);
+	output_sink_printf(out, "%c %s:%s", sign, path, name);
+	print_size_and_value(out, sb, name, value, prop->size, NULL);
+}
+
+// Print the differences between two device trees, either as text or, if machine_readable is
+// set, as one tab-separated record per difference.
+static bool
+devicetree_print_diff(const void *old_data, size_t old_size, const void *new_data,
+		size_t new_size, bool machine_readable, struct output_sink *out) {
+	struct devicetree_index old_index;
+	struct devicetree_index new_index;
+	bool ok = devicetree_index_build(old_data, old_size, &old_index);
+	if (!ok) {
+		return false;
+	}
+	ok = devicetree_index_build(new_data, new_size, &new_index);
+	if (!ok) {
+		devicetree_index_free(&old_index);
+		return false;
+	}
+	struct devicetree_hashes old_hashes;
+	struct devicetree_hashes new_hashes;
+	devicetree_hashes_compute(&old_index, &old_hashes);
+	devicetree_hashes_compute(&new_index, &new_hashes);
+	__block struct strbuf sb;
+	strbuf_alloc(&sb, print_verbose ? -1 : 64);
+	devicetree_diff_callback_t print_difference =
+			^(const struct devicetree_diff_entry *entry, bool *stop) {
+		if (machine_readable) {
+			// Offsets are of the node header, or of the property value.
+			const char *property = "";
+			uint32_t old_offset = DEVICETREE_INDEX_NONE;
+			uint32_t new_offset = DEVICETREE_INDEX_NONE;
+			if (entry->kind == DEVICETREE_DIFF_NODE_ADDED) {
+				new_offset = new_index.nodes[entry->new_node].offset;
+			} else if (entry->kind == DEVICETREE_DIFF_NODE_REMOVED) {
+				old_offset = old_index.nodes[entry->old_node].offset;
+			} else {
+				if (entry->old_property != DEVICETREE_INDEX_NONE) {
+					const struct devicetree_index_property *prop =
+						&old_index.properties[entry->old_property];
+					property = devicetree_index_property_name(&old_index, prop);
+					old_offset = prop->value_offset;
+				}
+				if (entry->new_property != DEVICETREE_INDEX_NONE) {
+					const struct devicetree_index_property *prop =
+						&new_index.properties[entry->new_property];
+					property = devicetree_index_property_name(&new_index, prop);
+					new_offset = prop->value_offset;
+				}
+			}
+			output_sink_printf(out, "%s\t%s\t%s\t", diff_kind_name(entry->kind),
+					entry->path, property);
+			output_sink_printf(out,
+					(old_offset == DEVICETREE_INDEX_NONE ? "-\t" : "0x%x\t"),
+					old_offset);
+			output_sink_printf(out,
+					(new_offset == DEVICETREE_INDEX_NONE ? "-\n" : "0x%x\n"),
+					new_offset);
+		} else if (entry->kind == DEVICETREE_DIFF_NODE_ADDED) {
+			output_sink_printf(out, "+ %s\n", entry->path);
+		} else if (entry->kind == DEVICETREE_DIFF_NODE_REMOVED) {
+			output_sink_printf(out, "- %s\n", entry->path);
+		} else {
+			if (entry->old_property != DEVICETREE_INDEX_NONE) {
+				print_diff_property(out, &sb, '-', entry->path,
+						&old_index, entry->old_property);
+			}
+			if (entry->new_property != DEVICETREE_INDEX_NONE) {
+				print_diff_property(out, &sb, '+', entry->path,
+						&new_index, entry->new_property);
+			}
+		}
+	};
+	devicetree_diff(&old_index, &old_hashes, &new_index, &new_hashes, print_difference);
+	ok = (old_index.nodes[0].end == old_size && new_index.nodes[0].end == new_size);
+	strbuf_free(&sb);
+	devicetree_hashes_free(&old_hashes);
+	devicetree_hashes_free(&new_hashes);
+	devicetree_index_free(&old_index);
+	devicetree_index_free(&new_index);
+	return ok;
+}
+
+// ---- devicetree-parse tool ---------------------------------------------------------------------
+
+// Check that an export only holds display types that this tool knows how to print. The loader
+// leaves the display types to whoever wrote them.
+static bool
+export_display_types_ok(const struct devicetree_export *export) {
+	for (size_t i = 0; i < export->index.n_properties; i++) {
+		if (export->display_types[i] > DISP_SEGMENT_RANGES) {
+			return false;
+		}
+	}
+	return true;
+}
+
+// Find the devicetree in an input file that has been read. If the file is an IM4P or IMG4 file,
+// data points to its payload inside the file. If the file is an export, data points to the
+// devicetree stored in it and, if export is not NULL, the export is loaded into it; otherwise
+// export is cleared. Either way, the export must be released with devicetree_close_index(). On
+// failure, the file is closed.
+static bool
+find_devicetree(const char *path, struct input_file *file, struct devicetree_export *export,
+		const void **data, size_t *size) {
+	bool ok;
+	*data = file->data;
+	*size = file->size;
+	if (export != NULL) {
+		memset(export, 0, sizeof(*export));
+	}
+	if (devicetree_export_detect(file->data, file->size)) {
+		struct devicetree_export loaded;
+		ok = devicetree_export_load(file->data, file->size, &loaded)
+			&& export_display_types_ok(&loaded);
+		if (!ok) {
+			fprintf(stderr, "%s: invalid export\n", path);
+			input_file_close(file);
+			return false;
+		}
+		*data = loaded.index.data;
+		*size = loaded.index.size;
+		if (export != NULL) {
+			*export = loaded;
+		}
+		return true;
+	}
+	char type[5];
+	enum img4_status status = img4_find_payload(file->data, file->size, data, size, type);
+	if (status == IMG4_NOT_WRAPPED) {
+		return true;
+	}
+	if (status == IMG4_OK) {
+		if (strcmp(type, "dtre") == 0) {
+			return true;
+		}
+		fprintf(stderr, "%s: the IMG4 payload has type \"%s\", not \"dtre\"\n",
+				path, type);
+	} else {
+		fprintf(stderr, "%s: %s\n", path, img4_status_description(status));
+	}
+	input_file_close(file);
+	return false;
+}
+
+// Read an input file and find the devicetree in it, as for find_devicetree().
+static bool
+open_file(const char *path, struct input_file *file, struct devicetree_export *export,
+		const void **data, size_t *size) {
+	bool ok = input_file_open(path, input_backend, input_flags, file);
+	if (!ok) {
+		return false;
+	}
+	return find_devicetree(path, file, export, data, size);
+}
+
+// Write an export of the devicetree, with the display type of every property, to a new file. If
+// the input is itself an export, its tables are written out again without parsing the tree.
+// Returns the tool's exit status.
+static int
+export_devicetree(const void *data, size_t size, struct devicetree_export *input,
+		const char *path) {
+	struct devicetree_index built;
+	const struct devicetree_index *index = &input->index;
+	const uint8_t *display_types = input->display_types;
+	uint8_t *computed_types = NULL;
+	if (index->nodes == NULL) {
+		bool ok = devicetree_index_build(data, size, &built);
+		if (!ok || built.nodes[0].end != size) {
+			fprintf(stderr, "invalid devicetree\n");
+			if (ok) {
+				devicetree_index_free(&built);
+			}
+			return 3;
+		}
+		index = &built;
+		computed_types = malloc(index->n_properties + 1);
+		assert(computed_types != NULL);
+		for (size_t i = 0; i < index->n_properties; i++) {
+			const struct devicetree_index_property *prop = &index->properties[i];
+			computed_types[i] = compute_display_type(
+					devicetree_index_property_name(index, prop),
+					devicetree_index_property_value(index, prop),
+					prop->size, SIZE_MAX);
+		}
+		display_types = computed_types;
+	}
+	int status = 0;
+	int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	if (fd < 0) {
+		perror("open");
+		status = 2;
+	} else {
+		bool ok = devicetree_export_write(index, display_types, fd);
+		if (close(fd) != 0) {
+			ok = false;
+		}
+		if (!ok) {
+			perror("write");
+			status = 2;
+		}
+	}
+	if (index == &built) {
+		devicetree_index_free(&built);
+	}
+	free(computed_types);
+	return status;
+}
+
+static bool
+check_devicetree(const char *file, const void *data, size_t size, struct output_sink *out) {
+	struct devicetree_validate_stats stats;
+	bool ok = devicetree_validate(data, size, &stats);
+	if (ok) {
+		output_sink_printf(out, "%s: ok: %zu nodes, %zu properties, depth %u\n", file,
+				stats.n_nodes, stats.n_properties, stats.max_depth);
+	} else {
+		output_sink_printf(out, "%s: invalid devicetree at offset 0x%zx\n", file,
+				stats.error_offset);
+	}
+	return ok;
+}
+
+// Check, print or export a devicetree that open_file() has read, in the mode chosen by the
+// options. Output goes to out, and the tree is formatted on n_threads threads (one per CPU if 0).
+// Returns the tool's exit status for the file.
+static int
+process_devicetree(const char *file, const void *data, size_t size,
+		struct devicetree_export *export, unsigned n_threads, struct output_sink *out) {
+	if (export_path != NULL) {
+		return export_devicetree(data, size, export, export_path);
+	}
+	bool ok = true;
+	if (check_only) {
+		ok = check_devicetree(file, data, size, out);
+	} else if (print_hashes) {
+		ok = devicetree_print_hashes(data, size, out);
+	} else if (n_query_texts > 0) {
+		ok = devicetree_print_queries((const struct devicetree_query *const *)queries,
+				n_query_texts, data, size, out);
+	} else if (json_output) {
+		ok = devicetree_print_json(data, size, export->display_types, out);
+	} else if (export->index.nodes != NULL) {
+		// An export is already indexed and classified, so print straight from its tables.
+		devicetree_print_index(&export->index, export, n_threads, out);
+	} else if (n_threads != 1) {
+		ok = devicetree_print_parallel(data, size, n_threads, out);
+	} else {
+		ok = devicetree_print(data, size, out);
+	}
+	return (!ok ? 3 : 0);
+}
+
+// Read and process one file of a batch into out. Each file is formatted on a single thread, since
+// the batch already keeps every thread busy. Returns the tool's exit status for the file.
+static int
+process_file(const char *file, struct output_sink *out, size_t *size) {
+	struct input_file input;
+	*size = 0;
+	struct devicetree_export export;
+	const void *data;
+	bool ok = open_file(file, &input, &export, &data, size);
+	if (!ok) {
+		return 2;
+	}
+	int status = process_devicetree(file, data, *size, &export, 1, out);
+	devicetree_close_index(&export);
+	input_file_close(&input);
+	return status;
+}
+
+// How much of a stream to look at before deciding whether it holds a raw devicetree. This covers
+// the export header and the start of an IMG4 file.
+#define STREAM_HEAD_SIZE	0x100
+
+// How much of a stream to read at a time.
+#define STREAM_CHUNK_SIZE	0x10000
+
+// Print a stream input, like a pipe, with the default printer. A raw devicetree is printed as it
+// is read, without ever holding all of it in memory. An export or an IMG4 file can only be used
+// as a whole, so it is read to the end and printed like any other file. Returns the tool's exit
+// status.
+static int
+print_stream(const char *path, struct output_sink *out) {
+	__block struct input_stream stream;
+	if (!input_stream_open(path, &stream)) {
+		return 2;
+	}
+	uint8_t *buffer = malloc(STREAM_CHUNK_SIZE);
+	assert(buffer != NULL);
+	size_t size = 0;
+	ssize_t count = 1;
+	while (size < STREAM_HEAD_SIZE && count > 0) {
+		count = input_stream_read(&stream, buffer + size, STREAM_CHUNK_SIZE - size);
+		size += (count > 0 ? count : 0);
+	}
+	int status = 2;
+	const void *payload;
+	size_t payload_size;
+	char type[5];
+	bool raw = (size >= STREAM_HEAD_SIZE && !devicetree_export_detect(buffer, size)
+			&& img4_find_payload(buffer, size, &payload, &payload_size, type)
+				== IMG4_NOT_WRAPPED);
+	if (count < 0) {
+		// The error has been printed.
+	} else if (raw) {
+		__block size_t head_size = size;
+		__block bool read_error = false;
+		bool (^next_chunk)(const void **, size_t *) =
+				^bool (const void **chunk, size_t *chunk_size) {
+			ssize_t chunk_count = head_size;
+			head_size = 0;
+			if (chunk_count == 0) {
+				chunk_count = input_stream_read(&stream, buffer, STREAM_CHUNK_SIZE);
+			}
+			read_error |= (chunk_count < 0);
+			*chunk = buffer;
+			*chunk_size = (chunk_count > 0 ? chunk_count : 0);
+			return (chunk_count > 0);
+		};
+		bool ok = devicetree_print_stream(out, next_chunk);
+		status = (read_error ? 2 : !ok ? 3 : 0);
+	} else {
+		struct input_file input;
+		struct devicetree_export export;
+		const void *data;
+		size_t data_size;
+		bool ok = input_stream_read_all(&stream, buffer, size, &input)
+			&& find_devicetree(path, &input, &export, &data, &data_size);
+		if (ok) {
+			status = process_devicetree(path, data, data_size, &export, 1, out);
+			devicetree_close_index(&export);
+			input_file_close(&input);
+		}
+	}
+	free(buffer);
+	input_stream_close(&stream);
+	return status;
+}
+
+// ---- Batch mode --------------------------------------------------------------------------------
+
+static int
+compare_strings(const void *a, const void *b) {
+	return strcmp(*(const char **)a, *(const char **)b);
+}
+
+static void
+file_list_add(char ***files, size_t *n_files, size_t *capacity, char *file) {
+	if (*n_files == *capacity) {
+		*capacity = (*capacity == 0 ? 64 : 2 * *capacity);
+		*files = realloc(*files, *capacity * sizeof(**files));
+		assert(*files != NULL);
+	}
+	(*files)[(*n_files)++] = file;
+}
+
+// Collect the files to process: the regular files in a directory, sorted by name, or the paths
+// listed one per line in a file.
+static bool
+batch_list_files(const char *source, char ***files, size_t *n_files) {
+	size_t capacity = 0;
+	*files = NULL;
+	*n_files = 0;
+	DIR *dir = opendir(source);
+	if (dir != NULL) {
+		struct dirent *entry;
+		while ((entry = readdir(dir)) != NULL) {
+			if (entry->d_name[0] == '.') {
+				continue;
+			}
+			char *path;
+			asprintf(&path, "%s/%s", source, entry->d_name);
+			assert(path != NULL);
+			struct stat st;
+			if (stat(path, &st) != 0 || !S_ISREG(st.st_mode)) {
+				free(path);
+				continue;
+			}
+			file_list_add(files, n_files, &capacity, path);
+		}
+		closedir(dir);
+		if (*n_files > 0) {
+			qsort(*files, *n_files, sizeof(**files), compare_strings);
+		}
+		return true;
+	}
+	FILE *list = fopen(source, "r");
+	if (list == NULL) {
+		perror("open");
+		return false;
+	}
+	char *line = NULL;
+	size_t line_capacity = 0;
+	ssize_t length;
+	while ((length = getline(&line, &line_capacity, list)) >= 0) {
+		while (length > 0 && (line[length - 1] == '\n' || line[length - 1] == '\r')) {
+			line[--length] = 0;
+		}
+		if (length > 0) {
+			file_list_add(files, n_files, &capacity, strdup(line));
+		}
+	}
+	free(line);
+	fclose(list);
+	return true;
+}
+
+// Get the final component of a path, which names the input's output file with -o.
+static const char *
+path_basename(const char *path) {
+	const char *name = strrchr(path, '/');
+	return (name != NULL ? name + 1 : path);
+}
+
+// Make sure that no two inputs would write the same file in the output directory. Inputs from a
+// directory always have distinct names, but a file list may name the same file name twice.
+static bool
+batch_check_output_names(char **files, size_t n_files) {
+	const char **names = malloc(n_files * sizeof(*names) + 1);
+	assert(names != NULL);
+	for (size_t i = 0; i < n_files; i++) {
+		names[i] = path_basename(files[i]);
+	}
+	qsort(names, n_files, sizeof(*names), compare_strings);
+	bool ok = true;
+	for (size_t i = 1; i < n_files; i++) {
+		if (strcmp(names[i - 1], names[i]) == 0) {
+			fprintf(stderr, "more than one input is named \"%s\"; their outputs would "
+					"overwrite each other\n", names[i]);
+			ok = false;
+			break;
+		}
+	}
+	free(names);
+	return ok;
+}
+
+static double
+current_time() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// When merging output, how many files per thread may be finished and waiting for the files before
+// them to be written.
+#define BATCH_WINDOW_PER_THREAD	4
+
+// Process many files on a pool of threads. The output is either merged on stdout in the order of
+// the file list, or written to one file per input in output_dir.
+//
+// Merged output has to be held until every earlier file is written, so in that case the files are
+// handed out in list order and only a few may finish ahead of the output. Otherwise, the files
+// are spread over a work-stealing pool.
+static int
+batch_process(const char *source, const char *output_dir) {
+	char **files;
+	size_t n_files;
+	bool ok = batch_list_files(source, &files, &n_files);
+	if (!ok) {
+		return 2;
+	}
+	if (output_dir != NULL && !batch_check_output_names(files, n_files)) {
+		for (size_t i = 0; i < n_files; i++) {
+			free(files[i]);
+		}
+		free(files);
+		return 2;
+	}
+	unsigned n_threads = print_threads;
+	if (n_threads == 0) {
+		long n_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		n_threads = (n_cpus > 0 ? n_cpus : 1);
+	}
+	// The next file a worker will get is the next one in its range, or, when the files are
+	// handed out in order, the one n_threads later.
+	size_t prefetch_distance = (output_dir == NULL ? n_threads : 1);
+	struct batch_result {
+		struct output_sink out;
+		size_t size;
+		int status;
+	};
+	struct batch_result *results = calloc(n_files, sizeof(*results));
+	assert(results != NULL || n_files == 0);
+	__block struct output_sink out;
+	output_sink_init_fd(&out, STDOUT_FILENO);
+	__block int status = 0;
+	__block size_t total_size = 0;
+	double start = current_time();
+	work_pool_task_callback_t process_task = ^(size_t task) {
+		struct batch_result *result = &results[task];
+		// Get the kernel reading this worker's next file while we parse this one.
+		if (task + prefetch_distance < n_files) {
+			input_file_prefetch(files[task + prefetch_distance]);
+		}
+		if (output_dir == NULL) {
+			output_sink_init_memory(&result->out);
+		} else {
+			char *path;
+			asprintf(&path, "%s/%s.txt", output_dir, path_basename(files[task]));
+			assert(path != NULL);
+			bool ok = output_sink_open_file(&result->out, path);
+			free(path);
+			if (!ok) {
+				perror("open");
+				result->status = 2;
+				return;
+			}
+		}
+		result->status = process_file(files[task], &result->out, &result->size);
+		if (output_dir != NULL && !output_sink_close(&result->out)) {
+			perror("write");
+			result->status = 2;
+		}
+	};
+	work_pool_done_callback_t task_done = ^(size_t task) {
+		struct batch_result *result = &results[task];
+		if (output_dir == NULL) {
+			output_sink_printf(&out, "%s==> %s <==\n", (task > 0 ? "\n" : ""),
+					files[task]);
+			output_sink_write(&out, result->out.buffer, result->out.size);
+			output_sink_close(&result->out);
+		}
+		total_size += result->size;
+		if (result->status > status) {
+			status = result->status;
+		}
+		free(files[task]);
+	};
+	if (output_dir == NULL) {
+		work_pool_run_ordered(n_files, n_threads, BATCH_WINDOW_PER_THREAD * n_threads,
+				process_task, task_done);
+	} else {
+		work_pool_run(n_files, n_threads, process_task, task_done);
+	}
+	output_sink_close(&out);
+	double elapsed = current_time() - start;
+	double megabytes = total_size / 1e6;
+	fprintf(stderr, "%zu files, %.1f MB in %.3f s: %.1f files/s, %.1f MB/s\n",
+			n_files, megabytes, elapsed, n_files / elapsed, megabytes / elapsed);
+	free(results);
+	free(files);
+	return status;
+}
+
+int
 main(int argc, const char *argv[]) {
+	select_implementations();
 	// Parse options.
 	int argidx = 1;
 	while (argidx < argc) {
@@ -486,25 +2477,147 @@ main(int argc, const char *argv[]) {
 			print_verbose = true;
 		} else if (strcmp(arg, "-t") == 0) {
 			print_tree = true;
+		} else if (strcmp(arg, "--check") == 0) {
+			check_only = true;
+		} else if (strcmp(arg, "--hash") == 0) {
+			print_hashes = true;
+		} else if (strcmp(arg, "-j") == 0) {
+			json_output = true;
+		} else if (strcmp(arg, "--base64") == 0) {
+			json_base64 = true;
+		} else if (strcmp(arg, "--export") == 0 && argidx < argc) {
+			export_path = argv[argidx];
+			argidx++;
+		} else if (strcmp(arg, "-q") == 0 && argidx < argc) {
+			query_texts = realloc(query_texts,
+					(n_query_texts + 1) * sizeof(*query_texts));
+			assert(query_texts != NULL);
+			query_texts[n_query_texts++] = argv[argidx];
+			argidx++;
+		} else if (strcmp(arg, "--io") == 0 && argidx < argc) {
+			const char *backend = argv[argidx];
+			argidx++;
+			if (strcmp(backend, "mmap") == 0) {
+				input_backend = INPUT_BACKEND_MMAP;
+				input_flags &= ~INPUT_POPULATE;
+			} else if (strcmp(backend, "mmap-populate") == 0) {
+				input_backend = INPUT_BACKEND_MMAP;
+				input_flags |= INPUT_POPULATE;
+			} else if (strcmp(backend, "read") == 0) {
+				input_backend = INPUT_BACKEND_READ;
+			} else {
+				argidx = argc;
+				break;
+			}
+		} else if (strcmp(arg, "--diff") == 0) {
+			diff = true;
+		} else if (strcmp(arg, "-m") == 0) {
+			machine_readable = true;
+		} else if (strcmp(arg, "--batch") == 0) {
+			batch = true;
+		} else if (strcmp(arg, "-o") == 0 && argidx < argc) {
+			output_dir = argv[argidx];
+			argidx++;
+		} else if (strcmp(arg, "-p") == 0 && argidx < argc) {
+			const char *threads = argv[argidx];
+			argidx++;
+			char *end;
+			unsigned long n_threads = strtoul(threads, &end, 10);
+			if (!('0' <= threads[0] && threads[0] <= '9') || *end != 0) {
+				argidx = argc;
+				break;
+			}
+			print_parallel = true;
+			print_threads = (n_threads < MAX_THREADS ? n_threads : MAX_THREADS);
 		} else {
 			argidx--;
 			break;
 		}
 	}
 	// Parse arguments.
-	if (argidx != argc - 1) {
-		printf("usage: %s [-v] [-t] <devicetree-file>\n", getprogname());
+	if (argidx != argc - (diff ? 2 : 1)) {
+		printf("usage: %s [-v] [-t] [-p <threads>] [--check | --hash | -j | -q <query>...] "
+		       "<devicetree-file>\n"
+		       "       %s [-v] [-t] [-p <threads>] [--check | --hash | -j | -q <query>...] "
+		       "[-o <dir>] --batch <dir-or-file-list>\n"
+		       "       %s --export <export-file> <devicetree-file>\n"
+		       "       %s [-v] [-m] --diff <old-file> <new-file>\n"
+		       "Files are mapped, or read with --io read. \"-\" reads standard input.\n"
+		       "--io mmap-populate faults in each mapping up front.\n"
+		       "-j writes JSON, with raw values in hex, or in base64 with --base64.\n"
+		       "Exports can be read in place of devicetree files.\n",
+				getprogname(), getprogname(), getprogname(), getprogname());
+		return 1;
+	}
+	// An export is written to a single file, so it needs a single input.
+	if (export_path != NULL && (batch || diff)) {
+		fprintf(stderr, "--export can't be combined with --batch or --diff\n");
 		return 1;
 	}
+	// Compile the queries before reading any file, so that a bad query is reported once.
+	if (n_query_texts > 0 && !compile_queries()) {
+		return 1;
+	}
+	// In diff mode, the arguments are the old and new files.
+	if (diff) {
+		struct input_file old_input;
+		struct input_file new_input;
+		const void *old_data;
+		const void *new_data;
+		size_t old_size;
+		size_t new_size;
+		bool ok = open_file(argv[argidx], &old_input, NULL, &old_data, &old_size);
+		if (!ok) {
+			return 2;
+		}
+		ok = open_file(argv[argidx + 1], &new_input, NULL, &new_data, &new_size);
+		if (!ok) {
+			input_file_close(&old_input);
+			return 2;
+		}
+		struct output_sink out;
+		output_sink_init_fd(&out, STDOUT_FILENO);
+		if (!machine_readable) {
+			output_sink_printf(&out, "--- %s\n+++ %s\n", argv[argidx],
+					argv[argidx + 1]);
+		}
+		ok = devicetree_print_diff(old_data, old_size, new_data, new_size,
+				machine_readable, &out);
+		output_sink_close(&out);
+		input_file_close(&old_input);
+		input_file_close(&new_input);
+		return (!ok ? 3 : 0);
+	}
+	// In batch mode, the argument is the directory or file list.
+	if (batch) {
+		return batch_process(argv[argidx], output_dir);
+	}
 	const char *file = argv[argidx];
+	// The default printer prints a pipe as it arrives rather than reading all of it first.
+	bool default_printer = (export_path == NULL && !check_only && !print_hashes
+			&& n_query_texts == 0 && !json_output && !print_parallel);
+	if (default_printer && input_file_is_stream(file)) {
+		struct output_sink out;
+		output_sink_init_fd(&out, STDOUT_FILENO);
+		int status = print_stream(file, &out);
+		output_sink_close(&out);
+		return status;
+	}
 	// Read the input file.
-	void *data;
+	struct input_file input;
+	struct devicetree_export export;
+	const void *data;
 	size_t size;
-	bool ok = mmap_file(file, &data, &size);
+	bool ok = open_file(file, &input, &export, &data, &size);
 	if (!ok) {
 		return 2;
 	}
-	// Print the device tree.
-	ok = devicetree_print(data, size);
-	return (!ok ? 3 : 0);
+	struct output_sink out;
+	output_sink_init_fd(&out, STDOUT_FILENO);
+	int status = process_devicetree(file, data, size, &export,
+			(print_parallel ? print_threads : 1), &out);
+	output_sink_close(&out);
+	devicetree_close_index(&export);
+	input_file_close(&input);
+	return status;
 }
@@ -0,0 +1,176 @@
+/*
+ * output-sink.c
+ * Brandon Azad
+ */
+#include "output-sink.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+// The buffer size of sinks that write to a file descriptor.
+#define FD_BUFFER_SIZE		OUTPUT_SINK_MAX_RESERVE
+
+// The initial buffer size of memory sinks.
+#define MEMORY_BUFFER_SIZE	0x4000
+
+static void
+init_sink(struct output_sink *sink, int fd, bool owns_fd, size_t capacity) {
+	sink->buffer = malloc(capacity);
+	assert(sink->buffer != NULL);
+	sink->size = 0;
+	sink->capacity = capacity;
+	sink->fd = fd;
+	sink->owns_fd = owns_fd;
+	sink->error = false;
+}
+
+void
+output_sink_init_fd(struct output_sink *sink, int fd) {
+	init_sink(sink, fd, false, FD_BUFFER_SIZE);
+}
+
+bool
+output_sink_open_file(struct output_sink *sink, const char *path) {
+	int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	if (fd < 0) {
+		return false;
+	}
+	init_sink(sink, fd, true, FD_BUFFER_SIZE);
+	return true;
+}
+
+void
+output_sink_init_memory(struct output_sink *sink) {
+	init_sink(sink, -1, false, MEMORY_BUFFER_SIZE);
+}
+
+// Write all of the data described by iov with as few writev() calls as possible. The iov array
+// is modified to track the progress of partial writes.
+static void
+write_all(struct output_sink *sink, struct iovec *iov, int count) {
+	while (!sink->error && count > 0) {
+		ssize_t written = writev(sink->fd, iov, count);
+		if (written < 0 && errno == EINTR) {
+			continue;
+		}
+		if (written < 0) {
+			sink->error = true;
+			break;
+		}
+		while (count > 0 && (size_t)written >= iov->iov_len) {
+			written -= iov->iov_len;
+			iov++;
+			count--;
+		}
+		if (count > 0) {
+			iov->iov_base = (char *)iov->iov_base + written;
+			iov->iov_len -= written;
+		}
+	}
+}
+
+bool
+output_sink_flush(struct output_sink *sink) {
+	if (sink->fd >= 0 && sink->size > 0) {
+		struct iovec iov = { sink->buffer, sink->size };
+		write_all(sink, &iov, 1);
+		sink->size = 0;
+	}
+	return !sink->error;
+}
+
+bool
+output_sink_close(struct output_sink *sink) {
+	bool ok = output_sink_flush(sink);
+	if (sink->owns_fd && close(sink->fd) != 0) {
+		ok = false;
+	}
+	free(sink->buffer);
+	sink->buffer = NULL;
+	sink->size = sink->capacity = 0;
+	sink->fd = -1;
+	sink->owns_fd = false;
+	return ok;
+}
+
+// Make room for size more bytes in the buffer, by writing out what's buffered or by growing a
+// memory sink. Returns false if the buffer of a file descriptor sink is too small.
+static bool
+reserve(struct output_sink *sink, size_t size) {
+	if (size <= sink->capacity - sink->size) {
+		return true;
+	}
+	if (sink->fd >= 0) {
+		output_sink_flush(sink);
+		return (size <= sink->capacity);
+	}
+	size_t capacity = 2 * sink->capacity;
+	if (capacity - sink->size < size) {
+		capacity = sink->size + size;
+	}
+	char *buffer = realloc(sink->buffer, capacity);
+	assert(buffer != NULL);
+	sink->buffer = buffer;
+	sink->capacity = capacity;
+	return true;
+}
+
+char *
+output_sink_reserve(struct output_sink *sink, size_t size) {
+	bool ok = reserve(sink, size);
+	assert(ok);
+	return sink->buffer + sink->size;
+}
+
+void
+output_sink_write_slow(struct output_sink *sink, const void *data, size_t size) {
+	if (sink->fd >= 0 && size >= sink->capacity) {
+		// The data is too large to buffer, so write it out along with what's already
+		// buffered.
+		struct iovec iov[2] = {
+			{ sink->buffer, sink->size },
+			{ (void *)data, size },
+		};
+		write_all(sink, iov, 2);
+		sink->size = 0;
+		return;
+	}
+	bool ok = reserve(sink, size);
+	assert(ok);
+	memcpy(sink->buffer + sink->size, data, size);
+	sink->size += size;
+}
+
+void
+output_sink_printf(struct output_sink *sink, const char *format, ...) {
+	va_list ap, ap2;
+	va_start(ap, format);
+	va_copy(ap2, ap);
+	// Try formatting straight into the buffer first.
+	size_t room = sink->capacity - sink->size;
+	int length = vsnprintf(sink->buffer + sink->size, room, format, ap);
+	va_end(ap);
+	assert(length >= 0);
+	if ((size_t)length >= room) {
+		// Leave room for the null that vsnprintf() adds.
+		if (reserve(sink, length + 1)) {
+			room = sink->capacity - sink->size;
+			vsnprintf(sink->buffer + sink->size, room, format, ap2);
+		} else {
+			char *string;
+			vasprintf(&string, format, ap2);
+			assert(string != NULL);
+			output_sink_write_slow(sink, string, length);
+			free(string);
+			length = 0;
+		}
+	}
+	va_end(ap2);
+	sink->size += length;
+}
@@ -0,0 +1,81 @@
+/*
+ * output-sink.h
+ * Brandon Azad
+ */
+#ifndef OUTPUT_SINK__H_
+#define OUTPUT_SINK__H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+
+// A buffered destination for the tool's output: standard output, a file, or memory. Output to a
+// file descriptor is collected in one large buffer and handed to write() once the buffer fills
+// up, so formatting many short lines costs a memcpy each rather than a stdio call each.
+struct output_sink {
+	char *buffer;
+	size_t size;
+	size_t capacity;
+	// The file descriptor that the buffer is flushed to, or -1 for a memory sink, which keeps
+	// all of its output in the buffer.
+	int fd;
+	// Whether the sink opened fd and should close it.
+	bool owns_fd;
+	// Whether a write to fd failed. Once it does, further output is dropped.
+	bool error;
+};
+
+// Create a sink that writes to an open file descriptor, like STDOUT_FILENO. The descriptor is
+// not closed by output_sink_close().
+void output_sink_init_fd(struct output_sink *sink, int fd);
+
+// Create a sink that writes to a new file, replacing any existing file at the path. On failure,
+// errno is set and false is returned.
+bool output_sink_open_file(struct output_sink *sink, const char *path);
+
+// Create a sink that collects its output in memory, in sink->buffer and sink->size.
+void output_sink_init_memory(struct output_sink *sink);
+
+// Write out everything that is buffered. Memory sinks keep their output. Returns false if a
+// write has failed.
+bool output_sink_flush(struct output_sink *sink);
+
+// Flush the sink, close its file if it opened one, and free the buffer. Returns false if a write
+// has failed.
+bool output_sink_close(struct output_sink *sink);
+
+// The slow path of output_sink_write(), for data that doesn't fit in the rest of the buffer.
+void output_sink_write_slow(struct output_sink *sink, const void *data, size_t size);
+
+static inline void
+output_sink_write(struct output_sink *sink, const void *data, size_t size) {
+	if (size <= sink->capacity - sink->size) {
+		memcpy(sink->buffer + sink->size, data, size);
+		sink->size += size;
+	} else {
+		output_sink_write_slow(sink, data, size);
+	}
+}
+
+// The most that output_sink_reserve() can reserve at once.
+#define OUTPUT_SINK_MAX_RESERVE	0x10000
+
+// Get room for up to size bytes at the end of the buffer, which the caller fills in and then
+// adds to the output with output_sink_commit(). This lets encoders write into the buffer
+// directly.
+char *output_sink_reserve(struct output_sink *sink, size_t size);
+
+static inline void
+output_sink_commit(struct output_sink *sink, size_t size) {
+	sink->size += size;
+}
+
+static inline void
+output_sink_write_string(struct output_sink *sink, const char *string) {
+	output_sink_write(sink, string, strlen(string));
+}
+
+void output_sink_printf(struct output_sink *sink, const char *format, ...)
+	__attribute__((format(printf, 2, 3)));
+
+#endif
@@ -0,0 +1,48 @@
+/*
+ * tests/display-type-test.c
+ * Brandon Azad
+ */
+#include "test.h"
+
+// The display type rules are private to the tool, so build the tool into the test.
+#define DEVICETREE_PARSE_TEST 1
+#define main devicetree_parse_main
+#include "../main.c"
+#undef main
+
+// Classifying a value with a small limit may only stop early; it must not pick a type that
+// formats differently from the exact one.
+static void
+test_small_values() {
+	const char *string = "uart0";
+	CHECK(compute_display_type("name", string, 6, 64) == DISP_STRING);
+	const uint32_t word = 0x1000;
+	CHECK(compute_display_type("width", &word, 4, 64) == DISP_HEX_INT);
+	CHECK(compute_display_type("#size-cells", &word, 4, 64) == DISP_DEC_INT);
+	const uint64_t ranges[2] = { 0x200000000, 0x4000 };
+	CHECK(compute_display_type("ranges", ranges, sizeof(ranges), 64) == DISP_PHYS_RANGES);
+}
+
+// A large zero-filled value whose size is a multiple of 16 stays ambiguous between a string and
+// physical ranges until all of it has been measured. The physical ranges must be checked once for
+// the value rather than once for every step of the measurement, which took minutes for a 64 MB
+// value.
+static void
+test_large_zero_value() {
+	size_t size = 4 * 1024 * 1024;
+	void *value = calloc(size, 1);
+	assert(value != NULL);
+	test_phys_ranges_checked = 0;
+	enum display_type type = compute_display_type("blob", value, size, 64);
+	CHECK(test_phys_ranges_checked <= size);
+	CHECK(type == compute_display_type("blob", value, size, SIZE_MAX));
+	free(value);
+}
+
+int
+main() {
+	select_implementations();
+	test_small_values();
+	test_large_zero_value();
+	return (test_failures > 0 ? 1 : 0);
+}
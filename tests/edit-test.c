@@ -0,0 +1,250 @@
+/*
+ * tests/edit-test.c
+ * Brandon Azad
+ */
+#include "../devicetree-edit.h"
+#include "test.h"
+#include "tree-builder.h"
+
+// Build a small devicetree:
+//
+//   /         name, model
+//   /cpus     name
+//     cpu0    name, reg
+//     cpu1    name, reg
+//   /arm-io   name, compatible
+//     uart0   name, reg
+//     uart1   name, reg
+//   /chosen   name, boot-args
+//   /memory   name, reg, odd
+//
+// The last property has a 5-byte value, so that the tree can also be cut off in its padding.
+static void
+build_tree(struct tree_builder *tree) {
+	uint32_t reg[2] = { 0x1000, 0x100 };
+	tree_builder_init(tree);
+	tree_builder_node(tree, 2, 4);
+	tree_builder_string(tree, "name", "device-tree");
+	tree_builder_string(tree, "model", "old-model");
+	tree_builder_node(tree, 1, 2);
+	tree_builder_string(tree, "name", "cpus");
+	for (unsigned i = 0; i < 2; i++) {
+		char name[8];
+		snprintf(name, sizeof(name), "cpu%u", i);
+		reg[0] = i;
+		tree_builder_node(tree, 2, 0);
+		tree_builder_string(tree, "name", name);
+		tree_builder_property(tree, "reg", reg, sizeof(reg[0]));
+	}
+	tree_builder_node(tree, 2, 2);
+	tree_builder_string(tree, "name", "arm-io");
+	tree_builder_string(tree, "compatible", "arm-io,t8010");
+	for (unsigned i = 0; i < 2; i++) {
+		char name[8];
+		snprintf(name, sizeof(name), "uart%u", i);
+		reg[0] = 0x1000 * (i + 1);
+		tree_builder_node(tree, 2, 0);
+		tree_builder_string(tree, "name", name);
+		tree_builder_property(tree, "reg", reg, sizeof(reg));
+	}
+	tree_builder_node(tree, 2, 0);
+	tree_builder_string(tree, "name", "chosen");
+	tree_builder_string(tree, "boot-args", "debug=0x8");
+	tree_builder_node(tree, 3, 0);
+	tree_builder_string(tree, "name", "memory");
+	tree_builder_property(tree, "reg", reg, sizeof(reg));
+	tree_builder_property(tree, "odd", "\x01\x02\x03\x04\x05", 5);
+}
+
+// Write the edited tree to a file with devicetree_edit_write() and read it back, checking that it
+// matches devicetree_edit_serialize(). The caller frees the result.
+static uint8_t *
+write_and_read_back(struct devicetree_edit *edit, size_t *size) {
+	*size = devicetree_edit_size(edit);
+	FILE *file = tmpfile();
+	assert(file != NULL);
+	CHECK(devicetree_edit_write(edit, fileno(file)));
+	uint8_t *written = malloc(*size + 1);
+	assert(written != NULL);
+	rewind(file);
+	CHECK(fread(written, 1, *size + 1, file) == *size);
+	fclose(file);
+	uint8_t *serialized = malloc(*size);
+	assert(serialized != NULL);
+	devicetree_edit_serialize(edit, serialized);
+	CHECK(memcmp(written, serialized, *size) == 0);
+	free(serialized);
+	return written;
+}
+
+static uint32_t
+find_node(struct devicetree_index *index, const char *path) {
+	uint32_t id = devicetree_find_node(index, path);
+	if (id == DEVICETREE_INDEX_NONE) {
+		fprintf(stderr, "no node %s\n", path);
+	}
+	return id;
+}
+
+// Check that a node has a property with the given value.
+static bool
+has_value(struct devicetree_index *index, const char *path, const char *name,
+		const void *value, size_t size) {
+	uint32_t id = find_node(index, path);
+	const void *found;
+	size_t found_size;
+	return (id != DEVICETREE_INDEX_NONE
+			&& devicetree_index_find_property(index, id, name, &found, &found_size)
+			&& found_size == size && memcmp(found, value, size) == 0);
+}
+
+static bool
+has_property(struct devicetree_index *index, const char *path, const char *name) {
+	uint32_t id = find_node(index, path);
+	const void *value;
+	size_t size;
+	return (id != DEVICETREE_INDEX_NONE
+			&& devicetree_index_find_property(index, id, name, &value, &size));
+}
+
+// Check that a whole subtree was copied byte for byte.
+static bool
+same_subtree(struct devicetree_index *original, struct devicetree_index *edited,
+		const char *path) {
+	uint32_t a = find_node(original, path);
+	uint32_t b = find_node(edited, path);
+	if (a == DEVICETREE_INDEX_NONE || b == DEVICETREE_INDEX_NONE) {
+		return false;
+	}
+	const struct devicetree_index_node *node_a = &original->nodes[a];
+	const struct devicetree_index_node *node_b = &edited->nodes[b];
+	size_t size = node_a->end - node_a->offset;
+	return (node_b->end - node_b->offset == size
+			&& memcmp(original->data + node_a->offset, edited->data + node_b->offset,
+				size) == 0);
+}
+
+// Find the bytes of a property, from its header through its padding.
+static const uint8_t *
+property_bytes(struct devicetree_index *index, const char *path, const char *name,
+		size_t *size) {
+	uint32_t id = find_node(index, path);
+	if (id == DEVICETREE_INDEX_NONE) {
+		return NULL;
+	}
+	const struct devicetree_index_node *node = &index->nodes[id];
+	for (uint32_t i = 0; i < node->n_properties; i++) {
+		const struct devicetree_index_property *prop =
+			&index->properties[node->first_property + i];
+		if (strcmp(devicetree_index_property_name(index, prop), name) == 0) {
+			size_t end = prop->value_offset + ((prop->size + 0x3) & ~0x3);
+			*size = (end < index->size ? end : index->size) - prop->name_offset;
+			return index->data + prop->name_offset;
+		}
+	}
+	return NULL;
+}
+
+// Check that an unedited property of an edited node was copied byte for byte.
+static bool
+same_property(struct devicetree_index *original, struct devicetree_index *edited,
+		const char *path, const char *name) {
+	size_t size_a, size_b;
+	const uint8_t *a = property_bytes(original, path, name, &size_a);
+	const uint8_t *b = property_bytes(edited, path, name, &size_b);
+	return (a != NULL && b != NULL && size_a == size_b && memcmp(a, b, size_a) == 0);
+}
+
+static void
+test_round_trip() {
+	struct tree_builder tree;
+	build_tree(&tree);
+	struct devicetree_index original;
+	CHECK(devicetree_index_build(tree.data, tree.size, &original));
+	struct devicetree_edit *edit = devicetree_edit_create(&original);
+	// An edit that changes nothing copies the tree as is.
+	size_t size;
+	uint8_t *data = write_and_read_back(edit, &size);
+	CHECK(size == tree.size && memcmp(data, tree.data, size) == 0);
+	free(data);
+	// Change, add and remove properties, and add and remove nodes.
+	uint32_t root = 0;
+	uint32_t arm_io = find_node(&original, "/arm-io");
+	uint32_t uart1 = find_node(&original, "/arm-io/uart1");
+	uint32_t chosen = find_node(&original, "/chosen");
+	uint32_t memory = find_node(&original, "/memory");
+	uint32_t reg[2] = { 0x5000, 0x40 };
+	CHECK(devicetree_edit_set_property(edit, root, "model", "new-model", 10));
+	CHECK(devicetree_edit_set_property(edit, chosen, "new-property", "\x07", 1));
+	CHECK(devicetree_edit_remove_property(edit, memory, "reg"));
+	CHECK(!devicetree_edit_remove_property(edit, memory, "missing"));
+	uint32_t added = devicetree_edit_add_node(edit, arm_io, "spi0");
+	CHECK(added != DEVICETREE_INDEX_NONE);
+	CHECK(devicetree_edit_set_property(edit, added, "reg", reg, sizeof(reg)));
+	CHECK(devicetree_edit_remove_node(edit, uart1));
+	CHECK(!devicetree_edit_set_property(edit, uart1, "reg", reg, sizeof(reg)));
+	CHECK(!devicetree_edit_remove_node(edit, root));
+	data = write_and_read_back(edit, &size);
+	// The result parses back with the edits in place.
+	struct devicetree_index edited;
+	bool ok = devicetree_index_build(data, size, &edited);
+	CHECK(ok);
+	if (ok) {
+		CHECK(edited.n_nodes == original.n_nodes);
+		CHECK(has_value(&edited, "/", "model", "new-model", 10));
+		CHECK(has_value(&edited, "/chosen", "new-property", "\x07", 1));
+		CHECK(has_value(&edited, "/chosen", "boot-args", "debug=0x8", 10));
+		CHECK(!has_property(&edited, "/memory", "reg"));
+		CHECK(has_value(&edited, "/arm-io/spi0", "name", "spi0", 5));
+		CHECK(has_value(&edited, "/arm-io/spi0", "reg", reg, sizeof(reg)));
+		CHECK(devicetree_find_node(&edited, "/arm-io/uart1") == DEVICETREE_INDEX_NONE);
+		// Untouched subtrees and the unedited properties of edited nodes are copied as
+		// they were.
+		CHECK(same_subtree(&original, &edited, "/cpus"));
+		CHECK(same_subtree(&original, &edited, "/arm-io/uart0"));
+		CHECK(same_property(&original, &edited, "/", "name"));
+		CHECK(same_property(&original, &edited, "/arm-io", "compatible"));
+		CHECK(same_property(&original, &edited, "/chosen", "boot-args"));
+		CHECK(same_property(&original, &edited, "/memory", "odd"));
+		devicetree_index_free(&edited);
+	}
+	free(data);
+	devicetree_edit_free(edit);
+	devicetree_index_free(&original);
+	tree_builder_free(&tree);
+}
+
+// A devicetree may end without padding after its last value. Once that property is no longer last,
+// the padding has to be added back.
+static void
+test_unpadded_end() {
+	struct tree_builder tree;
+	build_tree(&tree);
+	tree.size -= 3;
+	struct devicetree_index original;
+	CHECK(devicetree_index_build(tree.data, tree.size, &original));
+	struct devicetree_edit *edit = devicetree_edit_create(&original);
+	CHECK(devicetree_edit_add_node(edit, 0, "last") != DEVICETREE_INDEX_NONE);
+	size_t size;
+	uint8_t *data = write_and_read_back(edit, &size);
+	struct devicetree_index edited;
+	bool ok = devicetree_index_build(data, size, &edited);
+	CHECK(ok);
+	if (ok) {
+		CHECK(has_value(&edited, "/memory", "odd", "\x01\x02\x03\x04\x05", 5));
+		CHECK(has_value(&edited, "/last", "name", "last", 5));
+		CHECK(same_subtree(&original, &edited, "/arm-io"));
+		devicetree_index_free(&edited);
+	}
+	free(data);
+	devicetree_edit_free(edit);
+	devicetree_index_free(&original);
+	tree_builder_free(&tree);
+}
+
+int
+main() {
+	test_round_trip();
+	test_unpadded_end();
+	return test_failures;
+}
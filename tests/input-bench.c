@@ -0,0 +1,154 @@
+/*
+ * tests/input-bench.c
+ * Brandon Azad
+ */
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../input-file.h"
+#include "tree-builder.h"
+
+// The corpus: copies of one synthetic devicetree of a few megabytes.
+#define N_FILES	24
+
+// How many times to run each pass, keeping the fastest.
+#define RUNS	3
+
+static double
+current_time() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Write the corpus into a new temporary directory and return the paths of the files.
+static char **
+write_corpus(char *dir, size_t *corpus_size) {
+	struct tree_builder tree;
+	tree_builder_init(&tree);
+	tree_builder_add_subtree(&tree, 5, 10, 8, 24);
+	char *created = mkdtemp(dir);
+	assert(created != NULL);
+	char **files = calloc(N_FILES, sizeof(*files));
+	assert(files != NULL);
+	for (size_t i = 0; i < N_FILES; i++) {
+		asprintf(&files[i], "%s/devicetree-%zu", dir, i);
+		assert(files[i] != NULL);
+		int fd = open(files[i], O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		assert(fd >= 0);
+		ssize_t written = write(fd, tree.data, tree.size);
+		assert(written == tree.size);
+		// The pages must be clean before they can be dropped from the cache.
+		fsync(fd);
+		close(fd);
+	}
+	*corpus_size = N_FILES * tree.size;
+	tree_builder_free(&tree);
+	return files;
+}
+
+static void
+remove_corpus(const char *dir, char **files) {
+	for (size_t i = 0; i < N_FILES; i++) {
+		unlink(files[i]);
+		free(files[i]);
+	}
+	free(files);
+	rmdir(dir);
+}
+
+// Drop a file's pages from the page cache, so that the next read of it goes to the disk. Returns
+// false if the system gives no way to do this.
+static bool
+drop_cache(const char *path) {
+	int fd = open(path, O_RDONLY);
+	assert(fd >= 0);
+	bool dropped = false;
+#if defined(POSIX_FADV_DONTNEED)
+	dropped = (posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED) == 0);
+#elif defined(F_NOCACHE)
+	// macOS has no posix_fadvise(). Invalidating a mapping of the whole file evicts its pages
+	// from the unified buffer cache instead.
+	struct stat st;
+	fstat(fd, &st);
+	void *mapping = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	if (mapping != MAP_FAILED) {
+		dropped = (msync(mapping, st.st_size, MS_INVALIDATE) == 0);
+		munmap(mapping, st.st_size);
+	}
+#endif
+	close(fd);
+	return dropped;
+}
+
+// Read and validate every file of the corpus with the given backend, as --check --batch would on
+// one thread. With prefetch, the next file is prefetched before each file is read, like batch
+// mode does. Returns the time taken.
+static double
+read_corpus(char **files, enum input_backend backend, unsigned flags, bool prefetch) {
+	double start = current_time();
+	for (size_t i = 0; i < N_FILES; i++) {
+		if (prefetch && i + 1 < N_FILES) {
+			input_file_prefetch(files[i + 1]);
+		}
+		struct input_file file;
+		bool ok = input_file_open(files[i], backend, flags, &file);
+		assert(ok);
+		struct devicetree_validate_stats stats;
+		ok = devicetree_validate(file.data, file.size, &stats);
+		assert(ok);
+		input_file_close(&file);
+	}
+	return current_time() - start;
+}
+
+// Report the throughput of reading the corpus with a warm and with a cold page cache.
+static void
+bench_input(const char *description, char **files, size_t corpus_size,
+		enum input_backend backend, unsigned flags, bool prefetch) {
+	double warm = 1e9;
+	double cold = 1e9;
+	bool can_drop = true;
+	read_corpus(files, backend, flags, prefetch);
+	for (unsigned run = 0; run < RUNS; run++) {
+		double elapsed = read_corpus(files, backend, flags, prefetch);
+		warm = (elapsed < warm ? elapsed : warm);
+		for (size_t i = 0; i < N_FILES; i++) {
+			can_drop &= drop_cache(files[i]);
+		}
+		elapsed = read_corpus(files, backend, flags, prefetch);
+		cold = (elapsed < cold ? elapsed : cold);
+	}
+	double mb = corpus_size / 1e6;
+	if (can_drop) {
+		printf("%-28s warm %8.1f MB/s  cold %8.1f MB/s\n", description,
+				mb / warm, mb / cold);
+	} else {
+		printf("%-28s warm %8.1f MB/s  cold (can't drop the page cache)\n", description,
+				mb / warm);
+	}
+}
+
+int
+main() {
+	const char *tmpdir = getenv("TMPDIR");
+	char *dir;
+	asprintf(&dir, "%s/input-bench.XXXXXX", (tmpdir != NULL ? tmpdir : "/tmp"));
+	assert(dir != NULL);
+	size_t corpus_size;
+	char **files = write_corpus(dir, &corpus_size);
+	printf("%d files, %.1f MB\n", N_FILES, corpus_size / 1e6);
+	bench_input("mmap", files, corpus_size, INPUT_BACKEND_MMAP, INPUT_SEQUENTIAL, false);
+	bench_input("mmap, populate", files, corpus_size, INPUT_BACKEND_MMAP,
+			INPUT_SEQUENTIAL | INPUT_POPULATE, false);
+	bench_input("read", files, corpus_size, INPUT_BACKEND_READ, 0, false);
+	bench_input("mmap, prefetch next file", files, corpus_size, INPUT_BACKEND_MMAP,
+			INPUT_SEQUENTIAL, true);
+	bench_input("read, prefetch next file", files, corpus_size, INPUT_BACKEND_READ, 0, true);
+	remove_corpus(dir, files);
+	free(dir);
+	return 0;
+}
@@ -0,0 +1,83 @@
+/*
+ * tests/iterate-bench.c
+ * Brandon Azad
+ */
+#include <time.h>
+
+#include "tree-builder.h"
+
+// How many times to iterate over each tree, keeping the fastest.
+#define RUNS	10
+
+static double
+current_time() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Report how many nodes per second devicetree_iterate_limited() visits in a tree, with callbacks
+// that only count the nodes and properties.
+static void
+bench_tree(const char *description, const struct tree_builder *tree, unsigned max_depth) {
+	__block size_t nodes_seen = 0;
+	__block size_t properties_seen = 0;
+	__block unsigned deepest = 0;
+	devicetree_iterate_node_callback_t node_cb =
+			^(unsigned depth, const void *node, size_t size,
+					unsigned n_properties, unsigned n_children,
+					bool *skip_children, bool *stop) {
+		nodes_seen++;
+		deepest = (depth > deepest ? depth : deepest);
+	};
+	devicetree_iterate_property_callback_t property_cb =
+			^(unsigned depth, const char *name,
+					const void *value, size_t size, bool *stop) {
+		properties_seen++;
+	};
+	double best = 1e9;
+	for (unsigned run = 0; run < RUNS; run++) {
+		nodes_seen = 0;
+		properties_seen = 0;
+		const void *data = tree->data;
+		double start = current_time();
+		bool ok = devicetree_iterate_limited(&data, tree->size, max_depth,
+				node_cb, property_cb);
+		double elapsed = current_time() - start;
+		assert(ok && data == tree->data + tree->size);
+		best = (elapsed < best ? elapsed : best);
+	}
+	printf("%-28s %9zu nodes %10zu properties  depth %6u  %8.2f M nodes/s\n",
+			description, nodes_seen, properties_seen, deepest, nodes_seen / best / 1e6);
+}
+
+// Build a root with n_chains children, each the start of a chain of the given length.
+static void
+build_chains(struct tree_builder *tree, uint32_t n_chains, unsigned length) {
+	tree_builder_init(tree);
+	tree_builder_node(tree, 1, n_chains);
+	tree_builder_string(tree, "name", "device-tree");
+	for (uint32_t i = 0; i < n_chains; i++) {
+		tree_builder_add_chain(tree, length, 2, 4);
+	}
+}
+
+int
+main() {
+	struct tree_builder tree;
+	// A bushy tree, as a baseline.
+	tree_builder_init(&tree);
+	tree_builder_add_subtree(&tree, 6, 10, 2, 4);
+	bench_tree("height 6, 10 children", &tree, DEVICETREE_DEFAULT_MAX_DEPTH);
+	tree_builder_free(&tree);
+	// Deep trees within the default depth limit.
+	build_chains(&tree, 1000, 250);
+	bench_tree("1000 chains of 250 nodes", &tree, DEVICETREE_DEFAULT_MAX_DEPTH);
+	tree_builder_free(&tree);
+	// A single chain far deeper than the default limit. The traversal keeps its stack in
+	// memory rather than recursing, so only the limit needs to be raised.
+	build_chains(&tree, 1, 200000);
+	bench_tree("1 chain of 200000 nodes", &tree, 200000);
+	tree_builder_free(&tree);
+	return 0;
+}
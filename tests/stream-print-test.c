@@ -0,0 +1,106 @@
+/*
+ * tests/stream-print-test.c
+ * Brandon Azad
+ */
+#include "test.h"
+#include "tree-builder.h"
+
+// The stream printer is private to the tool, so build the tool into the test.
+#define main devicetree_parse_main
+#include "../main.c"
+#undef main
+
+// Print the tree both with devicetree_print() and with devicetree_print_stream(), fed in pieces of
+// piece_size bytes, and check that both give the same result, and the same output if the tree is
+// valid. The stream printer may already have printed more of a malformed tree.
+static void
+compare(const char *description, const struct tree_builder *tree, size_t piece_size) {
+	struct output_sink expected;
+	output_sink_init_memory(&expected);
+	bool expected_ok = devicetree_print(tree->data, tree->size, &expected);
+	struct output_sink actual;
+	output_sink_init_memory(&actual);
+	__block size_t offset = 0;
+	bool actual_ok = devicetree_print_stream(&actual,
+			^bool(const void **data, size_t *size) {
+		if (offset == tree->size) {
+			return false;
+		}
+		*data = tree->data + offset;
+		*size = (tree->size - offset < piece_size ? tree->size - offset : piece_size);
+		offset += *size;
+		return true;
+	});
+	bool same = (actual_ok == expected_ok && (!expected_ok || (actual.size == expected.size
+			&& memcmp(actual.buffer, expected.buffer, actual.size) == 0)));
+	if (!same) {
+		fprintf(stderr, "%s, %zu-byte pieces:\n--- devicetree_print() %d\n%.*s"
+				"--- devicetree_print_stream() %d\n%.*s", description, piece_size,
+				expected_ok, (int)expected.size, expected.buffer,
+				actual_ok, (int)actual.size, actual.buffer);
+	}
+	CHECK(same);
+	output_sink_close(&expected);
+	output_sink_close(&actual);
+}
+
+// Add a property with n_records records of record_size bytes, each filled from its index.
+static void
+add_records(struct tree_builder *tree, const char *name, size_t record_size, size_t n_records) {
+	size_t size = record_size * n_records;
+	uint8_t *value = malloc(size);
+	assert(value != NULL);
+	for (size_t i = 0; i < n_records; i++) {
+		uint64_t words[8] = { 0x800000000 + 0x4000 * i, 0xfffffff000000000 + i, 0, 0x4000 };
+		assert(record_size <= sizeof(words));
+		memcpy(value + i * record_size, words, record_size);
+	}
+	tree_builder_property(tree, name, value, size);
+	free(value);
+}
+
+// Values larger than STREAM_MAX_BUFFERED_VALUE are printed from their start, which must be cut
+// down to whole records for the range types.
+static void
+test_large_ranges() {
+	struct tree_builder tree;
+	tree_builder_init(&tree);
+	tree_builder_node(&tree, 3, 1);
+	tree_builder_string(&tree, "name", "device-tree");
+	add_records(&tree, "segment-ranges", sizeof(struct segment_range),
+			STREAM_MAX_BUFFERED_VALUE / sizeof(struct segment_range) + 1000);
+	add_records(&tree, "reg", sizeof(struct phys_range),
+			STREAM_MAX_BUFFERED_VALUE / sizeof(struct phys_range) + 1000);
+	tree_builder_node(&tree, 1, 0);
+	tree_builder_string(&tree, "name", "chosen");
+	size_t piece_sizes[] = { 7, 4096, 40000, tree.size };
+	for (size_t i = 0; i < sizeof(piece_sizes) / sizeof(piece_sizes[0]); i++) {
+		compare("large ranges", &tree, piece_sizes[i]);
+	}
+	tree_builder_free(&tree);
+}
+
+// A devicetree may end right after its last value, but not partway through the value's padding.
+static void
+test_end_in_padding() {
+	struct tree_builder tree;
+	tree_builder_init(&tree);
+	tree_builder_node(&tree, 2, 0);
+	tree_builder_string(&tree, "name", "device-tree");
+	tree_builder_property(&tree, "odd", "\x01\x02\x03\x04\x05", 5);
+	for (size_t cut = 0; cut <= 3; cut++) {
+		struct tree_builder truncated = tree;
+		truncated.size -= cut;
+		compare("tree ending in padding", &truncated, 1);
+		compare("tree ending in padding", &truncated, truncated.size);
+	}
+	tree_builder_free(&tree);
+}
+
+int
+main() {
+	select_implementations();
+	test_large_ranges();
+	test_end_in_padding();
+	return (test_failures > 0 ? 1 : 0);
+}
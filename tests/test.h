@@ -0,0 +1,24 @@
+/*
+ * tests/test.h
+ * Brandon Azad
+ */
+#ifndef TEST__H_
+#define TEST__H_
+
+#include <stdio.h>
+
+// The number of checks that failed so far. A test returns it from main(), so that any failure
+// fails the test.
+static int test_failures;
+
+// Check a condition, reporting it and carrying on if it doesn't hold.
+#define CHECK(condition)								\
+	do {										\
+		if (!(condition)) {							\
+			fprintf(stderr, "%s:%d: check failed: %s\n",			\
+					__FILE__, __LINE__, #condition);		\
+			test_failures++;						\
+		}									\
+	} while (0)
+
+#endif
@@ -0,0 +1,116 @@
+/*
+ * tests/tree-builder.h
+ * Brandon Azad
+ */
+#ifndef TREE_BUILDER__H_
+#define TREE_BUILDER__H_
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../devicetree-parse.h"
+
+// Builds a synthetic devicetree for the tests and benchmarks. Nodes and properties are added in
+// the order that they are stored: a node header, then its properties, then its children. This
+// header is also included from C++.
+struct tree_builder {
+	uint8_t *data;
+	size_t size;
+	size_t capacity;
+};
+
+static inline void
+tree_builder_init(struct tree_builder *tree) {
+	tree->capacity = 0x10000;
+	tree->size = 0;
+	tree->data = (uint8_t *)malloc(tree->capacity);
+	assert(tree->data != NULL);
+}
+
+static inline void
+tree_builder_free(struct tree_builder *tree) {
+	free(tree->data);
+	memset(tree, 0, sizeof(*tree));
+}
+
+// Add size zeroed bytes to the end of the tree and return them.
+static inline void *
+tree_builder_append(struct tree_builder *tree, size_t size) {
+	while (tree->capacity - tree->size < size) {
+		tree->capacity *= 2;
+		tree->data = (uint8_t *)realloc(tree->data, tree->capacity);
+		assert(tree->data != NULL);
+	}
+	void *p = tree->data + tree->size;
+	memset(p, 0, size);
+	tree->size += size;
+	return p;
+}
+
+static inline void
+tree_builder_node(struct tree_builder *tree, uint32_t n_properties, uint32_t n_children) {
+	struct devicetree_node *node =
+			(struct devicetree_node *)tree_builder_append(tree, sizeof(*node));
+	node->n_properties = n_properties;
+	node->n_children = n_children;
+}
+
+// Add a property, padding the value to 4 bytes.
+static inline void
+tree_builder_property(struct tree_builder *tree, const char *name, const void *value,
+		uint32_t size) {
+	struct devicetree_property *prop =
+			(struct devicetree_property *)tree_builder_append(tree, sizeof(*prop));
+	memcpy(prop->name, name, strnlen(name, sizeof(prop->name) - 1));
+	prop->size = size;
+	void *data = tree_builder_append(tree, (size + 0x3) & ~0x3);
+	memcpy(data, value, size);
+}
+
+// Add a property whose value is a string, including its null.
+static inline void
+tree_builder_string(struct tree_builder *tree, const char *name, const char *string) {
+	tree_builder_property(tree, name, string, strlen(string) + 1);
+}
+
+// Add a subtree of the given height in which every node but the leaves has n_children children.
+// Each node has a name and n_properties - 1 more properties, with value_size bytes each.
+static inline void
+tree_builder_add_subtree(struct tree_builder *tree, unsigned height, uint32_t n_children,
+		uint32_t n_properties, uint32_t value_size) {
+	static unsigned serial;
+	uint8_t value[256] = { 0 };
+	assert(value_size <= sizeof(value) && n_properties > 0);
+	tree_builder_node(tree, n_properties, (height > 1 ? n_children : 0));
+	char name[32];
+	snprintf(name, sizeof(name), "node%u", serial++);
+	tree_builder_string(tree, "name", name);
+	for (uint32_t i = 1; i < n_properties; i++) {
+		char prop_name[32];
+		snprintf(prop_name, sizeof(prop_name), "property-%u", i);
+		memcpy(value, &i, sizeof(i));
+		tree_builder_property(tree, prop_name, value, value_size);
+	}
+	for (uint32_t i = 0; height > 1 && i < n_children; i++) {
+		tree_builder_add_subtree(tree, height - 1, n_children, n_properties, value_size);
+	}
+}
+
+// Add a chain of nodes, each the only child of the one before, with n_properties properties each
+// as for tree_builder_add_subtree(). The chain is built without recursion, since it may be far
+// deeper than DEVICETREE_DEFAULT_MAX_DEPTH.
+static inline void
+tree_builder_add_chain(struct tree_builder *tree, unsigned length, uint32_t n_properties,
+		uint32_t value_size) {
+	for (unsigned i = 0; i < length; i++) {
+		size_t offset = tree->size;
+		tree_builder_add_subtree(tree, 1, 0, n_properties, value_size);
+		if (i + 1 < length) {
+			((struct devicetree_node *)(tree->data + offset))->n_children = 1;
+		}
+	}
+}
+
+#endif
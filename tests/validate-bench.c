@@ -0,0 +1,69 @@
+/*
+ * tests/validate-bench.c
+ * Brandon Azad
+ */
+#include <time.h>
+
+#include "tree-builder.h"
+
+// How many times to run each pass over the tree, keeping the fastest.
+#define RUNS	10
+
+static double
+current_time() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Report the throughput of devicetree_validate() on a tree, next to a devicetree_iterate() pass
+// with empty callbacks, which checks the same rules.
+static void
+bench_tree(const char *description, const struct tree_builder *tree) {
+	double validate_time = 1e9;
+	double iterate_time = 1e9;
+	struct devicetree_validate_stats stats;
+	for (unsigned run = 0; run < RUNS; run++) {
+		double start = current_time();
+		bool ok = devicetree_validate(tree->data, tree->size, &stats);
+		double elapsed = current_time() - start;
+		assert(ok);
+		validate_time = (elapsed < validate_time ? elapsed : validate_time);
+		const void *data = tree->data;
+		start = current_time();
+		ok = devicetree_iterate(&data, tree->size,
+				^(unsigned depth, const void *node, size_t size,
+						unsigned n_properties, unsigned n_children,
+						bool *skip_children, bool *stop) {},
+				^(unsigned depth, const char *name,
+						const void *value, size_t size, bool *stop) {});
+		elapsed = current_time() - start;
+		assert(ok);
+		iterate_time = (elapsed < iterate_time ? elapsed : iterate_time);
+	}
+	double mb = tree->size / 1e6;
+	printf("%-28s %8.1f MB %9zu nodes %10zu properties  validate %8.1f MB/s  "
+			"iterate %8.1f MB/s\n", description, mb, stats.n_nodes, stats.n_properties,
+			mb / validate_time, mb / iterate_time);
+}
+
+int
+main() {
+	struct tree_builder tree;
+	// Small properties, where the cost is in the headers.
+	tree_builder_init(&tree);
+	tree_builder_add_subtree(&tree, 6, 10, 8, 4);
+	bench_tree("small properties", &tree);
+	tree_builder_free(&tree);
+	// Larger values, where the cost is in skipping the data.
+	tree_builder_init(&tree);
+	tree_builder_add_subtree(&tree, 5, 10, 8, 256);
+	bench_tree("256-byte values", &tree);
+	tree_builder_free(&tree);
+	// One node with many children.
+	tree_builder_init(&tree);
+	tree_builder_add_subtree(&tree, 2, 100000, 4, 16);
+	bench_tree("100000 leaves", &tree);
+	tree_builder_free(&tree);
+	return 0;
+}
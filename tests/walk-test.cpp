@@ -0,0 +1,201 @@
+/*
+ * tests/walk-test.cpp
+ * Brandon Azad
+ */
+#include <string>
+#include <vector>
+
+#include "../devicetree-walk.hpp"
+#include "test.h"
+#include "tree-builder.h"
+
+// A node or property that a traversal visited.
+struct event {
+	bool is_node;
+	unsigned depth;
+	const void *pointer;
+	size_t size;
+	unsigned n_properties;
+	unsigned n_children;
+	std::string name;
+
+	bool
+	operator==(const event &other) const {
+		return (is_node == other.is_node && depth == other.depth
+				&& pointer == other.pointer && size == other.size
+				&& n_properties == other.n_properties
+				&& n_children == other.n_children && name == other.name);
+	}
+};
+
+// When to cut a traversal short, counting nodes in the order they are visited. Zero means never.
+struct rules {
+	unsigned skip_children_every;
+	unsigned stop_at;
+};
+
+static devicetree::action
+apply_rules(const struct rules &rules, unsigned node_index) {
+	if (rules.stop_at != 0 && node_index == rules.stop_at) {
+		return devicetree::action::stop;
+	}
+	if (rules.skip_children_every != 0 && node_index % rules.skip_children_every == 1) {
+		return devicetree::action::skip_children;
+	}
+	return devicetree::action::next;
+}
+
+static event
+node_event(unsigned depth, const void *node, size_t size, unsigned n_properties,
+		unsigned n_children) {
+	return event { true, depth, node, size, n_properties, n_children, std::string() };
+}
+
+static event
+property_event(unsigned depth, const char *name, const void *value, size_t size) {
+	return event { false, depth, value, size, 0, 0, std::string(name) };
+}
+
+// ---- devicetree_iterate() ----------------------------------------------------------------------
+
+// The blocks given to devicetree_iterate() record into these.
+static std::vector<event> iterate_events;
+static struct rules iterate_rules;
+static unsigned iterate_nodes;
+
+static bool
+iterate_tree(const struct tree_builder *tree, size_t size, unsigned max_depth, bool visit_nodes,
+		size_t *processed) {
+	iterate_events.clear();
+	iterate_nodes = 0;
+	devicetree_iterate_node_callback_t node_cb =
+			^(unsigned depth, const void *node, size_t size,
+					unsigned n_properties, unsigned n_children,
+					bool *skip_children, bool *stop) {
+		iterate_events.push_back(node_event(depth, node, size, n_properties, n_children));
+		devicetree::action action = apply_rules(iterate_rules, iterate_nodes++);
+		*stop = (action == devicetree::action::stop);
+		*skip_children = (action == devicetree::action::skip_children);
+	};
+	devicetree_iterate_property_callback_t property_cb =
+			^(unsigned depth, const char *name,
+					const void *value, size_t size, bool *stop) {
+		iterate_events.push_back(property_event(depth, name, value, size));
+	};
+	const void *data = tree->data;
+	bool ok = devicetree_iterate_limited(&data, size, max_depth,
+			(visit_nodes ? node_cb : NULL), property_cb);
+	*processed = (const uint8_t *)data - tree->data;
+	return ok;
+}
+
+// ---- devicetree::walk() ------------------------------------------------------------------------
+
+struct recorder {
+	std::vector<event> &events;
+	struct rules rules;
+	unsigned n_nodes;
+
+	devicetree::action
+	node(unsigned depth, const void *node, size_t size, unsigned n_properties,
+			unsigned n_children) {
+		events.push_back(node_event(depth, node, size, n_properties, n_children));
+		return apply_rules(rules, n_nodes++);
+	}
+
+	void
+	property(unsigned depth, const char *name, const void *value, size_t size) {
+		events.push_back(property_event(depth, name, value, size));
+	}
+};
+
+// A visitor without a node member, so that walk() compiles the node callback out.
+struct property_recorder {
+	std::vector<event> &events;
+
+	void
+	property(unsigned depth, const char *name, const void *value, size_t size) {
+		events.push_back(property_event(depth, name, value, size));
+	}
+};
+
+// ---- Tests -------------------------------------------------------------------------------------
+
+// Walk the first size bytes of the tree both ways and check that the results, the number of bytes
+// consumed, and the visited nodes and properties are the same.
+static void
+compare(const char *description, const struct tree_builder *tree, size_t size,
+		unsigned max_depth = DEVICETREE_DEFAULT_MAX_DEPTH,
+		struct rules rules = { 0, 0 }, bool visit_nodes = true) {
+	iterate_rules = rules;
+	size_t iterate_processed;
+	bool iterate_ok = iterate_tree(tree, size, max_depth, visit_nodes, &iterate_processed);
+	std::vector<event> walk_events;
+	size_t walk_processed = ~(size_t)0;
+	bool walk_ok;
+	if (visit_nodes) {
+		walk_ok = devicetree::walk(tree->data, size, recorder { walk_events, rules, 0 },
+				&walk_processed, max_depth);
+	} else {
+		walk_ok = devicetree::walk(tree->data, size, property_recorder { walk_events },
+				&walk_processed, max_depth);
+	}
+	bool same = (walk_ok == iterate_ok && walk_processed == iterate_processed
+			&& walk_events == iterate_events);
+	if (!same) {
+		fprintf(stderr, "%s (%zu bytes): walk %d, %zu bytes, %zu events; "
+				"iterate %d, %zu bytes, %zu events\n", description, size,
+				walk_ok, walk_processed, walk_events.size(),
+				iterate_ok, iterate_processed, iterate_events.size());
+	}
+	CHECK(same);
+}
+
+static void
+test_bushy_tree() {
+	struct tree_builder tree;
+	tree_builder_init(&tree);
+	tree_builder_add_subtree(&tree, 4, 5, 3, 8);
+	compare("bushy tree", &tree, tree.size);
+	compare("bushy tree, skipping children", &tree, tree.size,
+			DEVICETREE_DEFAULT_MAX_DEPTH, { 3, 0 });
+	compare("bushy tree, stopping", &tree, tree.size, DEVICETREE_DEFAULT_MAX_DEPTH, { 0, 40 });
+	compare("bushy tree, properties only", &tree, tree.size,
+			DEVICETREE_DEFAULT_MAX_DEPTH, { 0, 0 }, false);
+	// Trailing bytes are left unprocessed.
+	tree_builder_append(&tree, 12);
+	compare("bushy tree with trailing bytes", &tree, tree.size);
+	tree_builder_free(&tree);
+}
+
+// Every prefix of a tree is malformed except the whole tree. The values are 5 bytes, so that some
+// prefixes end in the padding of the last value.
+static void
+test_truncated_trees() {
+	struct tree_builder tree;
+	tree_builder_init(&tree);
+	tree_builder_add_subtree(&tree, 3, 2, 2, 5);
+	for (size_t size = 0; size <= tree.size; size++) {
+		compare("truncated tree", &tree, size);
+	}
+	tree_builder_free(&tree);
+}
+
+static void
+test_deep_chain() {
+	struct tree_builder tree;
+	tree_builder_init(&tree);
+	tree_builder_add_chain(&tree, 1000, 2, 4);
+	compare("deep chain", &tree, tree.size);
+	compare("deep chain, raised limit", &tree, tree.size, 1000);
+	compare("deep chain, skipping children", &tree, tree.size, 1000, { 7, 0 });
+	tree_builder_free(&tree);
+}
+
+int
+main() {
+	test_bushy_tree();
+	test_truncated_trees();
+	test_deep_chain();
+	return test_failures;
+}
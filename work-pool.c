@@ -0,0 +1,282 @@
+/*
+ * work-pool.c
+ * Brandon Azad
+ */
+#include "work-pool.h"
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+// The tasks a worker still has to run: [next, end).
+struct work_range {
+	pthread_mutex_t lock;
+	size_t next;
+	size_t end;
+};
+
+struct work_pool {
+	work_pool_task_callback_t task_callback;
+	struct work_range *ranges;
+	unsigned n_workers;
+	// Completion tracking, protected by done_lock.
+	pthread_mutex_t done_lock;
+	pthread_cond_t task_done;
+	bool *done;
+};
+
+struct work_worker {
+	struct work_pool *pool;
+	unsigned id;
+};
+
+// Take the next task from our own range.
+static bool
+take_task(struct work_range *range, size_t *task) {
+	bool ok = false;
+	pthread_mutex_lock(&range->lock);
+	if (range->next < range->end) {
+		*task = range->next++;
+		ok = true;
+	}
+	pthread_mutex_unlock(&range->lock);
+	return ok;
+}
+
+// Steal the back half of the largest range belonging to another worker and make it our own.
+static bool
+steal_tasks(struct work_pool *pool, unsigned self) {
+	for (;;) {
+		// Find the victim. Its range may shrink before we lock it again, so we recheck.
+		unsigned victim = self;
+		size_t largest = 0;
+		for (unsigned i = 0; i < pool->n_workers; i++) {
+			if (i == self) {
+				continue;
+			}
+			struct work_range *range = &pool->ranges[i];
+			pthread_mutex_lock(&range->lock);
+			size_t size = range->end - range->next;
+			pthread_mutex_unlock(&range->lock);
+			if (size > largest) {
+				largest = size;
+				victim = i;
+			}
+		}
+		if (victim == self) {
+			return false;
+		}
+		struct work_range *from = &pool->ranges[victim];
+		struct work_range *to = &pool->ranges[self];
+		pthread_mutex_lock(&from->lock);
+		size_t left = from->end - from->next;
+		if (left == 0) {
+			// Someone else got there first; look again.
+			pthread_mutex_unlock(&from->lock);
+			continue;
+		}
+		size_t mid = from->end - (left + 1) / 2;
+		size_t end = from->end;
+		from->end = mid;
+		pthread_mutex_unlock(&from->lock);
+		pthread_mutex_lock(&to->lock);
+		to->next = mid;
+		to->end = end;
+		pthread_mutex_unlock(&to->lock);
+		return true;
+	}
+}
+
+static void *
+work_worker(void *arg) {
+	struct work_worker *worker = arg;
+	struct work_pool *pool = worker->pool;
+	struct work_range *range = &pool->ranges[worker->id];
+	for (;;) {
+		size_t task;
+		if (!take_task(range, &task)) {
+			if (!steal_tasks(pool, worker->id)) {
+				break;
+			}
+			continue;
+		}
+		pool->task_callback(task);
+		pthread_mutex_lock(&pool->done_lock);
+		pool->done[task] = true;
+		pthread_cond_broadcast(&pool->task_done);
+		pthread_mutex_unlock(&pool->done_lock);
+	}
+	return NULL;
+}
+
+void
+work_pool_run(size_t n_tasks, unsigned n_threads,
+		work_pool_task_callback_t task_callback,
+		work_pool_done_callback_t done_callback) {
+	if (n_tasks == 0) {
+		return;
+	}
+	if (n_threads == 0) {
+		long n_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		n_threads = (n_cpus > 0 ? n_cpus : 1);
+	}
+	if (n_threads > n_tasks) {
+		n_threads = n_tasks;
+	}
+	struct work_pool pool;
+	pool.task_callback = task_callback;
+	pool.n_workers = n_threads;
+	pool.ranges = malloc(n_threads * sizeof(*pool.ranges));
+	pool.done = calloc(n_tasks, sizeof(*pool.done));
+	struct work_worker *workers = malloc(n_threads * sizeof(*workers));
+	pthread_t *threads = malloc(n_threads * sizeof(*threads));
+	assert(pool.ranges != NULL && pool.done != NULL && workers != NULL && threads != NULL);
+	pthread_mutex_init(&pool.done_lock, NULL);
+	pthread_cond_init(&pool.task_done, NULL);
+	// Give each worker an equal contiguous share of the tasks to start with.
+	for (unsigned i = 0; i < n_threads; i++) {
+		pthread_mutex_init(&pool.ranges[i].lock, NULL);
+		pool.ranges[i].next = n_tasks * i / n_threads;
+		pool.ranges[i].end  = n_tasks * (i + 1) / n_threads;
+		workers[i].pool = &pool;
+		workers[i].id = i;
+	}
+	unsigned n_started = 0;
+	for (; n_started < n_threads; n_started++) {
+		int err = pthread_create(&threads[n_started], NULL, work_worker,
+				&workers[n_started]);
+		if (err != 0) {
+			break;
+		}
+	}
+	// If we couldn't start any threads, run the tasks ourselves. Any worker that did start
+	// will steal the tasks of the ones that didn't.
+	if (n_started == 0) {
+		work_worker(&workers[0]);
+	}
+	for (size_t task = 0; done_callback != NULL && task < n_tasks; task++) {
+		pthread_mutex_lock(&pool.done_lock);
+		while (!pool.done[task]) {
+			pthread_cond_wait(&pool.task_done, &pool.done_lock);
+		}
+		pthread_mutex_unlock(&pool.done_lock);
+		done_callback(task);
+	}
+	for (unsigned i = 0; i < n_started; i++) {
+		pthread_join(threads[i], NULL);
+	}
+	for (unsigned i = 0; i < n_threads; i++) {
+		pthread_mutex_destroy(&pool.ranges[i].lock);
+	}
+	pthread_cond_destroy(&pool.task_done);
+	pthread_mutex_destroy(&pool.done_lock);
+	free(threads);
+	free(workers);
+	free(pool.done);
+	free(pool.ranges);
+}
+
+// ---- Ordered pool ------------------------------------------------------------------------------
+
+struct ordered_pool {
+	work_pool_task_callback_t task_callback;
+	size_t n_tasks;
+	size_t window;
+	pthread_mutex_t lock;
+	// Signaled when a task finishes.
+	pthread_cond_t task_done;
+	// Signaled when the window moves forward.
+	pthread_cond_t window_moved;
+	// The next task to start.
+	size_t next;
+	// The number of tasks whose done callback has returned.
+	size_t delivered;
+	bool *done;
+};
+
+static void *
+ordered_worker(void *arg) {
+	struct ordered_pool *pool = arg;
+	pthread_mutex_lock(&pool->lock);
+	for (;;) {
+		while (pool->next < pool->n_tasks && pool->next - pool->delivered >= pool->window) {
+			pthread_cond_wait(&pool->window_moved, &pool->lock);
+		}
+		if (pool->next >= pool->n_tasks) {
+			break;
+		}
+		size_t task = pool->next++;
+		pthread_mutex_unlock(&pool->lock);
+		pool->task_callback(task);
+		pthread_mutex_lock(&pool->lock);
+		pool->done[task] = true;
+		pthread_cond_broadcast(&pool->task_done);
+	}
+	pthread_mutex_unlock(&pool->lock);
+	return NULL;
+}
+
+void
+work_pool_run_ordered(size_t n_tasks, unsigned n_threads, size_t window,
+		work_pool_task_callback_t task_callback,
+		work_pool_done_callback_t done_callback) {
+	if (n_tasks == 0) {
+		return;
+	}
+	if (n_threads == 0) {
+		long n_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		n_threads = (n_cpus > 0 ? n_cpus : 1);
+	}
+	if (n_threads > n_tasks) {
+		n_threads = n_tasks;
+	}
+	if (window == 0) {
+		window = 1;
+	}
+	struct ordered_pool pool = {
+		.task_callback = task_callback,
+		.n_tasks       = n_tasks,
+		.window        = window,
+	};
+	pool.done = calloc(n_tasks, sizeof(*pool.done));
+	pthread_t *threads = malloc(n_threads * sizeof(*threads));
+	assert(pool.done != NULL && threads != NULL);
+	pthread_mutex_init(&pool.lock, NULL);
+	pthread_cond_init(&pool.task_done, NULL);
+	pthread_cond_init(&pool.window_moved, NULL);
+	unsigned n_started = 0;
+	for (; n_started < n_threads; n_started++) {
+		int err = pthread_create(&threads[n_started], NULL, ordered_worker, &pool);
+		if (err != 0) {
+			break;
+		}
+	}
+	for (size_t task = 0; task < n_tasks; task++) {
+		if (n_started == 0) {
+			// We couldn't start any threads, so run each task ourselves.
+			task_callback(task);
+		} else {
+			pthread_mutex_lock(&pool.lock);
+			while (!pool.done[task]) {
+				pthread_cond_wait(&pool.task_done, &pool.lock);
+			}
+			pthread_mutex_unlock(&pool.lock);
+		}
+		if (done_callback != NULL) {
+			done_callback(task);
+		}
+		pthread_mutex_lock(&pool.lock);
+		pool.delivered = task + 1;
+		pthread_cond_broadcast(&pool.window_moved);
+		pthread_mutex_unlock(&pool.lock);
+	}
+	for (unsigned i = 0; i < n_started; i++) {
+		pthread_join(threads[i], NULL);
+	}
+	pthread_cond_destroy(&pool.window_moved);
+	pthread_cond_destroy(&pool.task_done);
+	pthread_mutex_destroy(&pool.lock);
+	free(threads);
+	free(pool.done);
+}
@@ -0,0 +1,33 @@
+/*
+ * work-pool.h
+ * Brandon Azad
+ */
+#ifndef WORK_POOL__H_
+#define WORK_POOL__H_
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Run one task. This is called on a worker thread, concurrently with other tasks.
+typedef void (^work_pool_task_callback_t)(size_t task);
+
+// Called on the calling thread once per task, in task order, after the task has run.
+typedef void (^work_pool_done_callback_t)(size_t task);
+
+// Run tasks 0 through n_tasks - 1 on n_threads worker threads (one per CPU if n_threads is 0).
+// Each worker starts with its own contiguous range of tasks and takes them from the front. A
+// worker that runs out steals the back half of the largest remaining range, so tasks of very
+// different sizes still keep every worker busy. The done callback may be NULL.
+void work_pool_run(size_t n_tasks, unsigned n_threads,
+		work_pool_task_callback_t task_callback,
+		work_pool_done_callback_t done_callback);
+
+// Like work_pool_run(), but the workers take tasks strictly in order, and a task is not started
+// until the done callback has returned for every task at least window tasks before it. At most
+// window tasks are ever waiting for their done callback, which bounds how many results the
+// caller has to hold at once.
+void work_pool_run_ordered(size_t n_tasks, unsigned n_threads, size_t window,
+		work_pool_task_callback_t task_callback,
+		work_pool_done_callback_t done_callback);
+
+#endif